@@ -0,0 +1,87 @@
+/***********************************************************************************
+* Copyright (c) 2016, Johan Mabille, Loic Gouarin, Sylvain Corlay, Wolf Vollprecht *
+* Copyright (c) 2016, QuantStack                                                   *
+*                                                                                  *
+* Distributed under the terms of the BSD 3-Clause License.                         *
+*                                                                                  *
+* The full license is in the file LICENSE, distributed with this software.         *
+************************************************************************************/
+
+#include <cstddef>
+#include <functional>
+#include <ostream>
+#include <string>
+
+#include "benchmark/benchmark.h"
+
+#include "xeus-cling/xbuffer.hpp"
+
+namespace
+{
+    const std::string line = "The quick brown fox jumps over the lazy dog, again and again and again.\n";
+
+    struct published
+    {
+        std::size_t bytes = 0;
+
+        void operator()(const std::string& output, const xcpp::xoutput_origin&)
+        {
+            bytes += output.size();
+        }
+    };
+}
+
+// A loop printing with '\n', flushed when the cell ends.
+void BM_output_buffer_write(benchmark::State& state)
+{
+    published callback;
+    xcpp::xoutput_buffer buffer(std::ref(callback));
+    std::ostream os(&buffer);
+    std::size_t lines = 0;
+    for (auto _ : state)
+    {
+        os << line;
+        // Bounds the size of the buffer, as the end of a cell would.
+        if (++lines % 1024 == 0)
+        {
+            os.flush();
+        }
+    }
+    os.flush();
+    state.SetBytesProcessed(static_cast<int64_t>(callback.bytes));
+}
+BENCHMARK(BM_output_buffer_write);
+
+// A loop printing character by character.
+void BM_output_buffer_put(benchmark::State& state)
+{
+    published callback;
+    xcpp::xoutput_buffer buffer(std::ref(callback));
+    std::ostream os(&buffer);
+    std::size_t characters = 0;
+    for (auto _ : state)
+    {
+        os.put('x');
+        if (++characters % (1024 * 64) == 0)
+        {
+            os.flush();
+        }
+    }
+    os.flush();
+    state.SetBytesProcessed(static_cast<int64_t>(callback.bytes));
+}
+BENCHMARK(BM_output_buffer_put);
+
+// A loop printing with std::endl, each line being published.
+void BM_output_buffer_flush(benchmark::State& state)
+{
+    published callback;
+    xcpp::xoutput_buffer buffer(std::ref(callback));
+    std::ostream os(&buffer);
+    for (auto _ : state)
+    {
+        os << line << std::flush;
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(callback.bytes));
+}
+BENCHMARK(BM_output_buffer_flush);
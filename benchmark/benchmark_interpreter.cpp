@@ -0,0 +1,123 @@
+/***********************************************************************************
+* Copyright (c) 2016, Johan Mabille, Loic Gouarin, Sylvain Corlay, Wolf Vollprecht *
+* Copyright (c) 2016, QuantStack                                                   *
+*                                                                                  *
+* Distributed under the terms of the BSD 3-Clause License.                         *
+*                                                                                  *
+* The full license is in the file LICENSE, distributed with this software.         *
+************************************************************************************/
+
+#include <string>
+
+#include "benchmark/benchmark.h"
+
+#include "nlohmann/json.hpp"
+
+#include "xdriver.hpp"
+
+namespace nl = nlohmann;
+
+namespace
+{
+    nl::json execute(const std::string& code)
+    {
+        return xcpp::driver().execute_request(code, false, true, nl::json::object(), false);
+    }
+
+    // Declares the variables displayed by BM_mime_repr, once.
+    void declare_variables()
+    {
+        static bool declared = false;
+        if (!declared)
+        {
+            execute("#include <map>\n"
+                    "#include <string>\n"
+                    "#include <vector>\n"
+                    "int bm_int = 42;\n"
+                    "double bm_double = 3.14;\n"
+                    "std::string bm_string = \"Hello, World!\";\n"
+                    "std::vector<double> bm_vector(100, 1.);\n"
+                    "std::map<std::string, int> bm_map = {{\"one\", 1}, {\"two\", 2}};");
+            declared = true;
+        }
+    }
+
+    void count_messages(benchmark::State& state, std::size_t before)
+    {
+        state.counters["messages"] = benchmark::Counter(static_cast<double>(xcpp::published_messages() - before),
+                                                        benchmark::Counter::kAvgIterations);
+    }
+}
+
+// Dispatch of a line magic doing almost nothing.
+void BM_magic_dispatch(benchmark::State& state)
+{
+    std::size_t before = xcpp::published_messages();
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(execute("%optlevel"));
+    }
+    count_messages(state, before);
+}
+BENCHMARK(BM_magic_dispatch)->Unit(benchmark::kMicrosecond);
+
+// The help preamble, which looks the name up in the tagfiles.
+void BM_inspect_preamble(benchmark::State& state)
+{
+    std::size_t before = xcpp::published_messages();
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(execute("?std::vector"));
+    }
+    count_messages(state, before);
+}
+BENCHMARK(BM_inspect_preamble)->Unit(benchmark::kMillisecond);
+
+void BM_inspect_request(benchmark::State& state)
+{
+    const std::string code = "std::vector";
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(xcpp::driver().inspect_request(code, static_cast<int>(code.size()), 0));
+    }
+}
+BENCHMARK(BM_inspect_request)->Unit(benchmark::kMillisecond);
+
+void BM_complete_request(benchmark::State& state)
+{
+    const std::string code = "std::vec";
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(xcpp::driver().complete_request(code, static_cast<int>(code.size())));
+    }
+}
+BENCHMARK(BM_complete_request)->Unit(benchmark::kMillisecond);
+
+void BM_is_complete_request(benchmark::State& state)
+{
+    const std::string code = "for (int i = 0; i < 10; ++i)\n{\n    std::cout << i;\n";
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(xcpp::driver().is_complete_request(code));
+    }
+}
+BENCHMARK(BM_is_complete_request)->Unit(benchmark::kMicrosecond);
+
+// Execution of a cell made of a variable, whose value is displayed as an
+// execute_result with mime_repr. Re-running the same cell unloads its
+// previous run, so that the iterations do not pile up transactions.
+void BM_mime_repr(benchmark::State& state, const char* variable)
+{
+    declare_variables();
+    std::size_t before = xcpp::published_messages();
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(execute(variable));
+    }
+    count_messages(state, before);
+}
+BENCHMARK_CAPTURE(BM_mime_repr, int, "bm_int")->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_mime_repr, double, "bm_double")->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_mime_repr, string, "bm_string")->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_mime_repr, vector, "bm_vector")->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_mime_repr, map, "bm_map")->Unit(benchmark::kMillisecond);
@@ -0,0 +1,75 @@
+/***********************************************************************************
+* Copyright (c) 2016, Johan Mabille, Loic Gouarin, Sylvain Corlay, Wolf Vollprecht *
+* Copyright (c) 2016, QuantStack                                                   *
+*                                                                                  *
+* Distributed under the terms of the BSD 3-Clause License.                         *
+*                                                                                  *
+* The full license is in the file LICENSE, distributed with this software.         *
+************************************************************************************/
+
+#include <string>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+
+#include "xparser.hpp"
+
+namespace
+{
+    // A typical cell, split before being processed.
+    const std::string cell =
+        "#include <algorithm>\n"
+        "#include <vector>\n"
+        "\n"
+        "std::vector<double> v(1000, 1.);\n"
+        "std::sort(v.begin(), v.end());\n"
+        "#include <numeric>\n"
+        "double total = std::accumulate(v.begin(), v.end(), 0.);\n"
+        "total";
+
+    // Delimiters of complete_request.
+    const std::string delims = " \t\n`!@#$^&*()=+[{]}\\|;:\'\",<>?.";
+
+    // Results of codeComplete, as cling returns them.
+    const std::vector<std::string> completions = {
+        "[#void#]push_back(<#const value_type &__x#>)",
+        "[#size_type#]size()[# const#]",
+        "[#iterator#]insert(<#const_iterator __position#>, <#const value_type &__x#>)",
+        "vector<<#typename _Tp#>, <#typename _Alloc#>>",
+        "value_type"
+    };
+}
+
+void BM_split_from_includes(benchmark::State& state)
+{
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(xcpp::split_from_includes(cell));
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * cell.size()));
+}
+BENCHMARK(BM_split_from_includes);
+
+void BM_split_line(benchmark::State& state)
+{
+    std::string code = cell + ";\nv.push_ba";
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(xcpp::split_line(code, delims, code.size() - 1));
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * code.size()));
+}
+BENCHMARK(BM_split_line);
+
+void BM_clean_completion(benchmark::State& state)
+{
+    for (auto _ : state)
+    {
+        for (const auto& completion : completions)
+        {
+            benchmark::DoNotOptimize(xcpp::clean_completion(completion));
+        }
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * completions.size()));
+}
+BENCHMARK(BM_clean_completion);
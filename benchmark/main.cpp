@@ -0,0 +1,37 @@
+/***********************************************************************************
+* Copyright (c) 2016, Johan Mabille, Loic Gouarin, Sylvain Corlay, Wolf Vollprecht *
+* Copyright (c) 2016, QuantStack                                                   *
+*                                                                                  *
+* Distributed under the terms of the BSD 3-Clause License.                         *
+*                                                                                  *
+* The full license is in the file LICENSE, distributed with this software.         *
+************************************************************************************/
+
+#include <iostream>
+#include <ostream>
+
+#include "benchmark/benchmark.h"
+
+#include "xdriver.hpp"
+
+int main(int argc, char* argv[])
+{
+    ::benchmark::Initialize(&argc, argv);
+    if (::benchmark::ReportUnrecognizedArguments(argc, argv))
+    {
+        return 1;
+    }
+
+    // Saved before the interpreter redirects them.
+    std::ostream out(std::cout.rdbuf());
+    std::ostream err(std::cerr.rdbuf());
+
+    xcpp::start_driver();
+    ::benchmark::ConsoleReporter reporter;
+    reporter.SetOutputStream(&out);
+    reporter.SetErrorStream(&err);
+    // The JSON file given with --benchmark_out is written by the library.
+    ::benchmark::RunSpecifiedBenchmarks(&reporter);
+    xcpp::stop_driver();
+    return 0;
+}
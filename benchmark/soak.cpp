@@ -0,0 +1,293 @@
+/***********************************************************************************
+* Copyright (c) 2016, Johan Mabille, Loic Gouarin, Sylvain Corlay, Wolf Vollprecht *
+* Copyright (c) 2016, QuantStack                                                   *
+*                                                                                  *
+* Distributed under the terms of the BSD 3-Clause License.                         *
+*                                                                                  *
+* The full license is in the file LICENSE, distributed with this software.         *
+************************************************************************************/
+
+// Soak test: runs thousands of representative cells through the interpreter
+// and reports how its memory and state grow over a long session.
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "nlohmann/json.hpp"
+
+#include "xdriver.hpp"
+#include "xmemory.hpp"
+
+namespace nl = nlohmann;
+
+namespace
+{
+    const char* usage =
+        "Usage: soak_xeus_cling [options]\n"
+        "\n"
+        "  --cells N                   number of cells run after the warm-up (default: 5000)\n"
+        "  --warmup N                  number of cells run before the reference sample (default: 100)\n"
+        "  --interval N                number of cells between two samples (default: 250)\n"
+        "  --output FILE               write the samples and the growth as JSON\n"
+        "  --max-resident-growth MB    fail if the resident memory grows by more than MB\n"
+        "  --max-jit-growth MB         fail if the JIT code grows by more than MB\n"
+        "  --max-ast-growth MB         fail if the AST grows by more than MB\n"
+        "  --max-transaction-growth N  fail if more than N transactions are added\n";
+
+    struct options
+    {
+        std::size_t cells = 5000;
+        std::size_t warmup = 100;
+        std::size_t interval = 250;
+        std::string output;
+        // Limits of the growth, negative when not checked.
+        double max_resident_growth = -1.;
+        double max_jit_growth = -1.;
+        double max_ast_growth = -1.;
+        double max_transaction_growth = -1.;
+    };
+
+    bool parse_options(int argc, char* argv[], options& res)
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string arg = argv[i];
+            if (i + 1 == argc)
+            {
+                return false;
+            }
+            std::string value = argv[++i];
+            std::size_t count = static_cast<std::size_t>(std::max(1l, std::strtol(value.c_str(), nullptr, 10)));
+            double limit = std::atof(value.c_str());
+            if (arg == "--cells")
+            {
+                res.cells = count;
+            }
+            else if (arg == "--warmup")
+            {
+                res.warmup = count;
+            }
+            else if (arg == "--interval")
+            {
+                res.interval = count;
+            }
+            else if (arg == "--output")
+            {
+                res.output = value;
+            }
+            else if (arg == "--max-resident-growth")
+            {
+                res.max_resident_growth = limit * 1024 * 1024;
+            }
+            else if (arg == "--max-jit-growth")
+            {
+                res.max_jit_growth = limit * 1024 * 1024;
+            }
+            else if (arg == "--max-ast-growth")
+            {
+                res.max_ast_growth = limit * 1024 * 1024;
+            }
+            else if (arg == "--max-transaction-growth")
+            {
+                res.max_transaction_growth = limit;
+            }
+            else
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    nl::json execute(const std::string& code)
+    {
+        return xcpp::driver().execute_request(code, false, true, nl::json::object(), false);
+    }
+
+    const std::string setup =
+        "#include <iostream>\n"
+        "#include <map>\n"
+        "#include <numeric>\n"
+        "#include <string>\n"
+        "#include <vector>\n"
+        "std::vector<double> soak_vector(1000, 1.);\n"
+        "std::map<std::string, int> soak_map = {{\"one\", 1}, {\"two\", 2}};\n"
+        "std::size_t soak_total = 0;";
+
+    // What a user does in a notebook, in turn: the same few cells are run
+    // again and again, so any growth comes from the kernel rather than from
+    // new declarations.
+    std::vector<std::function<bool()>> representative_cells()
+    {
+        auto cell = [](std::string code)
+        {
+            // Magics do not report a status.
+            return [code]() { return execute(code).value("status", "ok") != "error"; };
+        };
+        return {
+            cell("soak_vector"),
+            cell("soak_map"),
+            cell("%timeit -n 10 -r 3 std::accumulate(soak_vector.begin(), soak_vector.end(), 0.)"),
+            cell("soak_total += soak_vector.size();"),
+            cell("for (int i = 0; i < 10; ++i)\n{\n    std::cout << i << ' ';\n}\nstd::cout << std::endl;"),
+            []()
+            {
+                // Fails when the tagfiles are not installed, which is not
+                // what is measured here.
+                execute("?std::vector");
+                return true;
+            },
+            []()
+            {
+                std::string code = "soak_vec";
+                return xcpp::driver().complete_request(code, static_cast<int>(code.size())).value("status", "") == "ok";
+            },
+            []()
+            {
+                std::string code = "soak_map";
+                xcpp::driver().inspect_request(code, static_cast<int>(code.size()), 0);
+                return true;
+            }
+        };
+    }
+
+    struct metric
+    {
+        const char* key;
+        const char* title;
+        bool bytes;
+        double limit;
+    };
+
+    std::string format(const metric& m, double value)
+    {
+        if (m.bytes)
+        {
+            return xcpp::format_memory(value);
+        }
+        std::ostringstream os;
+        os << std::fixed << std::setprecision(0) << value;
+        return os.str();
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    options opts;
+    if (!parse_options(argc, argv, opts))
+    {
+        std::cerr << usage;
+        return 2;
+    }
+
+    // Saved before the interpreter redirects them.
+    std::ostream out(std::cout.rdbuf());
+    std::ostream err(std::cerr.rdbuf());
+
+    xcpp::start_driver();
+    if (execute(setup).value("status", "") != "ok")
+    {
+        err << "The setup cell failed" << std::endl;
+        return 2;
+    }
+
+    auto cells = representative_cells();
+    std::size_t errors = 0;
+    std::size_t run = 0;
+    auto run_cells = [&](std::size_t count)
+    {
+        for (std::size_t i = 0; i < count; ++i, ++run)
+        {
+            if (!cells[run % cells.size()]())
+            {
+                ++errors;
+            }
+        }
+    };
+
+    run_cells(opts.warmup);
+    errors = 0;
+
+    const std::vector<metric> metrics = {
+        {"resident", "Resident", true, opts.max_resident_growth},
+        {"jit_code", "JIT code", true, opts.max_jit_growth},
+        {"ast", "AST", true, opts.max_ast_growth},
+        {"declarations", "Declarations", false, -1.},
+        {"transactions", "Transactions", false, opts.max_transaction_growth}
+    };
+
+    out << std::setw(8) << "Cells" << std::setw(10) << "Time (s)";
+    for (const auto& m : metrics)
+    {
+        out << std::setw(14) << m.title;
+    }
+    out << std::endl;
+
+    auto start = std::chrono::steady_clock::now();
+    nl::json samples = nl::json::array();
+    auto sample = [&](std::size_t cells_run)
+    {
+        nl::json s = xcpp::driver().memory_statistics();
+        s["cells"] = cells_run;
+        s["seconds"] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        out << std::setw(8) << cells_run << std::setw(10) << std::fixed << std::setprecision(1)
+            << s["seconds"].get<double>();
+        for (const auto& m : metrics)
+        {
+            out << std::setw(14) << format(m, s[m.key].get<double>());
+        }
+        out << std::endl;
+        samples.push_back(std::move(s));
+    };
+
+    sample(0);
+    for (std::size_t done = 0; done < opts.cells;)
+    {
+        std::size_t count = std::min(opts.interval, opts.cells - done);
+        run_cells(count);
+        done += count;
+        sample(done);
+    }
+
+    // The growth is measured from the sample taken after the warm-up, which
+    // includes the one-off costs such as the first display.
+    const nl::json& first = samples.front();
+    const nl::json& last = samples.back();
+    nl::json growth;
+    bool success = true;
+    out << "\nGrowth over " << opts.cells << " cells (" << errors << " errors):" << std::endl;
+    for (const auto& m : metrics)
+    {
+        double value = last[m.key].get<double>() - first[m.key].get<double>();
+        double per_cell = value / static_cast<double>(opts.cells);
+        growth[m.key] = {{"total", value}, {"per_cell", per_cell}};
+        out << "  " << std::left << std::setw(14) << m.title << std::right << std::setw(12) << format(m, value)
+            << "  (" << format(m, per_cell * 1000) << " per 1000 cells)";
+        if (m.limit >= 0. && value > m.limit)
+        {
+            out << "  exceeds the limit of " << format(m, m.limit);
+            success = false;
+        }
+        out << std::endl;
+    }
+
+    if (!opts.output.empty())
+    {
+        nl::json report = {{"cells", opts.cells}, {"warmup", opts.warmup}, {"errors", errors},
+                           {"samples", samples}, {"growth", growth}};
+        std::ofstream(opts.output) << report.dump(4) << std::endl;
+    }
+
+    xcpp::stop_driver();
+    return success ? 0 : 1;
+}
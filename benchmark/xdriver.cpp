@@ -0,0 +1,65 @@
+/***********************************************************************************
+* Copyright (c) 2016, Johan Mabille, Loic Gouarin, Sylvain Corlay, Wolf Vollprecht *
+* Copyright (c) 2016, QuantStack                                                   *
+*                                                                                  *
+* Distributed under the terms of the BSD 3-Clause License.                         *
+*                                                                                  *
+* The full license is in the file LICENSE, distributed with this software.         *
+************************************************************************************/
+
+#include <memory>
+#include <string>
+
+#include "nlohmann/json.hpp"
+
+#include "xdriver.hpp"
+
+namespace nl = nlohmann;
+
+namespace xcpp
+{
+    namespace
+    {
+        std::unique_ptr<interpreter>& driver_instance()
+        {
+            static std::unique_ptr<interpreter> instance;
+            return instance;
+        }
+
+        std::size_t& message_count()
+        {
+            static std::size_t count = 0;
+            return count;
+        }
+    }
+
+    void start_driver()
+    {
+        // Same arguments as the kernelspec of xcpp14, the headers of xcpp
+        // being taken from the source tree.
+        std::string llvm_include_dir = std::string(LLVM_DIR) + "/include";
+        const char* argv[] = {"xeus-cling", "-std=c++14", "-I" XCPP_INCLUDE_DIR, llvm_include_dir.c_str()};
+        driver_instance().reset(new interpreter(4, argv));
+        driver_instance()->register_publisher(
+            [](const std::string& /*msg_type*/, nl::json /*metadata*/, nl::json /*content*/, auto&& /*buffers*/)
+            {
+                ++message_count();
+            });
+        driver_instance()->configure();
+    }
+
+    void stop_driver()
+    {
+        driver_instance().reset();
+    }
+
+    interpreter& driver()
+    {
+        return *driver_instance();
+    }
+
+    std::size_t published_messages()
+    {
+        return message_count();
+    }
+}
@@ -0,0 +1,37 @@
+/***********************************************************************************
+* Copyright (c) 2016, Johan Mabille, Loic Gouarin, Sylvain Corlay, Wolf Vollprecht *
+* Copyright (c) 2016, QuantStack                                                   *
+*                                                                                  *
+* Distributed under the terms of the BSD 3-Clause License.                         *
+*                                                                                  *
+* The full license is in the file LICENSE, distributed with this software.         *
+************************************************************************************/
+
+#ifndef XCPP_BENCHMARK_DRIVER_HPP
+#define XCPP_BENCHMARK_DRIVER_HPP
+
+#include <cstddef>
+
+#include "xeus-cling/xinterpreter.hpp"
+
+namespace xcpp
+{
+    /**
+     * Builds the interpreter the benchmarks send their requests to, in
+     * process and without the Jupyter protocol. The messages it publishes
+     * are counted and dropped.
+     *
+     * The interpreter redirects std::cout and std::cerr for its whole
+     * lifetime, so the results are reported to the streams saved before it
+     * is started.
+     */
+    void start_driver();
+    void stop_driver();
+
+    interpreter& driver();
+
+    // Number of messages published by the interpreter since it was built.
+    std::size_t published_messages();
+}
+
+#endif
@@ -0,0 +1,26 @@
+/***********************************************************************************
+* Copyright (c) 2016, Johan Mabille, Loic Gouarin, Sylvain Corlay, Wolf Vollprecht *
+* Copyright (c) 2016, QuantStack                                                   *
+*                                                                                  *
+* Distributed under the terms of the BSD 3-Clause License.                         *
+*                                                                                  *
+* The full license is in the file LICENSE, distributed with this software.         *
+************************************************************************************/
+
+#ifndef XCPP_JOB_HPP
+#define XCPP_JOB_HPP
+
+#include "xeus-cling/xeus_cling_config.hpp"
+
+namespace xcpp
+{
+    /**
+     * Whether %kill was called for the %%background job running on the
+     * calling thread, always false outside of a job. A thread cannot be
+     * stopped from the outside: long running jobs check it regularly and
+     * return when it is set.
+     */
+    XEUS_CLING_API bool stop_requested() noexcept;
+}
+
+#endif
@@ -10,11 +10,17 @@
 #ifndef XCPP_MESSAGING_BUFFER_HPP
 #define XCPP_MESSAGING_BUFFER_HPP
 
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
 #include <functional>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <streambuf>
 #include <string>
+#include <thread>
+#include <vector>
 
 namespace xcpp
 {
@@ -22,55 +28,251 @@ namespace xcpp
      * output streambuf *
      ********************/
 
+    /**
+     * Where a piece of output comes from: the writer thread, numbered in the
+     * order threads first write to the buffer, and the cell that was running
+     * when it first wrote.
+     */
+    struct xoutput_origin
+    {
+        std::size_t thread;
+        std::size_t cell;
+        // Whether the cell is still running. If not, the thread outlived it.
+        bool current;
+        // Whether the thread has exited, this being its last output.
+        bool finished;
+    };
+
+    /**
+     * Each writer thread appends to a buffer of its own, so that threads
+     * printing concurrently do not wait for each other. The callback is only
+     * called by the kernel thread, the one that created the buffer, when it
+     * flushes its own output and when the cell ends, and by the flusher that
+     * drains the output of the other threads with flush_threads. Those only
+     * append and, when they flush, call the notify function to wake the
+     * flusher up.
+     */
     class xoutput_buffer : public std::streambuf
     {
     public:
 
         using base_type = std::streambuf;
-        using callback_type = std::function<void(const std::string&)>;
+        using callback_type = std::function<void(const std::string&, const xoutput_origin&)>;
+        using notify_type = std::function<void()>;
         using traits_type = base_type::traits_type;
 
-        xoutput_buffer(callback_type callback)
-            : m_callback(std::move(callback))
+        xoutput_buffer(callback_type callback, notify_type notify = notify_type())
+            : m_callback(std::move(callback)), m_notify(std::move(notify)), m_id(next_id()),
+              m_kernel_thread(std::this_thread::get_id()), m_cell(0), m_next_thread(0)
+        {
+        }
+
+        // Called by the thread running the cells: the threads writing for the
+        // first time until end_cell are attributed to this cell.
+        void begin_cell(std::size_t cell)
+        {
+            m_cell = cell;
+            local().cell = cell;
+        }
+
+        // Attributes the calling thread to the running cell before it writes
+        // anything, as if it had written now.
+        void track_thread()
+        {
+            local();
+        }
+
+        // Passes the pending output of all the threads to the callback, and
+        // returns the threads of the cell that wrote and are still running.
+        std::vector<std::size_t> end_cell()
+        {
+            flush_all();
+            std::vector<std::size_t> res;
+            const thread_output* self = &local();
+            {
+                std::lock_guard<std::mutex> lock(m_threads_mutex);
+                for (const auto& output : m_threads)
+                {
+                    if (output.get() != self && output->cell == m_cell && !output->finished)
+                    {
+                        res.push_back(output->thread);
+                    }
+                }
+            }
+            m_cell = 0;
+            return res;
+        }
+
+        // Whether one of the threads returned by end_cell is still running.
+        bool running(const std::vector<std::size_t>& threads)
+        {
+            std::lock_guard<std::mutex> lock(m_threads_mutex);
+            return std::any_of(m_threads.begin(), m_threads.end(),
+                               [&threads](const std::shared_ptr<thread_output>& output)
+                               {
+                                   return !output->finished &&
+                                          std::find(threads.begin(), threads.end(), output->thread) != threads.end();
+                               });
+        }
+
+        // Passes the pending output of all the threads to the callback.
+        void flush_all()
         {
+            drain(true);
+        }
+
+        // Passes the pending output of the threads other than the kernel
+        // thread to the callback.
+        void flush_threads()
+        {
+            drain(false);
         }
 
     protected:
 
         traits_type::int_type overflow(traits_type::int_type c) override
         {
-            std::lock_guard<std::mutex> lock(m_mutex);
             // Called for each output character.
             if (!traits_type::eq_int_type(c, traits_type::eof()))
             {
-                m_output.push_back(traits_type::to_char_type(c));
+                thread_output& output = local();
+                std::lock_guard<std::mutex> lock(output.mutex);
+                output.pending.push_back(traits_type::to_char_type(c));
             }
             return c;
         }
 
         std::streamsize xsputn(const char* s, std::streamsize count) override
         {
-            std::lock_guard<std::mutex> lock(m_mutex);
             // Called for a string of characters.
-            m_output.append(s, count);
+            thread_output& output = local();
+            std::lock_guard<std::mutex> lock(output.mutex);
+            output.pending.append(s, static_cast<std::size_t>(count));
             return count;
         }
 
         traits_type::int_type sync() override
         {
-            std::lock_guard<std::mutex> lock(m_mutex);
-            // Called in case of flush.
-            if (!m_output.empty())
+            // Called in case of flush. The kernel thread passes its own
+            // output to the callback, the other threads leave theirs to the
+            // flusher.
+            thread_output& output = local();
+            if (output.kernel)
+            {
+                publish(output);
+            }
+            else if (m_notify)
             {
-                m_callback(m_output);
-                m_output.clear();
+                m_notify();
             }
             return 0;
         }
 
+    private:
+
+        struct thread_output
+        {
+            // Only held by the writer thread and by the flushing thread.
+            std::mutex mutex;
+            std::string pending;
+            std::size_t thread = 0;
+            std::size_t cell = 0;
+            bool kernel = false;
+            std::atomic<bool> finished{false};
+        };
+
+        void drain(bool kernel)
+        {
+            std::vector<std::shared_ptr<thread_output>> threads;
+            {
+                std::lock_guard<std::mutex> lock(m_threads_mutex);
+                threads = m_threads;
+            }
+            for (const auto& output : threads)
+            {
+                if (kernel || !output->kernel)
+                {
+                    publish(*output);
+                }
+            }
+
+            // The threads that exited have nothing left to write.
+            std::lock_guard<std::mutex> lock(m_threads_mutex);
+            m_threads.erase(std::remove_if(m_threads.begin(), m_threads.end(),
+                                           [](const std::shared_ptr<thread_output>& output)
+                                           {
+                                               std::lock_guard<std::mutex> output_lock(output->mutex);
+                                               return output->finished && output->pending.empty();
+                                           }),
+                            m_threads.end());
+        }
+
+        // Buffers of a thread, by id of xoutput_buffer, marked as finished
+        // when the thread exits.
+        struct thread_registry
+        {
+            std::map<std::size_t, std::shared_ptr<thread_output>> outputs;
+
+            ~thread_registry()
+            {
+                for (auto& output : outputs)
+                {
+                    output.second->finished = true;
+                }
+            }
+        };
+
+        static std::size_t next_id()
+        {
+            static std::atomic<std::size_t> id(0);
+            return ++id;
+        }
+
+        thread_output& local()
+        {
+            thread_local thread_registry registry;
+            auto it = registry.outputs.find(m_id);
+            if (it != registry.outputs.end())
+            {
+                return *(it->second);
+            }
+            auto output = std::make_shared<thread_output>();
+            {
+                std::lock_guard<std::mutex> lock(m_threads_mutex);
+                output->thread = m_next_thread++;
+                output->cell = m_cell;
+                output->kernel = std::this_thread::get_id() == m_kernel_thread;
+                m_threads.push_back(output);
+            }
+            registry.outputs[m_id] = output;
+            return *output;
+        }
+
+        void publish(thread_output& output)
+        {
+            // Flushes are serialized, the writers are not.
+            std::lock_guard<std::mutex> lock(m_publish_mutex);
+            std::string text;
+            {
+                std::lock_guard<std::mutex> output_lock(output.mutex);
+                text.swap(output.pending);
+            }
+            xoutput_origin origin = {output.thread, output.cell, output.cell == m_cell, output.finished};
+            if (!text.empty() || (origin.finished && !origin.current))
+            {
+                m_callback(text, origin);
+            }
+        }
+
         callback_type m_callback;
-        std::string m_output;
-        std::mutex m_mutex;
+        notify_type m_notify;
+        const std::size_t m_id;
+        const std::thread::id m_kernel_thread;
+        std::atomic<std::size_t> m_cell;
+        std::size_t m_next_thread;
+        std::vector<std::shared_ptr<thread_output>> m_threads;
+        std::mutex m_threads_mutex;
+        std::mutex m_publish_mutex;
     };
 
     /*******************
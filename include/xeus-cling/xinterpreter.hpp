@@ -10,11 +10,20 @@
 #ifndef XEUS_CLING_INTERPRETER_HPP
 #define XEUS_CLING_INTERPRETER_HPP
 
+#include <condition_variable>
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <streambuf>
 #include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 
 #include "cling/Interpreter/Interpreter.h"
+#include "cling/Interpreter/Transaction.h"
 #include "cling/MetaProcessor/InputValidator.h"
 
 #include "nlohmann/json.hpp"
@@ -29,6 +38,10 @@ namespace nl = nlohmann;
 
 namespace xcpp
 {
+    class header_reloader;
+    class job_registry;
+    struct reset_request;
+
     class XEUS_CLING_API interpreter : public xeus::xinterpreter
     {
     public:
@@ -36,8 +49,14 @@ namespace xcpp
         interpreter(int argc, const char* const* argv);
         virtual ~interpreter();
 
-        void publish_stdout(const std::string&);
-        void publish_stderr(const std::string&);
+        void publish_stdout(const std::string&, const xoutput_origin&);
+        void publish_stderr(const std::string&, const xoutput_origin&);
+
+        // Memory used by the kernel and size of the state of the interpreter:
+        // "resident" and "jit_code" in bytes, "ast" the bytes allocated for
+        // the AST, "declarations" the number of top-level declarations and
+        // "transactions" the number of transactions.
+        nl::json memory_statistics();
 
     private:
 
@@ -70,12 +89,31 @@ namespace xcpp
         void redirect_output();
         void restore_output();
 
+        void publish_output(const std::string& name, const std::string& text, const xoutput_origin& origin);
+        void finish_cell_output();
+        void request_output_flush();
+        void flush_output();
+        void stop_output_flusher();
+
+        nl::json get_execution_metadata() const;
+
+        void unload_previous_cell(const std::string& code, std::size_t cell_hash);
+        void record_cell(std::size_t cell_hash, const cling::Transaction* previous,
+                         std::size_t threads_before);
+
         void init_preamble();
         void init_magic();
 
+        std::unique_ptr<cling::Interpreter> create_interpreter() const;
+        void request_reset(const reset_request& request);
+        void reset_interpreter(nl::json& kernel_res);
+
         std::string get_stdopt(int argc, const char* const* argv);
 
-        cling::Interpreter m_interpreter;
+        // Command-line arguments the interpreter was built with, kept to
+        // rebuild it in place on %reset.
+        std::vector<std::string> m_argv;
+        std::unique_ptr<cling::Interpreter> m_interpreter;
         cling::InputValidator m_input_validator;
         std::string m_version;
 
@@ -87,6 +125,55 @@ namespace xcpp
 
         xoutput_buffer m_cout_buffer;
         xoutput_buffer m_cerr_buffer;
+
+        // Displays showing the output of the threads that outlived the cell
+        // they first wrote in, by stream name and thread.
+        struct thread_display
+        {
+            nl::json display_id;
+            std::string text;
+        };
+        std::map<std::pair<std::string, std::size_t>, thread_display> m_thread_displays;
+        std::mutex m_thread_displays_mutex;
+
+        // Publishes the output the other threads flushed, so that they only
+        // append to their buffers and never publish themselves.
+        std::thread m_output_flusher;
+        std::mutex m_output_flush_mutex;
+        std::condition_variable m_output_flush_condition;
+        bool m_output_flush_requested;
+        bool m_output_flusher_stopped;
+
+        // Transactions produced by the last executed cell, identified by the
+        // hash of its content and by the names it declared. They are
+        // unloaded when the same cell is run again, or an edited cell
+        // declaring one of these names, as long as nothing was declared
+        // after them.
+        std::size_t m_last_cell_hash;
+        const cling::Transaction* p_last_cell_tail;
+        unsigned int m_last_cell_transactions;
+        std::set<std::string> m_last_cell_names;
+        // Which re-runs unload the last cell: "edited", "identical" or "off",
+        // set with %autounload.
+        std::string m_autounload;
+        // The threads of the process before the last cell ran, and the ones
+        // that wrote during the last cell and were still running when it
+        // ended: the cell is not unloaded while they may run its code.
+        std::size_t m_last_cell_threads_before;
+        std::vector<std::size_t> m_cell_cout_threads;
+        std::vector<std::size_t> m_cell_cerr_threads;
+
+        // Cells re-run after each %reset, set with the %%reset cell magic.
+        std::string m_prelude;
+        bool m_reset_pending;
+        bool m_reset_clear_prelude;
+
+        // Jobs started by %%background. They outlive a %reset, which is
+        // refused while one of them runs.
+        std::shared_ptr<job_registry> m_jobs;
+
+        // Local headers of the include blocks, reloaded when they change.
+        std::unique_ptr<header_reloader> p_header_reloader;
     };
 }
 
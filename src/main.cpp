@@ -18,6 +18,8 @@
 #include "xeus-cling/xinterpreter.hpp"
 #include "xeus-cling/xeus_cling_config.hpp"
 
+#include "xbatch.hpp"
+
 bool should_print_version(int argc, char* argv[])
 {
     for (int i = 0; i < argc; ++i)
@@ -87,6 +89,13 @@ int main(int argc, char* argv[])
         std::clog.setstate(std::ios_base::failbit);
     }
 
+    // Headless execution of notebooks, without a kernel.
+    xcpp::batch_options batch = xcpp::extract_batch_options(argc, argv);
+    if (!batch.notebooks.empty())
+    {
+        return xcpp::execute_notebooks(batch, [argc, argv]() { return build_interpreter(argc, argv); });
+    }
+
     std::string file_name = extract_filename(argc, argv);
 
     interpreter_ptr interpreter = build_interpreter(argc, argv);
@@ -0,0 +1,407 @@
+/***********************************************************************************
+* Copyright (c) 2016, Johan Mabille, Loic Gouarin, Sylvain Corlay, Wolf Vollprecht *
+* Copyright (c) 2016, QuantStack                                                   *
+*                                                                                  *
+* Distributed under the terms of the BSD 3-Clause License.                         *
+*                                                                                  *
+* The full license is in the file LICENSE, distributed with this software.         *
+************************************************************************************/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <cerrno>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "nlohmann/json.hpp"
+
+#include "xbatch.hpp"
+
+namespace nl = nlohmann;
+
+namespace xcpp
+{
+    batch_options extract_batch_options(int& argc, char* argv[])
+    {
+        batch_options res;
+        int kept = 1;
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string arg = argv[i];
+            if (arg == "--execute")
+            {
+                while (i + 1 < argc && argv[i + 1][0] != '-')
+                {
+                    res.notebooks.push_back(argv[++i]);
+                }
+            }
+            else if (arg == "--output" && i + 1 < argc)
+            {
+                res.output = argv[++i];
+            }
+            else if (arg == "-j" && i + 1 < argc)
+            {
+                res.jobs = static_cast<std::size_t>(std::max(1l, std::strtol(argv[++i], nullptr, 10)));
+            }
+            else if (arg == "--allow-errors")
+            {
+                res.allow_errors = true;
+            }
+            else
+            {
+                argv[kept++] = argv[i];
+            }
+        }
+        argc = kept;
+        return res;
+    }
+
+    namespace
+    {
+        std::string cell_source(const nl::json& cell)
+        {
+            const nl::json& source = cell["source"];
+            if (source.is_string())
+            {
+                return source.get<std::string>();
+            }
+            std::string res;
+            for (const auto& line : source)
+            {
+                res += line.get<std::string>();
+            }
+            return res;
+        }
+
+        bool expects_error(const nl::json& cell)
+        {
+            // Same convention as nbconvert.
+            auto metadata = cell.find("metadata");
+            if (metadata == cell.end() || !metadata->count("tags"))
+            {
+                return false;
+            }
+            for (const auto& tag : (*metadata)["tags"])
+            {
+                if (tag == "raises-exception")
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        std::string output_path(const std::string& input, const std::string& output)
+        {
+            if (!output.empty())
+            {
+                return output;
+            }
+            const std::string extension = ".ipynb";
+            std::string stem = input;
+            if (stem.size() > extension.size() &&
+                stem.compare(stem.size() - extension.size(), extension.size(), extension) == 0)
+            {
+                stem.resize(stem.size() - extension.size());
+            }
+            return stem + ".nbconvert" + extension;
+        }
+
+        // Records the messages published on IOPub as the outputs of the
+        // cell being executed, as a client would display them.
+        class output_collector
+        {
+        public:
+
+            output_collector(nl::json& cells)
+                : m_cells(cells)
+            {
+            }
+
+            void start(std::size_t cell)
+            {
+                m_cell = cell;
+                m_clear_pending = false;
+                m_cells[cell]["outputs"] = nl::json::array();
+            }
+
+            void publish(const std::string& msg_type, const nl::json& content)
+            {
+                if (msg_type == "update_display_data")
+                {
+                    update(content);
+                    return;
+                }
+                if (msg_type == "clear_output")
+                {
+                    if (content.value("wait", false))
+                    {
+                        m_clear_pending = true;
+                    }
+                    else
+                    {
+                        clear();
+                    }
+                    return;
+                }
+
+                nl::json& outputs = m_cells[m_cell]["outputs"];
+                nl::json output;
+                if (msg_type == "stream")
+                {
+                    if (!m_clear_pending && !outputs.empty() && outputs.back()["output_type"] == "stream" &&
+                        outputs.back()["name"] == content["name"])
+                    {
+                        outputs.back()["text"] = outputs.back()["text"].get<std::string>() +
+                                                 content["text"].get<std::string>();
+                        return;
+                    }
+                    output = {{"output_type", "stream"}, {"name", content["name"]}, {"text", content["text"]}};
+                }
+                else if (msg_type == "display_data")
+                {
+                    output = {{"output_type", "display_data"}, {"data", content["data"]},
+                              {"metadata", content.value("metadata", nl::json::object())}};
+                }
+                else if (msg_type == "execute_result")
+                {
+                    output = {{"output_type", "execute_result"}, {"data", content["data"]},
+                              {"metadata", content.value("metadata", nl::json::object())},
+                              {"execution_count", content["execution_count"]}};
+                }
+                else if (msg_type == "error")
+                {
+                    output = {{"output_type", "error"}, {"ename", content["ename"]},
+                              {"evalue", content["evalue"]}, {"traceback", content["traceback"]}};
+                }
+                else
+                {
+                    return;
+                }
+
+                if (m_clear_pending)
+                {
+                    clear();
+                }
+                outputs.push_back(std::move(output));
+
+                auto transient = content.find("transient");
+                if (transient != content.end() && transient->count("display_id"))
+                {
+                    m_displays[(*transient)["display_id"].get<std::string>()].emplace_back(m_cell, outputs.size() - 1);
+                }
+            }
+
+        private:
+
+            void clear()
+            {
+                m_clear_pending = false;
+                m_cells[m_cell]["outputs"] = nl::json::array();
+                for (auto& display : m_displays)
+                {
+                    auto& locations = display.second;
+                    for (auto it = locations.begin(); it != locations.end();)
+                    {
+                        it = it->first == m_cell ? locations.erase(it) : it + 1;
+                    }
+                }
+            }
+
+            // An update replaces all the outputs showing the display,
+            // including those of previous cells.
+            void update(const nl::json& content)
+            {
+                auto transient = content.find("transient");
+                if (transient == content.end() || !transient->count("display_id"))
+                {
+                    return;
+                }
+                auto display = m_displays.find((*transient)["display_id"].get<std::string>());
+                if (display == m_displays.end())
+                {
+                    return;
+                }
+                for (const auto& location : display->second)
+                {
+                    nl::json& output = m_cells[location.first]["outputs"][location.second];
+                    output["data"] = content["data"];
+                    output["metadata"] = content.value("metadata", nl::json::object());
+                }
+            }
+
+            nl::json& m_cells;
+            std::size_t m_cell = 0;
+            bool m_clear_pending = false;
+            std::map<std::string, std::vector<std::pair<std::size_t, std::size_t>>> m_displays;
+        };
+
+        bool execute_notebook(const std::string& input, const std::string& output,
+                              bool allow_errors, const interpreter_factory& factory)
+        {
+            nl::json notebook;
+            std::ifstream in(input);
+            if (!in)
+            {
+                std::clog << input << ": cannot open the notebook" << std::endl;
+                return false;
+            }
+            try
+            {
+                in >> notebook;
+            }
+            catch (const std::exception& e)
+            {
+                std::clog << input << ": invalid notebook: " << e.what() << std::endl;
+                return false;
+            }
+            if (!notebook.count("cells") || !notebook["cells"].is_array())
+            {
+                std::clog << input << ": invalid notebook: no cells" << std::endl;
+                return false;
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            nl::json& cells = notebook["cells"];
+            output_collector collector(cells);
+            bool success = true;
+            {
+                auto interpreter = factory();
+                interpreter->register_publisher(
+                    [&collector](const std::string& msg_type, nl::json /*metadata*/, nl::json content, auto&& /*buffers*/)
+                    {
+                        collector.publish(msg_type, content);
+                    });
+                interpreter->configure();
+
+                for (std::size_t i = 0; i < cells.size(); ++i)
+                {
+                    nl::json& cell = cells[i];
+                    if (cell.value("cell_type", "") != "code")
+                    {
+                        continue;
+                    }
+                    collector.start(i);
+                    nl::json reply = interpreter->execute_request(cell_source(cell), false, true,
+                                                                  nl::json::object(), false);
+                    cell["execution_count"] = reply.value("execution_count", nl::json());
+                    if (reply.value("status", "") != "ok" && !expects_error(cell))
+                    {
+                        std::clog << input << ": error in cell " << i + 1 << std::endl;
+                        success = false;
+                        if (!allow_errors)
+                        {
+                            break;
+                        }
+                    }
+                }
+            }
+
+            std::ofstream out(output);
+            if (!out)
+            {
+                std::clog << output << ": cannot write the notebook" << std::endl;
+                return false;
+            }
+            // The indentation of nbformat.
+            out << notebook.dump(1) << std::endl;
+
+            double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            std::clog << input << ": " << (success ? "executed" : "failed") << " in " << elapsed
+                      << " s, written to " << output << std::endl;
+            return success;
+        }
+    }
+
+    int execute_notebooks(const batch_options& options, const interpreter_factory& factory)
+    {
+        if (options.notebooks.size() > 1 && !options.output.empty())
+        {
+            std::clog << "--output can only be used with a single notebook" << std::endl;
+            return 2;
+        }
+
+        std::size_t failures = 0;
+#if !defined(_WIN32)
+        if (options.jobs > 1 && options.notebooks.size() > 1)
+        {
+            // The workers are forked before any interpreter is created, so
+            // that each notebook runs in a fresh process.
+            std::map<pid_t, std::string> running;
+            std::size_t next = 0;
+            while (next < options.notebooks.size() || !running.empty())
+            {
+                while (next < options.notebooks.size() && running.size() < options.jobs)
+                {
+                    const std::string& notebook = options.notebooks[next++];
+                    pid_t pid = fork();
+                    if (pid == 0)
+                    {
+                        bool success = execute_notebook(notebook, output_path(notebook, ""),
+                                                        options.allow_errors, factory);
+                        std::clog << std::flush;
+                        _exit(success ? 0 : 1);
+                    }
+                    if (pid < 0)
+                    {
+                        std::clog << notebook << ": cannot start a worker" << std::endl;
+                        ++failures;
+                        continue;
+                    }
+                    running[pid] = notebook;
+                }
+                if (running.empty())
+                {
+                    break;
+                }
+
+                int status = 0;
+                pid_t pid = waitpid(-1, &status, 0);
+                if (pid < 0)
+                {
+                    if (errno == EINTR)
+                    {
+                        continue;
+                    }
+                    break;
+                }
+                auto it = running.find(pid);
+                if (it == running.end())
+                {
+                    continue;
+                }
+                if (WIFSIGNALED(status))
+                {
+                    std::clog << it->second << ": the worker was killed by signal " << WTERMSIG(status) << std::endl;
+                }
+                if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+                {
+                    ++failures;
+                }
+                running.erase(it);
+            }
+            return failures == 0 ? 0 : 1;
+        }
+#endif
+
+        for (const auto& notebook : options.notebooks)
+        {
+            if (!execute_notebook(notebook, output_path(notebook, options.output), options.allow_errors, factory))
+            {
+                ++failures;
+            }
+        }
+        return failures == 0 ? 0 : 1;
+    }
+}
@@ -0,0 +1,53 @@
+/***********************************************************************************
+* Copyright (c) 2016, Johan Mabille, Loic Gouarin, Sylvain Corlay, Wolf Vollprecht *
+* Copyright (c) 2016, QuantStack                                                   *
+*                                                                                  *
+* Distributed under the terms of the BSD 3-Clause License.                         *
+*                                                                                  *
+* The full license is in the file LICENSE, distributed with this software.         *
+************************************************************************************/
+
+#ifndef XCPP_BATCH_HPP
+#define XCPP_BATCH_HPP
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "xeus-cling/xinterpreter.hpp"
+
+namespace xcpp
+{
+    struct batch_options
+    {
+        std::vector<std::string> notebooks;
+        // Output notebook, only with a single input notebook. By default,
+        // in.ipynb is written to in.nbconvert.ipynb.
+        std::string output;
+        // Number of notebooks executed concurrently, each in its own process.
+        std::size_t jobs = 1;
+        // Execute the remaining cells after an error.
+        bool allow_errors = false;
+    };
+
+    /**
+     * Extracts --execute, --output, -j and --allow-errors from the command
+     * line, and removes them from argv so that the remaining arguments can be
+     * passed to the interpreter.
+     */
+    batch_options extract_batch_options(int& argc, char* argv[]);
+
+    using interpreter_factory = std::function<std::unique_ptr<interpreter>()>;
+
+    /**
+     * Executes notebooks without a kernel nor a client: each notebook gets a
+     * fresh interpreter driven in process, and the messages it publishes are
+     * recorded as the outputs of the cells. Returns the exit status of xcpp,
+     * 0 if all the notebooks ran without errors.
+     */
+    int execute_notebooks(const batch_options& options, const interpreter_factory& factory);
+}
+
+#endif
@@ -21,6 +21,8 @@
 #define XEUS_HAS_CXXABI_H
 #endif
 
+#include <string>
+
 #if defined(XEUS_HAS_CXXABI_H)
 #include <cxxabi.h>
 // For some archtectures (mips, mips64, x86, x86_64) cxxabi.h in Android NDK is implemented by gabi++ library
@@ -35,38 +37,27 @@
 
 namespace xcpp
 {
-    const char* demangle(const char* name) noexcept;
-    const char* demangle(const std::string& name) noexcept;
-
-#if defined(XEUS_HAS_CXXABI_H)
-
-    inline const char* demangle(const char* name) noexcept
-    {
-        std::size_t size = 0;
-        int status = 0;
-        return abi::__cxa_demangle(name, 0, &size, &status);
-    }
-
-    inline const char* demangle(const std::string& name) noexcept
+    /**
+     * Returns the demangled form of a symbol or type name, or the name itself
+     * when it is not a mangled name or cannot be demangled on this platform.
+     */
+    inline std::string demangle(const std::string& name)
     {
-        std::size_t size = 0;
+#if defined(XEUS_HAS_CXXABI_H)
         int status = 0;
-        return abi::__cxa_demangle(name.c_str(), 0, &size, &status);
-    }
-
+        char* res = abi::__cxa_demangle(name.c_str(), nullptr, nullptr, &status);
+        if (res == nullptr)
+        {
+            return name;
+        }
+        // The buffer is allocated with malloc by the runtime.
+        std::string demangled(res);
+        std::free(res);
+        return demangled;
 #else
-
-    inline const char* demangle(const char* name) noexcept
-    {
         return name;
-    }
-
-    inline const char* demangle(const std::string& name) noexcept
-    {
-        return demangle(name.c_str());
-    }
-
 #endif
+    }
 }
 
 #endif
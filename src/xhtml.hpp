@@ -0,0 +1,72 @@
+/***********************************************************************************
+* Copyright (c) 2016, Johan Mabille, Loic Gouarin, Sylvain Corlay, Wolf Vollprecht *
+* Copyright (c) 2016, QuantStack                                                   *
+*                                                                                  *
+* Distributed under the terms of the BSD 3-Clause License.                         *
+*                                                                                  *
+* The full license is in the file LICENSE, distributed with this software.         *
+************************************************************************************/
+
+#ifndef XCPP_HTML_HPP
+#define XCPP_HTML_HPP
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace xcpp
+{
+    inline std::string html_escape(const std::string& text)
+    {
+        std::string res;
+        res.reserve(text.size());
+        for (char c : text)
+        {
+            switch (c)
+            {
+            case '&': res += "&amp;"; break;
+            case '<': res += "&lt;"; break;
+            case '>': res += "&gt;"; break;
+            case '"': res += "&quot;"; break;
+            default: res += c;
+            }
+        }
+        return res;
+    }
+
+    /**
+     * Renders rows of already escaped cells as an HTML table. Clicking on a
+     * header sorts the rows on that column, numerically when it can.
+     */
+    inline std::string html_table(const std::vector<std::string>& headers,
+                                  const std::vector<std::vector<std::string>>& rows)
+    {
+        std::ostringstream os;
+        os << "<table class=\"xcpp-sortable\"><thead><tr>";
+        for (const auto& header : headers)
+        {
+            os << "<th style=\"cursor: pointer\" onclick=\""
+               << "var t = this.closest('table'), b = t.tBodies[0], i = this.cellIndex;"
+               << "var d = this.dataset.desc = this.dataset.desc == '1' ? '0' : '1';"
+               << "Array.from(b.rows).sort(function(x, y) {"
+               << "var u = x.cells[i].textContent, v = y.cells[i].textContent;"
+               << "var r = isNaN(parseFloat(u)) ? u.localeCompare(v) : parseFloat(u) - parseFloat(v);"
+               << "return d == '1' ? -r : r; }).forEach(function(r) { b.appendChild(r); });\">"
+               << header << "</th>";
+        }
+        os << "</tr></thead><tbody>";
+        for (const auto& row : rows)
+        {
+            os << "<tr>";
+            for (const auto& cell : row)
+            {
+                os << "<td>" << cell << "</td>";
+            }
+            os << "</tr>";
+        }
+        os << "</tbody></table>";
+        return os.str();
+    }
+}
+
+#endif
@@ -8,14 +8,25 @@
 ************************************************************************************/
 
 #include <algorithm>
+#include <chrono>
 #include <cstdarg>
 #include <cstdio>
+#include <functional>
+#include <iostream>
 #include <memory>
 #include <regex>
+#include <set>
 #include <sstream>
 #include <vector>
 
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/Decl.h"
+#include "clang/Basic/SourceManager.h"
+#include "clang/Basic/TargetOptions.h"
+#include "clang/Frontend/CompilerInstance.h"
 #include "llvm/Support/DynamicLibrary.h"
+#include "xeus/xguid.hpp"
+
 #include "xeus-cling/xbuffer.hpp"
 #include "xeus-cling/xeus_cling_config.hpp"
 #include "xeus-cling/xinterpreter.hpp"
@@ -23,11 +34,19 @@
 
 #include "xinput.hpp"
 #include "xinspect.hpp"
+#include "xmagics/codegen.hpp"
+#include "xmagics/disassemble.hpp"
 #include "xmagics/executable.hpp"
 #include "xmagics/execution.hpp"
+#include "xmagics/forkmap.hpp"
+#include "xmagics/jobs.hpp"
 #include "xmagics/os.hpp"
+#include "xmagics/profiling.hpp"
+#include "xmagics/session.hpp"
+#include "xmemory.hpp"
 #include "xmime_internal.hpp"
 #include "xparser.hpp"
+#include "xreload.hpp"
 #include "xsystem.hpp"
 
 using namespace std::placeholders;
@@ -37,28 +56,45 @@ namespace xcpp
     void interpreter::configure_impl()
     {
         // Process #include "xeus/xinterpreter.hpp" in a separate block.
-        m_interpreter.process("#include \"xeus/xinterpreter.hpp\"", nullptr, nullptr, true);
+        m_interpreter->process("#include \"xeus/xinterpreter.hpp\"", nullptr, nullptr, true);
         // Expose interpreter instance to cling
         std::string block = "xeus::register_interpreter(static_cast<xeus::xinterpreter*>((void*)" + std::to_string(intptr_t(this)) + "));";
-        m_interpreter.process(block.c_str(), nullptr, nullptr, true);
+        m_interpreter->process(block.c_str(), nullptr, nullptr, true);
     }
 
     interpreter::interpreter(int argc, const char* const* argv)
-        : m_interpreter(argc, argv, LLVM_DIR),
+        : m_argv(argv, argv + argc),
+          m_interpreter(create_interpreter()),
           m_input_validator(),
           m_version(get_stdopt(argc, argv)), // Extract C++ language standard version from command-line option
           xmagics(),
           p_cout_strbuf(nullptr), p_cerr_strbuf(nullptr),
-          m_cout_buffer(std::bind(&interpreter::publish_stdout, this, _1)),
-          m_cerr_buffer(std::bind(&interpreter::publish_stderr, this, _1))
+          m_cout_buffer(std::bind(&interpreter::publish_stdout, this, _1, _2),
+                        std::bind(&interpreter::request_output_flush, this)),
+          m_cerr_buffer(std::bind(&interpreter::publish_stderr, this, _1, _2),
+                        std::bind(&interpreter::request_output_flush, this)),
+          m_output_flush_requested(false),
+          m_output_flusher_stopped(false),
+          m_last_cell_hash(0),
+          p_last_cell_tail(nullptr),
+          m_last_cell_transactions(0),
+          m_autounload("edited"),
+          m_last_cell_threads_before(0),
+          m_reset_pending(false),
+          m_reset_clear_prelude(false),
+          m_jobs(std::make_shared<job_registry>()),
+          p_header_reloader(new header_reloader(*m_interpreter))
     {
         redirect_output();
         init_preamble();
         init_magic();
+        m_output_flusher = std::thread(&interpreter::flush_output, this);
     }
 
     interpreter::~interpreter()
     {
+        m_jobs->stop_all();
+        stop_output_flusher();
         restore_output();
     }
 
@@ -71,16 +107,60 @@ namespace xcpp
     {
         nl::json kernel_res;
 
+        // The output of the threads started by the cell is attributed to it.
+        m_cout_buffer.begin_cell(static_cast<std::size_t>(execution_counter));
+        m_cerr_buffer.begin_cell(static_cast<std::size_t>(execution_counter));
+
+        // The headers edited since they were included are reloaded first,
+        // unless background jobs run code that would be unloaded with them.
+        if (p_header_reloader->modified())
+        {
+            if (m_jobs->running() != 0)
+            {
+                std::cerr << "Modified headers are not reloaded while background jobs are running" << std::endl;
+            }
+            else
+            {
+                p_header_reloader->reload();
+                p_last_cell_tail = nullptr;
+                cling_detail::xmime_included() = false;
+            }
+        }
+
         // Check for magics
         for (auto& pre : preamble_manager.preamble)
         {
             if (pre.second.is_match(code))
             {
+                // Magics may declare or unload transactions of their own.
+                p_last_cell_tail = nullptr;
                 pre.second.apply(code, kernel_res);
+                finish_cell_output();
+                // %reset only records the request, since the magics cannot be
+                // re-registered while one of them is being applied.
+                if (m_reset_pending)
+                {
+                    reset_interpreter(kernel_res);
+                }
+                // Magics may report metadata of their own.
+                nl::json metadata = get_execution_metadata();
+                if (kernel_res.count("metadata"))
+                {
+                    metadata.update(kernel_res["metadata"]);
+                }
+                kernel_res["metadata"] = std::move(metadata);
                 return kernel_res;
             }
         }
 
+        // Re-running the last cell (the usual edit loop) first unloads what
+        // its previous run declared, so that its definitions do not clash
+        // and the JIT memory does not pile up.
+        std::size_t cell_hash = std::hash<std::string>()(code);
+        unload_previous_cell(code, cell_hash);
+        const cling::Transaction* previous_transaction = m_interpreter->getLastTransaction();
+        std::size_t threads_before = thread_count();
+
         // Split code from includes
         auto blocks = split_from_includes(code.c_str());
 
@@ -92,7 +172,7 @@ namespace xcpp
         cling::Interpreter::CompilationResult compilation_result;
 
         // If silent is set to true, temporarily dismiss all std::cerr and
-        // std::cout outputs resulting from `m_interpreter.process`.
+        // std::cout outputs resulting from `m_interpreter->process`.
 
         auto cout_strbuf = std::cout.rdbuf();
         auto cerr_strbuf = std::cerr.rdbuf();
@@ -109,10 +189,19 @@ namespace xcpp
 
         for (const auto& block : blocks)
         {
+            // The headers pulled in by include blocks are recorded to be
+            // reloaded when they change.
+            bool include = is_include_block(block);
+            cling::Transaction* transaction = nullptr;
+            if (include)
+            {
+                p_header_reloader->begin_include();
+            }
+
             // Attempt normal evaluation
             try
             {
-                compilation_result = m_interpreter.process(block, &output, nullptr, true);
+                compilation_result = m_interpreter->process(block, &output, include ? &transaction : nullptr, true);
             }
 
             // Catch all errors
@@ -143,6 +232,11 @@ namespace xcpp
                 ename = "Interpreter Error";
             }
 
+            if (include)
+            {
+                p_header_reloader->end_include(block, errorlevel ? nullptr : transaction);
+            }
+
             // If an error was encountered, don't attempt further execution
             if (errorlevel)
             {
@@ -153,6 +247,7 @@ namespace xcpp
         // Flush streams
         std::cout << std::flush;
         std::cerr << std::flush;
+        finish_cell_output();
 
         // Reset non-silent output buffers
         if (silent)
@@ -189,7 +284,7 @@ namespace xcpp
             if (!silent && output.hasValue() && trim(blocks.back()).back() != ';')
             {
                 nl::json pub_data = mime_repr(output);
-                publish_execution_result(execution_counter, std::move(pub_data), nl::json::object());
+                publish_execution_result(execution_counter, std::move(pub_data), get_execution_metadata());
             }
 
             // Compose execute_reply message.
@@ -197,6 +292,9 @@ namespace xcpp
             kernel_res["payload"] = nl::json::array();
             kernel_res["user_expressions"] = nl::json::object();
         }
+
+        kernel_res["metadata"] = get_execution_metadata();
+        record_cell(cell_hash, previous_transaction, threads_before);
         return kernel_res;
     }
 
@@ -213,19 +311,12 @@ namespace xcpp
         auto text = split_line(code, delims, _cursor_pos);
         std::string to_complete = text.back().c_str();
 
-        compilation_result = m_interpreter.codeComplete(code.c_str(), _cursor_pos, result);
+        compilation_result = m_interpreter->codeComplete(code.c_str(), _cursor_pos, result);
 
         // change the print result
         for (auto& r : result)
         {
-            // remove the definition at the beginning (for example [#int#])
-            r = std::regex_replace(r, std::regex("\\[\\#.*\\#\\]"), "");
-            // remove the variable name in <#type name#>
-            r = std::regex_replace(r, std::regex("(\\ |\\*)+(\\w+)(\\#\\>)"), "$1$3");
-            // remove unnecessary space at the end of <#type   #>
-            r = std::regex_replace(r, std::regex("\\ *(\\#\\>)"), "$1");
-            // remove <# #> to keep only the type
-            r = std::regex_replace(r, std::regex("\\<\\#([^#>]*)\\#\\>"), "$1");
+            r = clean_completion(r);
         }
 
         kernel_res["matches"] = result;
@@ -249,7 +340,7 @@ namespace xcpp
         std::smatch magic;
         if (std::regex_search(dummy, magic, re_method))
         {
-            inspect(magic[0], kernel_res, m_interpreter);
+            inspect(magic[0], kernel_res, *m_interpreter);
         }
         return kernel_res;
     }
@@ -321,6 +412,8 @@ namespace xcpp
 
     void interpreter::shutdown_request_impl()
     {
+        m_jobs->stop_all();
+        stop_output_flusher();
         restore_output();
     }
 
@@ -413,28 +506,401 @@ namespace xcpp
         // to std::cout and std::cerr, these are handled implicitly.
     }
 
-    void interpreter::publish_stdout(const std::string& s)
+    nl::json interpreter::memory_statistics()
+    {
+        release_free_memory();
+        clang::ASTContext& context = m_interpreter->getCI()->getASTContext();
+        std::size_t declarations = 0;
+        // Without loading the declarations of an external source.
+        for (auto it = context.getTranslationUnitDecl()->noload_decls_begin();
+             it != context.getTranslationUnitDecl()->noload_decls_end(); ++it)
+        {
+            ++declarations;
+        }
+        std::size_t transactions = 0;
+        for (const cling::Transaction* transaction = m_interpreter->getFirstTransaction();
+             transaction != nullptr; transaction = transaction->getNext())
+        {
+            ++transactions;
+        }
+
+        nl::json res;
+        res["resident"] = resident_memory();
+        res["jit_code"] = jit_code_memory();
+        res["ast"] = context.getASTAllocatedMemory() + context.getSideTableAllocatedMemory();
+        res["declarations"] = declarations;
+        res["transactions"] = transactions;
+        return res;
+    }
+
+    nl::json interpreter::get_execution_metadata() const
+    {
+        nl::json metadata;
+        metadata["optlevel"] = optlevel_of(*m_interpreter);
+        return metadata;
+    }
+
+    namespace
+    {
+        // Names declared at the top level by the content of a cell, not by
+        // the headers it includes nor by cling.
+        void collect_cell_names(const cling::Transaction& t, const clang::SourceManager& sm,
+                                std::set<std::string>& names)
+        {
+            for (auto it = t.decls_begin(); it != t.decls_end(); ++it)
+            {
+                for (const clang::Decl* decl : it->m_DGR)
+                {
+                    const auto* named = llvm::dyn_cast<clang::NamedDecl>(decl);
+                    if (named == nullptr || named->isImplicit() || named->getIdentifier() == nullptr ||
+                        named->getName().startswith("__cling") || !named->getLocation().isValid())
+                    {
+                        continue;
+                    }
+                    clang::FileID file = sm.getFileID(sm.getExpansionLoc(named->getLocation()));
+                    if (sm.getFileEntryForID(file) == nullptr)
+                    {
+                        names.insert(named->getName().str());
+                    }
+                }
+            }
+            if (t.hasNestedTransactions())
+            {
+                for (auto it = t.nested_begin(); it != t.nested_end(); ++it)
+                {
+                    collect_cell_names(**it, sm, names);
+                }
+            }
+        }
+    }
+
+    void interpreter::unload_previous_cell(const std::string& code, std::size_t cell_hash)
+    {
+        // cling can only unload the most recent transactions, hence the check
+        // that the last cell is still the tail of the transaction list. An
+        // edited cell is taken for a re-run of the last cell when it declares
+        // one of the names that the last cell declared.
+        bool identical = m_last_cell_hash == cell_hash && m_autounload != "off";
+        bool edited = false;
+        if (!identical && m_autounload == "edited" && p_last_cell_tail != nullptr)
+        {
+            std::set<std::string> names = declared_names(code);
+            edited = std::any_of(names.begin(), names.end(), [this](const std::string& name)
+            {
+                return m_last_cell_names.count(name) != 0;
+            });
+        }
+        if (p_last_cell_tail != nullptr && (identical || edited) &&
+            m_interpreter->getLastTransaction() == p_last_cell_tail)
+        {
+            // The threads started by the previous run would be left running
+            // code that is freed. Threads that never wrote are only seen
+            // through the number of threads of the process.
+            if (m_jobs->running() != 0)
+            {
+                std::cerr << "Background jobs are running, the previous run of the cell is not unloaded" << std::endl;
+            }
+            else if (m_cout_buffer.running(m_cell_cout_threads) || m_cerr_buffer.running(m_cell_cerr_threads) ||
+                thread_count() > m_last_cell_threads_before)
+            {
+                std::cerr << "Threads started by the previous run of the cell are still running, "
+                          << "it is not unloaded" << std::endl;
+            }
+            else
+            {
+                if (edited)
+                {
+                    std::cout << "Unloading the previous cell, whose declarations this cell replaces "
+                              << "(%autounload identical to keep it)" << std::endl;
+                }
+                m_interpreter->unload(m_last_cell_transactions);
+                // The first display of the previous run may have declared the
+                // support for rich output, declaring it again is harmless.
+                cling_detail::xmime_included() = false;
+            }
+        }
+        p_last_cell_tail = nullptr;
+        m_last_cell_transactions = 0;
+        m_last_cell_names.clear();
+    }
+
+    void interpreter::record_cell(std::size_t cell_hash, const cling::Transaction* previous,
+                                  std::size_t threads_before)
+    {
+        // Transactions that failed to compile were already rolled back by
+        // cling, only the ones that are still alive are counted.
+        const cling::Transaction* transaction = previous != nullptr
+            ? previous->getNext()
+            : m_interpreter->getFirstTransaction();
+        const clang::SourceManager& sm = m_interpreter->getCI()->getSourceManager();
+        unsigned int count = 0;
+        const cling::Transaction* tail = nullptr;
+        m_last_cell_names.clear();
+        for (; transaction != nullptr; transaction = transaction->getNext())
+        {
+            tail = transaction;
+            ++count;
+            collect_cell_names(*transaction, sm, m_last_cell_names);
+        }
+        m_last_cell_hash = cell_hash;
+        p_last_cell_tail = tail;
+        m_last_cell_transactions = count;
+        m_last_cell_threads_before = threads_before;
+    }
+
+    void interpreter::publish_stdout(const std::string& s, const xoutput_origin& origin)
+    {
+        publish_output("stdout", s, origin);
+    }
+
+    void interpreter::publish_stderr(const std::string& s, const xoutput_origin& origin)
+    {
+        publish_output("stderr", s, origin);
+    }
+
+    void interpreter::publish_output(const std::string& name, const std::string& text, const xoutput_origin& origin)
+    {
+        if (!origin.current)
+        {
+            // A stream message would be shown in the running cell: the output
+            // of a thread that outlived its cell goes to its display instead.
+            std::lock_guard<std::mutex> lock(m_thread_displays_mutex);
+            auto it = m_thread_displays.find(std::make_pair(name, origin.thread));
+            if (it != m_thread_displays.end())
+            {
+                thread_display& display = it->second;
+                display.text += text;
+                if (!text.empty())
+                {
+                    nl::json data;
+                    data["text/plain"] = display.text;
+                    update_display_data(std::move(data), nl::json::object(), {{"display_id", display.display_id}});
+                }
+                if (origin.finished)
+                {
+                    m_thread_displays.erase(it);
+                }
+                return;
+            }
+        }
+        if (!text.empty())
+        {
+            publish_stream(name, text);
+        }
+    }
+
+    void interpreter::request_output_flush()
     {
-        publish_stream("stdout", s);
+        {
+            std::lock_guard<std::mutex> lock(m_output_flush_mutex);
+            m_output_flush_requested = true;
+        }
+        m_output_flush_condition.notify_one();
     }
 
-    void interpreter::publish_stderr(const std::string& s)
+    void interpreter::flush_output()
     {
-        publish_stream("stderr", s);
+        std::unique_lock<std::mutex> lock(m_output_flush_mutex);
+        while (true)
+        {
+            m_output_flush_condition.wait(lock, [this]()
+            {
+                return m_output_flush_requested || m_output_flusher_stopped;
+            });
+            if (m_output_flusher_stopped)
+            {
+                return;
+            }
+            m_output_flush_requested = false;
+            lock.unlock();
+            m_cout_buffer.flush_threads();
+            m_cerr_buffer.flush_threads();
+            lock.lock();
+        }
+    }
+
+    void interpreter::stop_output_flusher()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_output_flush_mutex);
+            m_output_flusher_stopped = true;
+        }
+        m_output_flush_condition.notify_one();
+        if (m_output_flusher.joinable())
+        {
+            m_output_flusher.join();
+        }
+    }
+
+    void interpreter::finish_cell_output()
+    {
+        // The threads still running when the cell ends get an empty display,
+        // updated with their later output.
+        auto add_displays = [this](const std::string& name, const std::vector<std::size_t>& threads)
+        {
+            for (std::size_t thread : threads)
+            {
+                nl::json display_id = xeus::new_xguid();
+                {
+                    std::lock_guard<std::mutex> lock(m_thread_displays_mutex);
+                    m_thread_displays[std::make_pair(name, thread)] = thread_display{display_id, ""};
+                }
+                nl::json data;
+                data["text/plain"] = "";
+                display_data(std::move(data), nl::json::object(), {{"display_id", display_id}});
+            }
+        };
+        m_cell_cout_threads = m_cout_buffer.end_cell();
+        m_cell_cerr_threads = m_cerr_buffer.end_cell();
+        add_displays("stdout", m_cell_cout_threads);
+        add_displays("stderr", m_cell_cerr_threads);
+        m_jobs->publish_finished();
     }
 
     void interpreter::init_preamble()
     {
-        preamble_manager.register_preamble("introspection", new xintrospection(m_interpreter));
+        preamble_manager.register_preamble("introspection", new xintrospection(*m_interpreter));
         preamble_manager.register_preamble("magics", new xmagics_manager());
         preamble_manager.register_preamble("shell", new xsystem());
     }
 
     void interpreter::init_magic()
     {
-        preamble_manager["magics"].get_cast<xmagics_manager>().register_magic("executable", executable(m_interpreter));
+        preamble_manager["magics"].get_cast<xmagics_manager>().register_magic("autounload", autounload(m_autounload));
+        preamble_manager["magics"].get_cast<xmagics_manager>().register_magic("background", background(*m_interpreter, m_jobs));
+        preamble_manager["magics"].get_cast<xmagics_manager>().register_magic("compiletime", compiletime(*m_interpreter));
+        preamble_manager["magics"].get_cast<xmagics_manager>().register_magic("cpuinfo", cpuinfo(*m_interpreter));
+        preamble_manager["magics"].get_cast<xmagics_manager>().register_magic("disassemble", disassemble(*m_interpreter));
+        preamble_manager["magics"].get_cast<xmagics_manager>().register_magic("executable", executable(*m_interpreter));
         preamble_manager["magics"].get_cast<xmagics_manager>().register_magic("file", writefile());
-        preamble_manager["magics"].get_cast<xmagics_manager>().register_magic("timeit", timeit(&m_interpreter));
+        preamble_manager["magics"].get_cast<xmagics_manager>().register_magic("forkmap", forkmap(*m_interpreter));
+        preamble_manager["magics"].get_cast<xmagics_manager>().register_magic("jobs", jobs(m_jobs));
+        preamble_manager["magics"].get_cast<xmagics_manager>().register_magic("kill", kill_job(m_jobs));
+        preamble_manager["magics"].get_cast<xmagics_manager>().register_magic("llvm_ir", llvm_ir(*m_interpreter));
+        preamble_manager["magics"].get_cast<xmagics_manager>().register_magic("march", march(*m_interpreter));
+        preamble_manager["magics"].get_cast<xmagics_manager>().register_magic("native", native(*m_interpreter));
+        preamble_manager["magics"].get_cast<xmagics_manager>().register_magic("optlevel", optlevel(*m_interpreter));
+        preamble_manager["magics"].get_cast<xmagics_manager>().register_magic("optreport", optreport(*m_interpreter));
+        preamble_manager["magics"].get_cast<xmagics_manager>().register_magic("prun", prun(*m_interpreter));
+        preamble_manager["magics"].get_cast<xmagics_manager>().register_magic("reset", reset(std::bind(&interpreter::request_reset, this, _1)));
+        preamble_manager["magics"].get_cast<xmagics_manager>().register_magic("run", run(*m_interpreter, m_jobs));
+        preamble_manager["magics"].get_cast<xmagics_manager>().register_magic("timeit", timeit(m_interpreter.get()));
+        preamble_manager["magics"].get_cast<xmagics_manager>().register_magic("wait", wait_job(m_jobs));
+    }
+
+    std::unique_ptr<cling::Interpreter> interpreter::create_interpreter() const
+    {
+        std::vector<const char*> argv;
+        argv.reserve(m_argv.size());
+        for (const auto& arg : m_argv)
+        {
+            argv.push_back(arg.c_str());
+        }
+        std::unique_ptr<cling::Interpreter> res(
+            new cling::Interpreter(static_cast<int>(argv.size()), argv.data(), LLVM_DIR));
+
+        // Honour -O<n> from the kernelspec for the JIT-compiled cells.
+        int level = get_optlevel(m_argv);
+        if (level >= 0)
+        {
+            set_optlevel(*res, level);
+        }
+
+        // Likewise for -march=<cpu>, including -march=native.
+        std::string cpu = get_march(m_argv);
+        if (!cpu.empty() && !set_target_cpu(*res, cpu))
+        {
+            std::clog << "Unknown CPU " << cpu << ", generating code for the default target" << std::endl;
+        }
+        return res;
+    }
+
+    void interpreter::request_reset(const reset_request& request)
+    {
+        // The jobs run code owned by the interpreter.
+        std::size_t running = m_jobs->running();
+        if (running != 0)
+        {
+            std::cerr << "UsageError: " << running << " background jobs are running, "
+                      << "%wait for them or %kill them before %reset\n";
+            return;
+        }
+        if (request.set_prelude)
+        {
+            m_prelude = request.prelude;
+        }
+        m_reset_clear_prelude = request.clear_prelude;
+        m_reset_pending = true;
+    }
+
+    void interpreter::reset_interpreter(nl::json& kernel_res)
+    {
+        m_reset_pending = false;
+        if (m_reset_clear_prelude)
+        {
+            m_prelude.clear();
+            m_reset_clear_prelude = false;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        std::size_t memory_before = resident_memory();
+
+        // The optimization level set with %optlevel and the target set with
+        // %march are kept across the reset.
+        int optlevel = optlevel_of(*m_interpreter);
+        clang::TargetOptions target = m_interpreter->getCI()->getTargetOpts();
+
+        // Destroy the previous instance before building the new one, so that
+        // its JIT memory and AST are released first. Static destructors of
+        // the user code run at this point.
+        p_last_cell_tail = nullptr;
+        m_interpreter.reset();
+        release_free_memory();
+        std::size_t memory_after = resident_memory();
+        cling_detail::xmime_included() = false;
+
+        // Output redirections and the injected printf symbols are process
+        // wide and outlive the interpreter, they do not need to be redone.
+        m_interpreter = create_interpreter();
+        set_optlevel(*m_interpreter, optlevel);
+        const clang::TargetOptions& new_target = m_interpreter->getCI()->getTargetOpts();
+        if (new_target.CPU != target.CPU || new_target.FeaturesAsWritten != target.FeaturesAsWritten)
+        {
+            set_target_cpu(*m_interpreter, target.CPU, target.FeaturesAsWritten);
+        }
+        p_header_reloader.reset(new header_reloader(*m_interpreter));
+        configure_impl();
+        init_preamble();
+        init_magic();
+
+        bool prelude_ok = process_cell(*m_interpreter, m_prelude);
+        if (!prelude_ok)
+        {
+            std::cerr << "Error while running the prelude, the remaining cells were skipped\n";
+        }
+
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        std::ostringstream report;
+        report.precision(3);
+        report << "Interpreter reset in " << elapsed.count() << " s";
+        if (memory_before != 0)
+        {
+            double freed = static_cast<double>(memory_before) - static_cast<double>(memory_after);
+            report << ", freed " << format_memory(freed);
+        }
+        if (!m_prelude.empty() && prelude_ok)
+        {
+            report << " (prelude re-run)";
+        }
+        std::cout << report.str() << std::endl;
+
+        kernel_res["status"] = prelude_ok ? "ok" : "error";
+        if (!prelude_ok)
+        {
+            kernel_res["ename"] = "Interpreter Error";
+            kernel_res["evalue"] = "error in %reset prelude";
+            kernel_res["traceback"] = nl::json::array();
+        }
     }
 
     std::string interpreter::get_stdopt(int argc, const char* const* argv)
@@ -0,0 +1,79 @@
+/***********************************************************************************
+* Copyright (c) 2016, Johan Mabille, Loic Gouarin, Sylvain Corlay, Wolf Vollprecht *
+* Copyright (c) 2016, QuantStack                                                   *
+*                                                                                  *
+* Distributed under the terms of the BSD 3-Clause License.                         *
+*                                                                                  *
+* The full license is in the file LICENSE, distributed with this software.         *
+************************************************************************************/
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "llvm/Object/ObjectFile.h"
+#include "llvm/Object/SymbolSize.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include "xjit.hpp"
+
+// The GDB JIT interface, through which the JIT of cling registers the objects
+// it loads, with their sections at their load address. It is defined by
+// llvm/lib/ExecutionEngine/GDBRegistrationListener.cpp.
+extern "C"
+{
+    struct jit_code_entry
+    {
+        struct jit_code_entry* next_entry;
+        struct jit_code_entry* prev_entry;
+        const char* symfile_addr;
+        std::uint64_t symfile_size;
+    };
+
+    struct jit_descriptor
+    {
+        std::uint32_t version;
+        std::uint32_t action_flag;
+        struct jit_code_entry* relevant_entry;
+        struct jit_code_entry* first_entry;
+    };
+
+    extern struct jit_descriptor __jit_debug_descriptor;
+}
+
+namespace xcpp
+{
+    std::vector<jit_function> jit_functions()
+    {
+        std::vector<jit_function> functions;
+        for (const jit_code_entry* entry = __jit_debug_descriptor.first_entry; entry != nullptr;
+             entry = entry->next_entry)
+        {
+            llvm::MemoryBufferRef buffer(llvm::StringRef(entry->symfile_addr, entry->symfile_size), "jit");
+            auto object = llvm::object::ObjectFile::createObjectFile(buffer);
+            if (!object)
+            {
+                llvm::consumeError(object.takeError());
+                continue;
+            }
+            for (const auto& symbol : llvm::object::computeSymbolSizes(**object))
+            {
+                auto type = symbol.first.getType();
+                auto name = symbol.first.getName();
+                auto address = symbol.first.getAddress();
+                if (!type || !name || !address)
+                {
+                    llvm::consumeError(type.takeError());
+                    llvm::consumeError(name.takeError());
+                    llvm::consumeError(address.takeError());
+                    continue;
+                }
+                if (*type == llvm::object::SymbolRef::ST_Function && symbol.second != 0)
+                {
+                    functions.push_back({name->str(), *address, symbol.second});
+                }
+            }
+        }
+        return functions;
+    }
+}
@@ -0,0 +1,37 @@
+/***********************************************************************************
+* Copyright (c) 2016, Johan Mabille, Loic Gouarin, Sylvain Corlay, Wolf Vollprecht *
+* Copyright (c) 2016, QuantStack                                                   *
+*                                                                                  *
+* Distributed under the terms of the BSD 3-Clause License.                         *
+*                                                                                  *
+* The full license is in the file LICENSE, distributed with this software.         *
+************************************************************************************/
+
+#ifndef XCPP_JIT_HPP
+#define XCPP_JIT_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace xcpp
+{
+    struct jit_function
+    {
+        // Mangled name.
+        std::string name;
+        std::uint64_t address;
+        std::uint64_t size;
+    };
+
+    /**
+     * Returns the functions whose machine code the JIT has loaded, read from
+     * the symbol tables of the objects it registers through the GDB JIT
+     * interface. Unlike looking a function up in the interpreter, this never
+     * makes the JIT emit code. The objects only change while a cell is
+     * compiled.
+     */
+    std::vector<jit_function> jit_functions();
+}
+
+#endif
@@ -0,0 +1,617 @@
+/***********************************************************************************
+* Copyright (c) 2016, Johan Mabille, Loic Gouarin, Sylvain Corlay, Wolf Vollprecht *
+* Copyright (c) 2016, QuantStack                                                   *
+*                                                                                  *
+* Distributed under the terms of the BSD 3-Clause License.                         *
+*                                                                                  *
+* The full license is in the file LICENSE, distributed with this software.         *
+************************************************************************************/
+
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <regex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/IR/DiagnosticInfo.h"
+#include "llvm/IR/DiagnosticPrinter.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Casting.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/raw_ostream.h"
+#include "clang/Basic/CodeGenOptions.h"
+#include "clang/Basic/TargetInfo.h"
+#include "clang/Basic/TargetOptions.h"
+#include "clang/CodeGen/ModuleBuilder.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "cling/Interpreter/Interpreter.h"
+
+#include "nlohmann/json.hpp"
+
+#include "xeus/xinterpreter.hpp"
+
+#include "xeus-cling/xoptions.hpp"
+
+#include "codegen.hpp"
+#include "execution.hpp"
+#include "../xhtml.hpp"
+#include "../xparser.hpp"
+
+namespace nl = nlohmann;
+
+namespace xcpp
+{
+    int get_optlevel(const std::vector<std::string>& args)
+    {
+        int res = -1;
+        for (const auto& arg : args)
+        {
+            // The last occurrence wins, as for clang.
+            if (arg.size() == 3 && arg.compare(0, 2, "-O") == 0 && arg[2] >= '0' && arg[2] <= '3')
+            {
+                res = arg[2] - '0';
+            }
+        }
+        return res;
+    }
+
+    bool set_optlevel(cling::Interpreter& interpreter, int level)
+    {
+        if (level < 0 || level > 3)
+        {
+            return false;
+        }
+        // cling reads the level from the code generation options whenever it
+        // compiles a new transaction, this is what its .O command does.
+        interpreter.getCI()->getCodeGenOpts().OptimizationLevel = level;
+        return true;
+    }
+
+    int optlevel_of(const cling::Interpreter& interpreter)
+    {
+        return interpreter.getCI()->getCodeGenOpts().OptimizationLevel;
+    }
+
+    std::string get_march(const std::vector<std::string>& args)
+    {
+        std::string res;
+        for (const auto& arg : args)
+        {
+            if (arg.compare(0, 7, "-march=") == 0)
+            {
+                res = arg.substr(7);
+            }
+        }
+        return res;
+    }
+
+    bool set_target_cpu(cling::Interpreter& interpreter,
+                        const std::string& cpu,
+                        const std::vector<std::string>& features)
+    {
+        auto* CI = interpreter.getCI();
+        auto& Target = CI->getTarget();
+        auto& TargetOpts = CI->getTargetOpts();
+
+        std::string CPU = cpu;
+        std::vector<std::string> FeaturesAsWritten;
+        if (cpu == "native")
+        {
+            CPU = llvm::sys::getHostCPUName();
+            llvm::StringMap<bool> HostFeatures;
+            if (llvm::sys::getHostCPUFeatures(HostFeatures))
+            {
+                for (const auto& F : HostFeatures)
+                {
+                    FeaturesAsWritten.push_back((F.getValue() ? "+" : "-") + F.getKey().str());
+                }
+            }
+        }
+        std::copy(features.begin(), features.end(), std::back_inserter(FeaturesAsWritten));
+
+        std::string PreviousCPU = TargetOpts.CPU;
+        if (!Target.setCPU(CPU))
+        {
+            Target.setCPU(PreviousCPU);
+            return false;
+        }
+
+        // Expand the CPU and the explicit features the same way clang does
+        // when it creates the target. Code generation attaches the resulting
+        // "target-cpu" and "target-features" to every function it emits, and
+        // the JIT honours them when it selects instructions. The predefined
+        // macros (__AVX2__, ...) are not updated.
+        llvm::StringMap<bool> FeatureMap;
+        if (!Target.initFeatureMap(FeatureMap, CI->getDiagnostics(), CPU, FeaturesAsWritten))
+        {
+            Target.setCPU(PreviousCPU);
+            return false;
+        }
+        TargetOpts.CPU = CPU;
+        TargetOpts.FeaturesAsWritten = FeaturesAsWritten;
+        TargetOpts.FeatureMap = FeatureMap;
+        TargetOpts.Features.clear();
+        for (const auto& F : FeatureMap)
+        {
+            TargetOpts.Features.push_back((F.getValue() ? "+" : "-") + F.getKey().str());
+        }
+        std::sort(TargetOpts.Features.begin(), TargetOpts.Features.end());
+        return true;
+    }
+
+    xoptions optlevel::get_options()
+    {
+        xoptions options{"optlevel", "Set the optimization level of the JIT-compiled code"};
+        options.add_options()
+            ("l,level", "optimization level, between 0 and 3", cxxopts::value<int>());
+        options.parse_positional("level");
+        return options;
+    }
+
+    bool optlevel::parse_level(const std::string& line, int& level)
+    {
+        auto options = get_options();
+        auto result = options.parse(line);
+        if (!result.count("level"))
+        {
+            return false;
+        }
+        level = result["level"].as<int>();
+        return true;
+    }
+
+    void optlevel::operator()(const std::string& line)
+    {
+        int level = 0;
+        if (!parse_level(line, level))
+        {
+            std::cout << "Optimization level: " << optlevel_of(m_interpreter) << std::endl;
+            return;
+        }
+        if (!set_optlevel(m_interpreter, level))
+        {
+            std::cerr << "UsageError: the optimization level must be 0, 1, 2 or 3\n";
+        }
+    }
+
+    void optlevel::operator()(const std::string& line, const std::string& cell)
+    {
+        int level = 0;
+        if (!parse_level(line, level))
+        {
+            std::cerr << "UsageError: the following arguments are required: level\n";
+            return;
+        }
+
+        int previous = optlevel_of(m_interpreter);
+        if (!set_optlevel(m_interpreter, level))
+        {
+            std::cerr << "UsageError: the optimization level must be 0, 1, 2 or 3\n";
+            return;
+        }
+        process_cell(m_interpreter, cell);
+        set_optlevel(m_interpreter, previous);
+    }
+
+    namespace
+    {
+        bool is_simd_feature(const std::string& feature)
+        {
+            static const std::vector<std::string> prefixes = {
+                "sse", "ssse", "avx", "fma", "f16c", "neon", "altivec", "vsx", "sve", "mmx", "3dnow", "xop"
+            };
+            return std::any_of(prefixes.begin(), prefixes.end(), [&feature](const std::string& prefix)
+            {
+                return feature.compare(0, prefix.size(), prefix) == 0;
+            });
+        }
+
+        void print_features(std::ostream& os, const std::vector<std::string>& features)
+        {
+            std::vector<std::string> simd;
+            std::vector<std::string> other;
+            for (const auto& feature : features)
+            {
+                (is_simd_feature(feature) ? simd : other).push_back(feature);
+            }
+            os << "  SIMD:  ";
+            for (const auto& feature : simd)
+            {
+                os << feature << " ";
+            }
+            os << "\n  Other: ";
+            for (const auto& feature : other)
+            {
+                os << feature << " ";
+            }
+            os << "\n";
+        }
+    }
+
+    void cpuinfo::operator()(const std::string& /*line*/)
+    {
+        std::vector<std::string> host_features;
+        llvm::StringMap<bool> HostFeatures;
+        if (llvm::sys::getHostCPUFeatures(HostFeatures))
+        {
+            for (const auto& F : HostFeatures)
+            {
+                if (F.getValue())
+                {
+                    host_features.push_back(F.getKey().str());
+                }
+            }
+        }
+        std::sort(host_features.begin(), host_features.end());
+
+        const auto& TargetOpts = m_interpreter.getCI()->getTargetOpts();
+        std::vector<std::string> jit_features;
+        for (const auto& feature : TargetOpts.Features)
+        {
+            if (!feature.empty() && feature[0] == '+')
+            {
+                jit_features.push_back(feature.substr(1));
+            }
+        }
+        std::sort(jit_features.begin(), jit_features.end());
+
+        std::ostringstream os;
+        os << "Host CPU: " << llvm::sys::getHostCPUName().str() << "\n";
+        os << "Host features:\n";
+        print_features(os, host_features);
+        os << "\nJIT target: " << TargetOpts.Triple << "\n";
+        os << "JIT CPU: " << (TargetOpts.CPU.empty() ? "generic" : TargetOpts.CPU) << "\n";
+        os << "JIT features:\n";
+        print_features(os, jit_features);
+        os << "JIT optimization level: " << optlevel_of(m_interpreter) << "\n";
+
+        std::vector<std::string> missing;
+        std::set_difference(host_features.begin(), host_features.end(),
+                            jit_features.begin(), jit_features.end(),
+                            std::back_inserter(missing));
+        missing.erase(std::remove_if(missing.begin(), missing.end(), [](const std::string& f)
+        {
+            return !is_simd_feature(f);
+        }), missing.end());
+        if (!missing.empty())
+        {
+            os << "\nSIMD extensions of the host not used by the JIT: ";
+            for (const auto& feature : missing)
+            {
+                os << feature << " ";
+            }
+            os << "\nUse %march native to generate code for them.\n";
+        }
+        std::cout << os.str() << std::flush;
+    }
+
+    xoptions march::get_options()
+    {
+        xoptions options{"march", "Select the CPU and features the JIT generates code for"};
+        options.add_options()
+            ("c,cpu", "target CPU, or native for the host CPU", cxxopts::value<std::string>())
+            ("f,features", "comma-separated list of features to enable (+name) or disable (-name)",
+             cxxopts::value<std::string>()->default_value(""));
+        options.parse_positional("cpu");
+        return options;
+    }
+
+    void march::operator()(const std::string& line)
+    {
+        auto options = get_options();
+        auto result = options.parse(line);
+
+        if (!result.count("cpu"))
+        {
+            const auto& TargetOpts = m_interpreter.getCI()->getTargetOpts();
+            std::cout << "JIT CPU: " << (TargetOpts.CPU.empty() ? "generic" : TargetOpts.CPU) << std::endl;
+            return;
+        }
+
+        std::vector<std::string> features;
+        std::istringstream iss(result["features"].as<std::string>());
+        std::string feature;
+        while (std::getline(iss, feature, ','))
+        {
+            if (feature.empty())
+            {
+                continue;
+            }
+            if (feature[0] != '+' && feature[0] != '-')
+            {
+                feature = "+" + feature;
+            }
+            features.push_back(feature);
+        }
+
+        std::string cpu = result["cpu"].as<std::string>();
+        if (!set_target_cpu(m_interpreter, cpu, features))
+        {
+            std::cerr << "UsageError: unknown CPU or feature for this target: " << cpu << "\n";
+            return;
+        }
+        std::cout << "Generating code for " << m_interpreter.getCI()->getTargetOpts().CPU
+                  << " in the subsequent cells" << std::endl;
+    }
+
+    namespace
+    {
+        struct remark
+        {
+            std::string kind;
+            std::string pass;
+            std::string function;
+            std::string file;
+            unsigned int line;
+            std::string message;
+        };
+
+        struct remark_collector
+        {
+            std::regex passes;
+            std::vector<remark> remarks;
+            llvm::LLVMContext::DiagnosticHandlerTy previous_handler;
+            void* previous_context;
+        };
+
+        void collect_remark(const llvm::DiagnosticInfo& info, void* context)
+        {
+            auto* collector = static_cast<remark_collector*>(context);
+            const auto* opt = llvm::dyn_cast<llvm::DiagnosticInfoOptimizationBase>(&info);
+            if (opt == nullptr)
+            {
+                // Not a remark: hand it to whoever handled diagnostics before.
+                if (collector->previous_handler != nullptr)
+                {
+                    collector->previous_handler(info, collector->previous_context);
+                }
+                else if (info.getSeverity() == llvm::DS_Error || info.getSeverity() == llvm::DS_Warning)
+                {
+                    std::string message;
+                    llvm::raw_string_ostream os(message);
+                    llvm::DiagnosticPrinterRawOStream printer(os);
+                    info.print(printer);
+                    std::cerr << os.str() << std::endl;
+                }
+                return;
+            }
+
+            std::string pass = opt->getPassName();
+            if (!std::regex_match(pass, collector->passes))
+            {
+                return;
+            }
+
+            remark r;
+            r.kind = opt->isPassed() ? "passed" : (opt->isMissed() ? "missed" : "analysis");
+            r.pass = pass;
+            r.function = opt->getFunction().getName().str();
+            r.line = 0;
+            if (opt->isLocationAvailable())
+            {
+                llvm::StringRef file;
+                unsigned int column = 0;
+                opt->getLocation(&file, &r.line, &column);
+                r.file = file.str();
+            }
+            r.message = opt->getMsg();
+            collector->remarks.push_back(std::move(r));
+        }
+
+        // Line of the cell corresponding to each line of each block the cell
+        // is split into, the splitting dropping the empty lines.
+        std::vector<std::vector<std::size_t>> map_block_lines(const std::vector<std::string>& cell_lines,
+                                                              const std::vector<std::string>& blocks)
+        {
+            std::vector<std::vector<std::size_t>> res;
+            std::size_t cursor = 0;
+            for (const auto& block : blocks)
+            {
+                std::vector<std::size_t> lines;
+                std::istringstream is(block);
+                std::string block_line;
+                while (std::getline(is, block_line))
+                {
+                    std::size_t current = cursor;
+                    while (current < cell_lines.size() && cell_lines[current] != block_line)
+                    {
+                        ++current;
+                    }
+                    if (current < cell_lines.size())
+                    {
+                        cursor = current + 1;
+                    }
+                    lines.push_back(current < cell_lines.size() ? current : cell_lines.size());
+                }
+                res.push_back(std::move(lines));
+            }
+            return res;
+        }
+
+        std::string format_remarks(const std::vector<const remark*>& remarks)
+        {
+            static const std::map<std::string, std::string> colors = {
+                {"passed", "#2e7d32"}, {"missed", "#c62828"}, {"analysis", "#616161"}
+            };
+            std::ostringstream os;
+            for (const remark* r : remarks)
+            {
+                os << "<div><span style=\"color: " << colors.at(r->kind) << "\">" << r->kind << "</span> "
+                   << "<code>" << html_escape(r->pass) << "</code>: " << html_escape(r->message) << "</div>";
+            }
+            return os.str();
+        }
+
+        // Remarks are only attached to source lines when the IR carries debug
+        // locations, which are only generated for the cell of the report. The
+        // module of the next transaction is created when the current one is
+        // committed, hence the empty declarations.
+        struct debug_locations
+        {
+            cling::Interpreter& m_interpreter;
+            clang::codegenoptions::DebugInfoKind m_previous;
+
+            debug_locations(cling::Interpreter& interpreter)
+                : m_interpreter(interpreter),
+                  m_previous(interpreter.getCI()->getCodeGenOpts().getDebugInfo())
+            {
+                if (m_previous == clang::codegenoptions::NoDebugInfo)
+                {
+                    m_interpreter.getCI()->getCodeGenOpts().setDebugInfo(clang::codegenoptions::LocTrackingOnly);
+                    m_interpreter.declare("namespace __xcpp_optreport {}");
+                }
+            }
+
+            ~debug_locations()
+            {
+                clang::CodeGenOptions& CGOpts = m_interpreter.getCI()->getCodeGenOpts();
+                if (CGOpts.getDebugInfo() != m_previous)
+                {
+                    CGOpts.setDebugInfo(m_previous);
+                    m_interpreter.declare("namespace __xcpp_optreport {}");
+                }
+            }
+        };
+    }
+
+    xoptions optreport::get_options()
+    {
+        xoptions options{"optreport", "Show the optimization remarks of a cell"};
+        options.add_options()
+            ("p,passes", "regular expression matching the names of the passes to report",
+             cxxopts::value<std::string>()->default_value("loop-vectorize|slp-vectorizer|inline"));
+        return options;
+    }
+
+    void optreport::operator()(const std::string& line, const std::string& cell)
+    {
+        auto options = get_options();
+        auto result = options.parse(line);
+
+        remark_collector collector;
+        try
+        {
+            collector.passes = std::regex(result["passes"].as<std::string>());
+        }
+        catch (const std::regex_error& e)
+        {
+            std::cerr << "UsageError: invalid pass expression: " << e.what() << "\n";
+            return;
+        }
+
+        debug_locations locations(m_interpreter);
+
+        llvm::LLVMContext& context = m_interpreter.getCodeGenerator()->GetModule()->getContext();
+        collector.previous_handler = context.getDiagnosticHandler();
+        collector.previous_context = context.getDiagnosticContext();
+
+        std::vector<std::string> blocks = split_from_includes(cell);
+        std::vector<std::string> cell_lines;
+        std::istringstream is(cell);
+        std::string cell_line;
+        while (std::getline(is, cell_line))
+        {
+            cell_lines.push_back(cell_line);
+        }
+        std::vector<std::vector<std::size_t>> block_lines = map_block_lines(cell_lines, blocks);
+
+        // Remarks located in the cell, per line of the cell, and elsewhere.
+        std::vector<std::vector<const remark*>> by_line(cell_lines.size());
+        std::vector<remark> remarks;
+        for (std::size_t b = 0; b < blocks.size(); ++b)
+        {
+            if (trim(blocks[b]).empty())
+            {
+                continue;
+            }
+            collector.remarks.clear();
+            context.setDiagnosticHandler(collect_remark, &collector, false);
+            bool success = process_cell(m_interpreter, blocks[b]);
+            context.setDiagnosticHandler(collector.previous_handler, collector.previous_context, false);
+
+            for (auto& r : collector.remarks)
+            {
+                if (r.file.compare(0, 11, "input_line_") == 0 && r.line > 0)
+                {
+                    // Statements are wrapped in a function whose header takes
+                    // one line of the input buffer.
+                    unsigned int line = r.line - (r.function.find("__cling_Un1Qu3") == 0 ? 1 : 0);
+                    r.file.clear();
+                    r.line = line > 0 && line <= block_lines[b].size() ?
+                        static_cast<unsigned int>(block_lines[b][line - 1] + 1) : 0;
+                }
+                remarks.push_back(std::move(r));
+            }
+            if (!success)
+            {
+                break;
+            }
+        }
+
+        // The same remark is emitted for every copy of an inlined function.
+        std::set<std::tuple<std::string, unsigned int, std::string, std::string, std::string>> seen;
+        std::vector<const remark*> elsewhere;
+        for (const auto& r : remarks)
+        {
+            if (!seen.insert(std::make_tuple(r.file, r.line, r.kind, r.pass, r.message)).second)
+            {
+                continue;
+            }
+            if (r.file.empty() && r.line > 0 && r.line <= by_line.size())
+            {
+                by_line[r.line - 1].push_back(&r);
+            }
+            else
+            {
+                elsewhere.push_back(&r);
+            }
+        }
+
+        std::ostringstream text;
+        std::vector<std::vector<std::string>> rows;
+        for (std::size_t i = 0; i < cell_lines.size(); ++i)
+        {
+            rows.push_back({std::to_string(i + 1), "<pre style=\"margin: 0\">" + html_escape(cell_lines[i]) + "</pre>",
+                            format_remarks(by_line[i])});
+            for (const remark* r : by_line[i])
+            {
+                text << "line " << i + 1 << ": " << r->kind << " [" << r->pass << "] " << r->message << "\n";
+            }
+        }
+        std::ostringstream html;
+        html << html_table({"Line", "Source", "Remarks"}, rows);
+
+        if (!elsewhere.empty())
+        {
+            std::vector<std::vector<std::string>> other_rows;
+            for (const remark* r : elsewhere)
+            {
+                std::string location = r->file.empty() ? "" : r->file + ":" + std::to_string(r->line);
+                other_rows.push_back({html_escape(location), html_escape(r->function), format_remarks({r})});
+                text << (location.empty() ? r->function : location) << ": " << r->kind
+                     << " [" << r->pass << "] " << r->message << "\n";
+            }
+            html << "<h4>Remarks outside of the cell</h4>"
+                 << html_table({"Location", "Function", "Remarks"}, other_rows);
+        }
+
+        if (remarks.empty())
+        {
+            text << "No optimization remark. Most passes only run from %optlevel 2.\n";
+            html << "<p>No optimization remark. Most passes only run from <code>%optlevel 2</code>.</p>";
+        }
+
+        nl::json pub_data;
+        pub_data["text/plain"] = text.str();
+        pub_data["text/html"] = html.str();
+        xeus::get_interpreter().display_data(std::move(pub_data), nl::json::object(), nl::json::object());
+    }
+}
@@ -0,0 +1,115 @@
+/***********************************************************************************
+* Copyright (c) 2016, Johan Mabille, Loic Gouarin, Sylvain Corlay, Wolf Vollprecht *
+* Copyright (c) 2016, QuantStack                                                   *
+*                                                                                  *
+* Distributed under the terms of the BSD 3-Clause License.                         *
+*                                                                                  *
+* The full license is in the file LICENSE, distributed with this software.         *
+************************************************************************************/
+
+#ifndef XMAGICS_CODEGEN_HPP
+#define XMAGICS_CODEGEN_HPP
+
+#include <string>
+#include <vector>
+
+#include "cling/Interpreter/Interpreter.h"
+
+#include "xeus-cling/xmagics.hpp"
+#include "xeus-cling/xoptions.hpp"
+
+namespace xcpp
+{
+    /**
+     * Returns the optimization level requested with -O<n> in the command-line
+     * arguments of the kernel, or -1 if there is none.
+     */
+    int get_optlevel(const std::vector<std::string>& args);
+
+    /**
+     * Sets the optimization level used for the transactions of the
+     * subsequent cells. Returns false if the level is out of range.
+     */
+    bool set_optlevel(cling::Interpreter& interpreter, int level);
+
+    int optlevel_of(const cling::Interpreter& interpreter);
+
+    /**
+     * Returns the CPU requested with -march=<cpu> in the command-line
+     * arguments of the kernel, or an empty string if there is none.
+     */
+    std::string get_march(const std::vector<std::string>& args);
+
+    /**
+     * Sets the CPU and the additional features (e.g. "+avx2", "-fma") the
+     * code of the subsequent cells is generated for. "native" designates the
+     * host CPU and all the features it supports. Returns false if the CPU is
+     * not known to the target.
+     */
+    bool set_target_cpu(cling::Interpreter& interpreter,
+                        const std::string& cpu,
+                        const std::vector<std::string>& features = {});
+
+    class optlevel : public xmagic_line_cell
+    {
+    public:
+
+        optlevel(cling::Interpreter& i) : m_interpreter(i) {}
+
+        xoptions get_options();
+        virtual void operator()(const std::string& line) override;
+        virtual void operator()(const std::string& line, const std::string& cell) override;
+
+    private:
+
+        bool parse_level(const std::string& line, int& level);
+
+        cling::Interpreter& m_interpreter;
+    };
+
+    class cpuinfo : public xmagic_line
+    {
+    public:
+
+        cpuinfo(cling::Interpreter& i) : m_interpreter(i) {}
+
+        virtual void operator()(const std::string& line) override;
+
+    private:
+
+        cling::Interpreter& m_interpreter;
+    };
+
+    /**
+     * %%optreport runs a cell while collecting the optimization remarks of
+     * the LLVM passes, and shows them next to the lines of the cell.
+     */
+    class optreport : public xmagic_cell
+    {
+    public:
+
+        optreport(cling::Interpreter& i) : m_interpreter(i) {}
+
+        xoptions get_options();
+        virtual void operator()(const std::string& line, const std::string& cell) override;
+
+    private:
+
+        cling::Interpreter& m_interpreter;
+    };
+
+    class march : public xmagic_line
+    {
+    public:
+
+        march(cling::Interpreter& i) : m_interpreter(i) {}
+
+        xoptions get_options();
+        virtual void operator()(const std::string& line) override;
+
+    private:
+
+        cling::Interpreter& m_interpreter;
+    };
+}
+#endif
@@ -0,0 +1,399 @@
+/***********************************************************************************
+* Copyright (c) 2016, Johan Mabille, Loic Gouarin, Sylvain Corlay, Wolf Vollprecht *
+* Copyright (c) 2016, QuantStack                                                   *
+*                                                                                  *
+* Distributed under the terms of the BSD 3-Clause License.                         *
+*                                                                                  *
+* The full license is in the file LICENSE, distributed with this software.         *
+************************************************************************************/
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <regex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/Triple.h"
+#include "llvm/IR/Module.h"
+#include "llvm/MC/MCAsmInfo.h"
+#include "llvm/MC/MCContext.h"
+#include "llvm/MC/MCDisassembler/MCDisassembler.h"
+#include "llvm/MC/MCInst.h"
+#include "llvm/MC/MCInstPrinter.h"
+#include "llvm/MC/MCInstrInfo.h"
+#include "llvm/MC/MCObjectFileInfo.h"
+#include "llvm/MC/MCRegisterInfo.h"
+#include "llvm/MC/MCSubtargetInfo.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/TargetRegistry.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/raw_ostream.h"
+#include "clang/Basic/TargetOptions.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "cling/Interpreter/Interpreter.h"
+#include "cling/Interpreter/Transaction.h"
+
+#include "nlohmann/json.hpp"
+
+#include "xeus/xinterpreter.hpp"
+
+#include "disassemble.hpp"
+#include "../xdemangle.hpp"
+#include "../xjit.hpp"
+
+namespace nl = nlohmann;
+
+namespace xcpp
+{
+    namespace
+    {
+        bool matches(const std::string& mangled, const std::string& name)
+        {
+            if (mangled == name)
+            {
+                return true;
+            }
+            std::string demangled = demangle(mangled);
+            return demangled == name ||
+                   (demangled.compare(0, name.size(), name) == 0 && demangled.size() > name.size() &&
+                    demangled[name.size()] == '(');
+        }
+
+        void collect_functions(const cling::Transaction& t, const std::string& name,
+                               std::vector<const llvm::Function*>& functions)
+        {
+            if (t.hasNestedTransactions())
+            {
+                for (auto n = t.nested_begin(), e = t.nested_end(); n != e; ++n)
+                {
+                    collect_functions(**n, name, functions);
+                }
+            }
+            if (const llvm::Module* module = t.getModule())
+            {
+                for (const llvm::Function& f : *module)
+                {
+                    if (!f.isDeclaration() && matches(f.getName().str(), name))
+                    {
+                        functions.push_back(&f);
+                    }
+                }
+            }
+        }
+
+        // Width in bits of the vector register an assembly instruction
+        // operates on, 0 for scalar instructions.
+        int vector_width(const std::string& instruction)
+        {
+            static const std::regex neon(R"(\bv[0-9]+\.(16b|8h|4s|2d))");
+            static const std::regex neon64(R"(\bv[0-9]+\.(8b|4h|2s))");
+            if (instruction.find("%zmm") != std::string::npos)
+            {
+                return 512;
+            }
+            if (instruction.find("%ymm") != std::string::npos)
+            {
+                return 256;
+            }
+            if (instruction.find("%xmm") != std::string::npos)
+            {
+                std::istringstream is(instruction);
+                std::string mnemonic;
+                is >> mnemonic;
+                auto ends_with = [&mnemonic](const char* suffix)
+                {
+                    std::string s(suffix);
+                    return mnemonic.size() >= s.size() &&
+                           mnemonic.compare(mnemonic.size() - s.size(), s.size(), s) == 0;
+                };
+                bool packed = ends_with("ps") || ends_with("pd") ||
+                              mnemonic.compare(0, 1, "p") == 0 || mnemonic.compare(0, 2, "vp") == 0;
+                return packed ? 128 : 0;
+            }
+            if (std::regex_search(instruction, neon))
+            {
+                return 128;
+            }
+            if (std::regex_search(instruction, neon64))
+            {
+                return 64;
+            }
+            return 0;
+        }
+
+        std::string annotate_assembly(const std::string& assembly, std::size_t& vector_count,
+                                      std::size_t& instruction_count)
+        {
+            std::istringstream is(assembly);
+            std::ostringstream os;
+            std::string line;
+            vector_count = 0;
+            instruction_count = 0;
+            while (std::getline(is, line))
+            {
+                std::size_t first = line.find_first_not_of(" \t");
+                bool instruction = first != std::string::npos && first > 0 &&
+                                   line[first] != '.' && line[first] != '#' && line[first] != ';' &&
+                                   line[first] != '/';
+                os << line;
+                if (instruction)
+                {
+                    ++instruction_count;
+                    int width = vector_width(line.substr(first));
+                    if (width != 0)
+                    {
+                        ++vector_count;
+                        os << "    # <-- vector, " << width << " bits";
+                    }
+                }
+                os << "\n";
+            }
+            return os.str();
+        }
+
+        std::string annotate_ir(const std::string& ir, std::size_t& vector_count,
+                                std::size_t& instruction_count)
+        {
+            static const std::regex vector_type(R"(<\s*[0-9]+ x )");
+            std::istringstream is(ir);
+            std::ostringstream os;
+            std::string line;
+            vector_count = 0;
+            instruction_count = 0;
+            while (std::getline(is, line))
+            {
+                os << line;
+                bool instruction = line.compare(0, 2, "  ") == 0 && line.find_first_not_of(" ") != std::string::npos;
+                if (instruction)
+                {
+                    ++instruction_count;
+                    if (std::regex_search(line, vector_type))
+                    {
+                        ++vector_count;
+                        os << "    ; <-- vector";
+                    }
+                }
+                os << "\n";
+            }
+            return os.str();
+        }
+
+        void publish_code(const std::string& title, const std::string& language, const std::string& code)
+        {
+            nl::json pub_data;
+            pub_data["text/plain"] = title + "\n" + code;
+            pub_data["text/markdown"] = "**" + title + "**\n\n```" + language + "\n" + code + "```\n";
+            xeus::get_interpreter().display_data(std::move(pub_data), nl::json::object(), nl::json::object());
+        }
+
+        std::string vector_summary(std::size_t vector_count, std::size_t instruction_count)
+        {
+            std::ostringstream os;
+            os << " (" << vector_count << " of " << instruction_count << " instructions are vector instructions)";
+            return os.str();
+        }
+
+        // Size of the machine code of the function at address.
+        bool jit_function_size(std::uint64_t address, std::uint64_t& size)
+        {
+            for (const jit_function& function : jit_functions())
+            {
+                if (function.address == address)
+                {
+                    size = function.size;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // Disassembles the machine code of the function that the JIT loaded,
+        // one instruction per line followed by its offset in the function.
+        bool emit_assembly(const cling::Interpreter& interpreter, const llvm::Function& function,
+                           std::string& assembly)
+        {
+            std::string name = function.getName().str();
+            void* address = interpreter.getAddressOfGlobal(name);
+            if (address == nullptr)
+            {
+                std::cerr << "The JIT did not load " << demangle(name) << std::endl;
+                return false;
+            }
+            std::uint64_t start = reinterpret_cast<std::uintptr_t>(address);
+            std::uint64_t size = 0;
+            if (!jit_function_size(start, size))
+            {
+                std::cerr << "The size of the machine code of " << demangle(name) << " is unknown" << std::endl;
+                return false;
+            }
+
+            llvm::InitializeNativeTargetDisassembler();
+            const clang::TargetOptions& target_opts = interpreter.getCI()->getTargetOpts();
+            const std::string& triple = target_opts.Triple;
+            std::string error;
+            const llvm::Target* target = llvm::TargetRegistry::lookupTarget(triple, error);
+            if (target == nullptr)
+            {
+                std::cerr << error << std::endl;
+                return false;
+            }
+            std::unique_ptr<llvm::MCRegisterInfo> register_info(target->createMCRegInfo(triple));
+            std::unique_ptr<llvm::MCAsmInfo> asm_info(register_info ? target->createMCAsmInfo(*register_info, triple) : nullptr);
+            std::unique_ptr<llvm::MCSubtargetInfo> subtarget_info(target->createMCSubtargetInfo(
+                triple, target_opts.CPU, llvm::join(target_opts.Features.begin(), target_opts.Features.end(), ",")));
+            std::unique_ptr<llvm::MCInstrInfo> instr_info(target->createMCInstrInfo());
+            if (!asm_info || !subtarget_info || !instr_info)
+            {
+                std::cerr << "The target cannot disassemble" << std::endl;
+                return false;
+            }
+            llvm::MCObjectFileInfo object_file_info;
+            llvm::MCContext context(asm_info.get(), register_info.get(), &object_file_info);
+            std::unique_ptr<llvm::MCDisassembler> disassembler(target->createMCDisassembler(*subtarget_info, context));
+            std::unique_ptr<llvm::MCInstPrinter> printer(target->createMCInstPrinter(
+                llvm::Triple(triple), asm_info->getAssemblerDialect(), *asm_info, *instr_info, *register_info));
+            if (!disassembler || !printer)
+            {
+                std::cerr << "The target cannot disassemble" << std::endl;
+                return false;
+            }
+
+            llvm::ArrayRef<std::uint8_t> bytes(static_cast<const std::uint8_t*>(address), size);
+            llvm::raw_string_ostream os(assembly);
+            os << name << ":\n";
+            std::uint64_t instruction_size = 0;
+            for (std::uint64_t offset = 0; offset < size; offset += instruction_size)
+            {
+                std::string text;
+                llvm::raw_string_ostream instruction_os(text);
+                llvm::MCInst instruction;
+                if (disassembler->getInstruction(instruction, instruction_size, bytes.slice(offset), start + offset,
+                                                 llvm::nulls(), llvm::nulls()) == llvm::MCDisassembler::Success)
+                {
+                    printer->printInst(&instruction, instruction_os, "", *subtarget_info);
+                }
+                else
+                {
+                    instruction_size = 1;
+                    instruction_os << ".byte " << llvm::format_hex(bytes[offset], 4);
+                }
+                instruction_os.flush();
+                os << "\t" << llvm::StringRef(text).ltrim() << "\t" << asm_info->getCommentString()
+                   << " +" << offset << "\n";
+            }
+            os.flush();
+            return true;
+        }
+    }
+
+    std::vector<const llvm::Function*> find_jit_functions(const cling::Interpreter& interpreter,
+                                                          const std::string& name)
+    {
+        std::vector<const llvm::Function*> res;
+        for (const cling::Transaction* t = interpreter.getFirstTransaction(); t != nullptr; t = t->getNext())
+        {
+            collect_functions(*t, name, res);
+        }
+
+        // Keep the most recent definition of each symbol.
+        std::vector<const llvm::Function*> latest;
+        std::set<std::string> seen;
+        for (auto it = res.rbegin(); it != res.rend(); ++it)
+        {
+            if (seen.insert((*it)->getName().str()).second)
+            {
+                latest.push_back(*it);
+            }
+        }
+        return latest;
+    }
+
+    xoptions llvm_ir::get_options()
+    {
+        xoptions options{"llvm_ir", "Show the optimized LLVM IR of a JIT-compiled function"};
+        options.add_options()
+            ("f,function", "name of the function", cxxopts::value<std::string>());
+        options.parse_positional("function");
+        return options;
+    }
+
+    void llvm_ir::operator()(const std::string& line)
+    {
+        auto options = get_options();
+        auto result = options.parse(line);
+        if (!result.count("function"))
+        {
+            std::cerr << "UsageError: %llvm_ir requires a function name\n";
+            return;
+        }
+
+        std::string name = result["function"].as<std::string>();
+        auto functions = find_jit_functions(m_interpreter, name);
+        if (functions.empty())
+        {
+            std::cerr << "No JIT-compiled function named " << name
+                      << ". Inline functions and function templates are only compiled once they are used.\n";
+            return;
+        }
+
+        for (const llvm::Function* function : functions)
+        {
+            std::string ir;
+            llvm::raw_string_ostream os(ir);
+            function->print(os);
+            os.flush();
+            std::size_t vector_count, instruction_count;
+            std::string code = annotate_ir(ir, vector_count, instruction_count);
+            publish_code(demangle(function->getName().str()) + vector_summary(vector_count, instruction_count),
+                         "llvm", code);
+        }
+    }
+
+    xoptions disassemble::get_options()
+    {
+        xoptions options{"disassemble", "Show the machine code of a JIT-compiled function"};
+        options.add_options()
+            ("f,function", "name of the function", cxxopts::value<std::string>());
+        options.parse_positional("function");
+        return options;
+    }
+
+    void disassemble::operator()(const std::string& line)
+    {
+        auto options = get_options();
+        auto result = options.parse(line);
+        if (!result.count("function"))
+        {
+            std::cerr << "UsageError: %disassemble requires a function name\n";
+            return;
+        }
+
+        std::string name = result["function"].as<std::string>();
+        auto functions = find_jit_functions(m_interpreter, name);
+        if (functions.empty())
+        {
+            std::cerr << "No JIT-compiled function named " << name
+                      << ". Inline functions and function templates are only compiled once they are used.\n";
+            return;
+        }
+
+        for (const llvm::Function* function : functions)
+        {
+            std::string assembly;
+            if (!emit_assembly(m_interpreter, *function, assembly))
+            {
+                return;
+            }
+            std::size_t vector_count, instruction_count;
+            std::string code = annotate_assembly(assembly, vector_count, instruction_count);
+            publish_code(demangle(function->getName().str()) + vector_summary(vector_count, instruction_count),
+                         "gas", code);
+        }
+    }
+}
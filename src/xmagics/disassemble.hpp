@@ -0,0 +1,60 @@
+/***********************************************************************************
+* Copyright (c) 2016, Johan Mabille, Loic Gouarin, Sylvain Corlay, Wolf Vollprecht *
+* Copyright (c) 2016, QuantStack                                                   *
+*                                                                                  *
+* Distributed under the terms of the BSD 3-Clause License.                         *
+*                                                                                  *
+* The full license is in the file LICENSE, distributed with this software.         *
+************************************************************************************/
+
+#ifndef XMAGICS_DISASSEMBLE_HPP
+#define XMAGICS_DISASSEMBLE_HPP
+
+#include <string>
+#include <vector>
+
+#include "llvm/IR/Function.h"
+#include "cling/Interpreter/Interpreter.h"
+
+#include "xeus-cling/xmagics.hpp"
+#include "xeus-cling/xoptions.hpp"
+
+namespace xcpp
+{
+    /**
+     * Returns the functions defined in the modules of the transactions whose
+     * mangled or demangled name is name, or whose demangled name is name
+     * followed by a parameter list. The most recent definitions come first.
+     */
+    std::vector<const llvm::Function*> find_jit_functions(const cling::Interpreter& interpreter,
+                                                          const std::string& name);
+
+    class llvm_ir : public xmagic_line
+    {
+    public:
+
+        llvm_ir(cling::Interpreter& i) : m_interpreter(i) {}
+
+        xoptions get_options();
+        virtual void operator()(const std::string& line) override;
+
+    private:
+
+        cling::Interpreter& m_interpreter;
+    };
+
+    class disassemble : public xmagic_line
+    {
+    public:
+
+        disassemble(cling::Interpreter& i) : m_interpreter(i) {}
+
+        xoptions get_options();
+        virtual void operator()(const std::string& line) override;
+
+    private:
+
+        cling::Interpreter& m_interpreter;
+    };
+}
+#endif
@@ -8,40 +8,82 @@
 ************************************************************************************/
 
 #include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
 #include <iostream>
 #include <iterator>
 #include <fstream>
+#include <functional>
 #include <memory>
+#include <set>
+#include <sstream>
 #include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 
 #include "llvm/ADT/SmallString.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/IR/Module.h"
+#include "llvm/ProfileData/InstrProfReader.h"
+#include "llvm/ProfileData/InstrProfWriter.h"
+#include "llvm/Support/CachePruning.h"
+#include "llvm/Support/DynamicLibrary.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/FileSystem.h"
 #include "llvm/Support/FileUtilities.h"
+#include "llvm/Support/MD5.h"
 #include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/Path.h"
 #include "llvm/Support/Program.h"
 #include "clang/AST/ASTContext.h"
+#include "clang/AST/DeclCXX.h"
 #include "clang/AST/DeclGroup.h"
+#include "clang/AST/Expr.h"
+#include "clang/AST/ExprCXX.h"
+#include "clang/AST/Mangle.h"
 #include "clang/AST/RecursiveASTVisitor.h"
 #include "clang/Basic/DebugInfoOptions.h"
 #include "clang/Basic/Sanitizers.h"
+#include "clang/Basic/SourceManager.h"
 #include "clang/Basic/TargetInfo.h"
+#include "clang/Basic/TargetOptions.h"
+#include "clang/Basic/Version.h"
 #include "clang/CodeGen/BackendUtil.h"
 #include "clang/CodeGen/ModuleBuilder.h"
 #include "clang/Frontend/CompilerInstance.h"
+#include "clang/Lex/Lexer.h"
 #include "cling/Interpreter/Interpreter.h"
 #include "cling/Interpreter/Transaction.h"
 
+#include "nlohmann/json.hpp"
+
+#include "xeus/xguid.hpp"
+#include "xeus/xinterpreter.hpp"
+
 #include "xeus-cling/xoptions.hpp"
 
+#include "../xdemangle.hpp"
+#include "../xmemory.hpp"
 #include "../xparser.hpp"
+#include "../xprocess.hpp"
 
+#include "codegen.hpp"
 #include "executable.hpp"
+#include "xray.hpp"
+
+namespace nl = nlohmann;
 
 namespace xcpp
 {
+    namespace
+    {
+        // Prefix of the functions holding the body of %%executable cells.
+        const std::string MainWrapperPrefix = "__xeus_cling_main_wrapper_";
+    }
+
     xoptions executable::get_options()
     {
         xoptions options{"executable", "write executable"};
@@ -49,7 +91,16 @@ namespace xcpp
             ("f,filename", "filename",
              cxxopts::value<std::string>()->default_value(""))
             ("o,options", "options",
-             cxxopts::value<std::vector<std::string>>()->default_value(""));
+             cxxopts::value<std::vector<std::string>>()->default_value(""))
+            ("no-cache", "do not reuse nor store object files in the cache")
+            ("all-decls", "emit all the declarations of the session, not only those reachable from main")
+            ("run", "run the executable once it is built")
+            ("background", "link the executable in the background, the kernel stays available")
+            ("pgo", "build with profile-guided optimization, trained on a run with the given arguments")
+            ("repeat", "number of times the executable is run",
+             cxxopts::value<std::size_t>()->default_value("1"))
+            ("arg", "argument passed to the executable, can be repeated",
+             cxxopts::value<std::vector<std::string>>());
         options.parse_positional({"filename", "options"});
         return options;
     }
@@ -65,7 +116,7 @@ namespace xcpp
         // Generate a unique fn that is not unloaded after generating the
         // executable. This is necessary for templates like std::endl to
         // work correctly in subsequent cells.
-        std::string fn_name = "__xeus_cling_main_wrapper_";
+        std::string fn_name = MainWrapperPrefix;
         fn_name += std::to_string(m_unique++);
         unique_fn = "int " + fn_name + "() {\n";
         unique_fn += cell + "\n";
@@ -90,7 +141,7 @@ namespace xcpp
         : public clang::RecursiveASTVisitor<FindTopLevelDecls>
     {
     public:
-        FindTopLevelDecls(clang::ASTConsumer* C) : m_consumer(C) {}
+        FindTopLevelDecls(std::vector<clang::Decl*>& Decls) : m_decls(Decls) {}
 
         bool shouldVisitTemplateInstantiations() { return true; }
 
@@ -104,7 +155,7 @@ namespace xcpp
                     return true;
                 }
             }
-            m_consumer->HandleTopLevelDecl(clang::DeclGroupRef(D));
+            add(D);
             return true;
         }
 
@@ -112,232 +163,1672 @@ namespace xcpp
         {
             if (D->isFileVarDecl())
             {
-                m_consumer->HandleTopLevelDecl(clang::DeclGroupRef(D));
+                add(D);
             }
             return true;
         }
 
     private:
-        clang::ASTConsumer* m_consumer;
+        void add(clang::Decl* D)
+        {
+            // A declaration can be reached from several entries of a
+            // transaction, but must only be emitted once per object.
+            if (m_seen.insert(D).second)
+            {
+                m_decls.push_back(D);
+            }
+        }
+
+        std::vector<clang::Decl*>& m_decls;
+        std::set<clang::Decl*> m_seen;
     };
 
-    bool executable::generate_obj(std::string& ObjectFile, bool EnableDebugInfo)
+    // Collects the functions and global variables that can be reached from
+    // a set of roots: through calls and references in their bodies and
+    // initializers, and through the constructors, destructors and virtual
+    // functions of the classes they create or destroy.
+    class FindReachableDecls
+        : public clang::RecursiveASTVisitor<FindReachableDecls>
     {
-        // Generate LLVM IR for current AST.
-        auto* CI = m_interpreter.getCI();
-        auto* Context = m_interpreter.getLLVMContext();
-        auto& AST = CI->getASTContext();
-        auto& HeaderSearchOpts = CI->getHeaderSearchOpts();
+    public:
+        bool shouldVisitTemplateInstantiations() { return true; }
+        bool shouldVisitImplicitCode() { return true; }
 
-        // Generate relocations suitable for dynamic linking.
-        auto CodeGenOpts = CI->getCodeGenOpts();
-        CodeGenOpts.RelocationModel = "pic";
+        void addRoot(clang::Decl* D) { reach(D); }
 
-        // Enable debug information if requested.
-        if (EnableDebugInfo)
+        // Only the bodies of the declarations accepted by the predicate are
+        // traversed, the others are reachable but their uses are not.
+        void setTraverse(std::function<bool(const clang::Decl*)> Traverse)
         {
-            CodeGenOpts.setDebugInfo(
-                clang::codegenoptions::DebugInfoKind::FullDebugInfo);
+            m_traverse = std::move(Traverse);
         }
 
-        std::unique_ptr<clang::CodeGenerator> CG(clang::CreateLLVMCodeGen(
-            CI->getDiagnostics(), "object", HeaderSearchOpts,
-            CI->getPreprocessorOpts(), CodeGenOpts, *Context));
-        CG->Initialize(AST);
-
-        FindTopLevelDecls Visitor(CG.get());
-        Visitor.TraverseDecl(AST.getTranslationUnitDecl());
-
-        CG->HandleTranslationUnit(AST);
-
-        // Generate (temporary) object code from LLVM IR.
-        int ObjectFD;
-        llvm::SmallString<64> ObjectFilePath;
-        std::error_code EC = llvm::sys::fs::createTemporaryFile(
-            "object", "o", ObjectFD, ObjectFilePath);
-        if (EC)
+        void run()
         {
-            std::cerr << "Could not create temporary object file:" << std::endl
-                      << EC.message() << std::endl;
-            return false;
+            while (!m_worklist.empty())
+            {
+                clang::Decl* D = m_worklist.back();
+                m_worklist.pop_back();
+                TraverseDecl(D);
+            }
         }
-        ObjectFile = ObjectFilePath.str();
 
-        std::unique_ptr<llvm::raw_pwrite_stream> OS(
-            new llvm::raw_fd_ostream(ObjectFD, true));
+        bool isReachable(const clang::Decl* D) const
+        {
+            return m_reachable.count(D->getCanonicalDecl()) != 0;
+        }
 
-        auto DataLayout = AST.getTargetInfo().getDataLayout();
-        EmitBackendOutput(CI->getDiagnostics(), HeaderSearchOpts,
-                          CodeGenOpts, CI->getTargetOpts(),
-                          CI->getLangOpts(), DataLayout, CG->GetModule(),
-                          clang::Backend_EmitObj, std::move(OS));
-        return true;
-    }
+        std::size_t size() const { return m_reachable.size(); }
 
-    bool executable::generate_exe(const std::string& ObjectFile,
-                                  const std::string& ExeFile,
-                                  const std::vector<std::string>& LinkerOptions)
-    {
-        auto& HeaderSearchOpts = m_interpreter.getCI()->getHeaderSearchOpts();
-        // Generate executable by linking the created object code.
-        llvm::StringRef InstallDir = llvm::sys::path::parent_path(
-            llvm::sys::path::parent_path(
-                llvm::sys::path::parent_path(HeaderSearchOpts.ResourceDir)));
-        llvm::SmallString<256> Compiler(InstallDir);
-        llvm::sys::path::append(Compiler, "bin", "clang++");
+        const std::set<const clang::Decl*>& decls() const { return m_reachable; }
 
-        // Construct arguments to linker command.
-        llvm::SmallVector<const char*, 16> Args;
-        Args.push_back(Compiler.c_str());
-        Args.push_back(ObjectFile.c_str());
-        for (auto& O : LinkerOptions)
+        bool VisitDeclRefExpr(clang::DeclRefExpr* E)
         {
-            Args.push_back(O.c_str());
+            reach(E->getDecl());
+            return true;
         }
-        Args.push_back("-o");
-        Args.push_back(ExeFile.c_str());
-        Args.push_back(NULL);
 
-        // Redirect output and error streams from linker.
-        llvm::SmallString<64> OutputFile, ErrorFile;
-        llvm::sys::fs::createTemporaryFile("linker", "out", OutputFile);
-        llvm::sys::fs::createTemporaryFile("linker", "err", ErrorFile);
-        llvm::FileRemover OutputRemover(OutputFile.c_str());
-        llvm::FileRemover ErrorRemover(ErrorFile.c_str());
+        bool VisitMemberExpr(clang::MemberExpr* E)
+        {
+            reach(E->getMemberDecl());
+            return true;
+        }
 
-        llvm::StringRef OutputFileStr(OutputFile);
-        llvm::StringRef ErrorFileStr(ErrorFile);
-        const llvm::StringRef* Redirects[] = {nullptr, &OutputFileStr,
-                                              &ErrorFileStr};
+        bool VisitCXXConstructExpr(clang::CXXConstructExpr* E)
+        {
+            reach(E->getConstructor());
+            return true;
+        }
 
-        // Finally run the linker.
-        int ret = llvm::sys::ExecuteAndWait(Compiler, Args.data(), nullptr,
-                                            Redirects);
+        bool VisitCXXNewExpr(clang::CXXNewExpr* E)
+        {
+            reach(E->getOperatorNew());
+            reach(E->getOperatorDelete());
+            return true;
+        }
 
-        // Read back output and error streams.
-        llvm::StringRef OutputStr, ErrorStr;
-        auto OutputBuf = llvm::MemoryBuffer::getFile(OutputFileStr);
-        if (OutputBuf)
+        bool VisitCXXDeleteExpr(clang::CXXDeleteExpr* E)
         {
-            OutputStr = OutputBuf.get()->getBuffer();
+            reach(E->getOperatorDelete());
+            reachDestructor(E->getDestroyedType());
+            return true;
         }
-        auto ErrorBuf = llvm::MemoryBuffer::getFile(ErrorFileStr);
-        if (ErrorBuf)
+
+        bool VisitCXXBindTemporaryExpr(clang::CXXBindTemporaryExpr* E)
         {
-            ErrorStr = ErrorBuf.get()->getBuffer();
+            reach(const_cast<clang::CXXDestructorDecl*>(E->getTemporary()->getDestructor()));
+            return true;
         }
 
-        // Forward to user.
-        if (!OutputStr.empty())
+        bool VisitCXXThrowExpr(clang::CXXThrowExpr* E)
         {
-            std::cout << "---" << std::endl;
-            std::cout << OutputStr.str();
+            if (E->getSubExpr())
+            {
+                reachDestructor(E->getSubExpr()->getType());
+            }
+            return true;
         }
-        if (!ErrorStr.empty())
+
+        // Default arguments and default member initializers are not part
+        // of the expressions that use them.
+        bool VisitCXXDefaultArgExpr(clang::CXXDefaultArgExpr* E)
         {
-            std::cerr << ErrorStr.str();
-            return false;
+            TraverseStmt(E->getExpr());
+            return true;
         }
-        else if (ret != 0)
+
+        bool VisitCXXDefaultInitExpr(clang::CXXDefaultInitExpr* E)
         {
-            // At least let the user know that something went wrong.
-            std::cerr << "Could not link executable" << std::endl;
-            return false;
+            TraverseStmt(E->getExpr());
+            return true;
         }
 
-        // Return success!
-        return true;
-    }
+        bool VisitLambdaExpr(clang::LambdaExpr* E)
+        {
+            for (auto* M : E->getLambdaClass()->methods())
+            {
+                reach(M);
+            }
+            return true;
+        }
 
-    void executable::operator()(const std::string& line, const std::string& cell)
-    {
-        auto options = get_options();
-        auto parsed = options.parse(line);
+        bool VisitVarDecl(clang::VarDecl* D)
+        {
+            reachDestructor(D->getType());
+            return true;
+        }
 
-        std::string ExeFile = parsed["filename"].as<std::string>();
-        if (ExeFile.empty())
+    private:
+        void reach(clang::Decl* D)
         {
-            std::cerr << "UsageError: "
-                      << "the following arguments are required: filename"
-                      << std::endl;
-            return;
+            if (D == nullptr)
+            {
+                return;
+            }
+            auto* FD = llvm::dyn_cast<clang::FunctionDecl>(D);
+            auto* VD = llvm::dyn_cast<clang::VarDecl>(D);
+            // Local variables are handled with the body they belong to.
+            if (FD == nullptr && (VD == nullptr || !VD->hasGlobalStorage() || VD->isStaticLocal()))
+            {
+                return;
+            }
+            if (!m_reachable.insert(D->getCanonicalDecl()).second ||
+                (m_traverse && !m_traverse(D)))
+            {
+                return;
+            }
+
+            if (FD != nullptr)
+            {
+                const clang::FunctionDecl* Definition = nullptr;
+                if (FD->hasBody(Definition))
+                {
+                    m_worklist.push_back(const_cast<clang::FunctionDecl*>(Definition));
+                }
+                if (auto* Ctor = llvm::dyn_cast<clang::CXXConstructorDecl>(FD))
+                {
+                    // The vtable of the class refers to all its virtual
+                    // functions, and what is constructed gets destroyed.
+                    reachVirtuals(Ctor->getParent());
+                    if (auto* Dtor = Ctor->getParent()->getDestructor())
+                    {
+                        reach(Dtor);
+                    }
+                }
+                if (auto* Dtor = llvm::dyn_cast<clang::CXXDestructorDecl>(FD))
+                {
+                    const clang::CXXRecordDecl* RD = Dtor->getParent();
+                    for (const auto* Field : RD->fields())
+                    {
+                        reachDestructor(Field->getType());
+                    }
+                    for (const auto& Base : RD->bases())
+                    {
+                        reachDestructor(Base.getType());
+                    }
+                }
+            }
+            else if (clang::VarDecl* Definition = VD->getDefinition())
+            {
+                m_worklist.push_back(Definition);
+            }
         }
-        std::vector<std::string> LinkerOptions =
-            parsed["options"].as<std::vector<std::string>>();
 
-        std::string main, unique_fn;
-        generate_fns(cell, main, unique_fn);
-        // First declare the unique_fn that is not unloaded.
-        auto result = m_interpreter.declare(unique_fn);
-        if (result != cling::Interpreter::kSuccess)
+        void reachVirtuals(const clang::CXXRecordDecl* RD)
         {
-            return;
+            if (RD == nullptr || !RD->hasDefinition())
+            {
+                return;
+            }
+            RD = RD->getDefinition();
+            if (!m_classes.insert(RD).second)
+            {
+                return;
+            }
+            for (auto* M : RD->methods())
+            {
+                if (M->isVirtual())
+                {
+                    reach(M);
+                }
+            }
+            for (const auto& Base : RD->bases())
+            {
+                reachVirtuals(Base.getType()->getAsCXXRecordDecl());
+            }
         }
 
-        // Now declare main() function.
-        cling::Transaction* t = nullptr;
-        result = m_interpreter.declare(main, &t);
-        if (result != cling::Interpreter::kSuccess || t == nullptr)
+        void reachDestructor(clang::QualType T)
         {
-            return;
+            if (T.isNull())
+            {
+                return;
+            }
+            const clang::CXXRecordDecl* RD = T->getBaseElementTypeUnsafe()->getAsCXXRecordDecl();
+            if (RD != nullptr && RD->hasDefinition())
+            {
+                reach(RD->getDefinition()->getDestructor());
+            }
         }
 
-        // Make sure to unload the transaction that added the main() function.
-        // This enables repeated execution of a %%executable cell.
-        struct Unloader
+        std::set<const clang::Decl*> m_reachable;
+        std::set<const clang::CXXRecordDecl*> m_classes;
+        std::vector<clang::Decl*> m_worklist;
+        std::function<bool(const clang::Decl*)> m_traverse;
+    };
+
+    namespace
+    {
+        void collectTransactionDecls(const cling::Transaction& T,
+                                     FindTopLevelDecls& Visitor,
+                                     std::vector<clang::Decl*>& AllDecls)
         {
-            cling::Interpreter& m_interpreter;
-            cling::Transaction& m_transaction;
-            Unloader(cling::Interpreter& i, cling::Transaction& t)
-                : m_interpreter(i), m_transaction(t) {}
-            ~Unloader()
+            for (auto I = T.decls_begin(), E = T.decls_end(); I != E; ++I)
             {
-                m_interpreter.unload(m_transaction);
+                for (clang::Decl* D : I->m_DGR)
+                {
+                    AllDecls.push_back(D);
+                    Visitor.TraverseDecl(D);
+                }
+            }
+            if (T.hasNestedTransactions())
+            {
+                for (auto N = T.nested_begin(), E = T.nested_end(); N != E; ++N)
+                {
+                    collectTransactionDecls(**N, Visitor, AllDecls);
+                }
             }
         }
-        unloader(m_interpreter, *t);
 
-        // Enable debug information if user requested -g in the linker options.
-        bool EnableDebugInfo =
-            (std::find(LinkerOptions.begin(), LinkerOptions.end(),
-                       "-g") != LinkerOptions.end());
-        if (EnableDebugInfo)
+        // Whether the transaction defines the wrapper of a previous
+        // %%executable cell, which is not called by the current main.
+        bool isPreviousMainWrapper(const std::vector<clang::Decl*>& Decls,
+                                   const std::string& CurrentWrapper)
         {
-            std::cout << "Enabling debug information" << std::endl;
+            return std::any_of(Decls.begin(), Decls.end(), [&CurrentWrapper](const clang::Decl* D)
+            {
+                const auto* FD = llvm::dyn_cast<clang::FunctionDecl>(D);
+                if (FD == nullptr || FD->getIdentifier() == nullptr)
+                {
+                    return false;
+                }
+                llvm::StringRef Name = FD->getName();
+                return Name.startswith(MainWrapperPrefix) && Name != CurrentWrapper;
+            });
         }
 
-        // Enable TSan instrumentation if user requested -fsanitize=thread in
-        // the linker options.
-        bool SanitizeThread =
-            (std::find(LinkerOptions.begin(), LinkerOptions.end(),
-                       "-fsanitize=thread") != LinkerOptions.end());
-        auto& SanitizeOpts = m_interpreter.getCI()->getLangOpts().Sanitize;
-        if (SanitizeThread)
+        // The wrappers are numbered in the order of the runs: the number is
+        // left out of the hash so that running the same cell again in the
+        // session gives the same key.
+        std::string withoutWrapperNumbers(llvm::StringRef Buffer)
         {
-            std::cout << "Enabling instrumentation for ThreadSanitizer"
-                      << std::endl;
-            SanitizeOpts.set(clang::SanitizerKind::Thread, true);
+            std::string Res;
+            Res.reserve(Buffer.size());
+            std::size_t Pos = 0;
+            while (Pos < Buffer.size())
+            {
+                std::size_t Found = Buffer.find(MainWrapperPrefix, Pos);
+                if (Found == llvm::StringRef::npos)
+                {
+                    Res += Buffer.substr(Pos).str();
+                    break;
+                }
+                Found += MainWrapperPrefix.size();
+                Res += Buffer.slice(Pos, Found).str();
+                Pos = Found;
+                while (Pos < Buffer.size() && std::isdigit(static_cast<unsigned char>(Buffer[Pos])))
+                {
+                    ++Pos;
+                }
+            }
+            return Res;
+        }
 
-            // Imply debug information because it gives the user a clue which
-            // line of the input caused the race.
-            EnableDebugInfo = true;
+        // Hashes the source of the declarations of a transaction. Files are
+        // identified by their path, size and modification time, cells by
+        // their content.
+        void hashTransaction(llvm::MD5& Hash, clang::SourceManager& SM,
+                             const std::vector<clang::Decl*>& Decls)
+        {
+            std::set<clang::FileID> Files;
+            for (const clang::Decl* D : Decls)
+            {
+                clang::SourceLocation Loc = D->getLocation();
+                if (Loc.isValid())
+                {
+                    Files.insert(SM.getFileID(SM.getExpansionLoc(Loc)));
+                }
+                else if (auto* ND = llvm::dyn_cast<clang::NamedDecl>(D))
+                {
+                    Hash.update(ND->getQualifiedNameAsString());
+                }
+                Hash.update(D->getDeclKindName());
+            }
+            for (const clang::FileID& FID : Files)
+            {
+                if (const clang::FileEntry* FE = SM.getFileEntryForID(FID))
+                {
+                    Hash.update(FE->getName());
+                    Hash.update(std::to_string(FE->getSize()));
+                    Hash.update(std::to_string(FE->getModificationTime()));
+                }
+                else
+                {
+                    bool Invalid = false;
+                    llvm::StringRef Buffer = SM.getBufferData(FID, &Invalid);
+                    if (!Invalid)
+                    {
+                        Hash.update(withoutWrapperNumbers(Buffer));
+                    }
+                }
+            }
         }
 
-        std::cout << "Writing executable to " << ExeFile << std::endl;
+        std::string codeGenKey(const clang::CompilerInstance& CI,
+                               const clang::CodeGenOptions& CodeGenOpts,
+                               bool EmitBitcode)
+        {
+            const auto& TargetOpts = CI.getTargetOpts();
+            std::string Key = clang::getClangFullVersion();
+            Key += EmitBitcode ? ";bc" : ";obj";
+            Key += ";O" + std::to_string(CodeGenOpts.OptimizationLevel);
+            Key += ";fm" + std::to_string(CI.getLangOpts().FastMath) +
+                   std::to_string(CodeGenOpts.UnsafeFPMath) + std::to_string(CodeGenOpts.NoInfsFPMath) +
+                   std::to_string(CodeGenOpts.NoNaNsFPMath) + std::to_string(CodeGenOpts.NoSignedZeros);
+            Key += ";g" + std::to_string(static_cast<int>(CodeGenOpts.getDebugInfo()));
+            Key += ";" + CodeGenOpts.RelocationModel;
+            Key += ";san" + std::to_string(CI.getLangOpts().Sanitize.Mask);
+            Key += ";xray" + std::to_string(CodeGenOpts.XRayInstrumentFunctions) + ":" +
+                   std::to_string(CodeGenOpts.XRayInstructionThreshold);
+            Key += ";" + TargetOpts.Triple + ";" + TargetOpts.CPU;
+            for (const auto& Feature : TargetOpts.Features)
+            {
+                Key += "," + Feature;
+            }
+            return Key;
+        }
 
-        std::string ObjectFile;
-        if (!generate_obj(ObjectFile, EnableDebugInfo))
+        // Globals whose initialization or destruction has side effects run
+        // in the executable whether main uses them or not.
+        bool hasDynamicInitialization(clang::ASTContext& AST, const clang::Decl* D)
         {
-            return;
+            const auto* VD = llvm::dyn_cast<clang::VarDecl>(D);
+            if (VD == nullptr || !VD->isThisDeclarationADefinition() ||
+                VD->getDeclContext()->isDependentContext() || VD->getDescribedVarTemplate())
+            {
+                return false;
+            }
+            const clang::Expr* Init = VD->getInit();
+            if (Init != nullptr && !Init->isValueDependent() &&
+                !Init->isConstantInitializer(AST, VD->getType()->isReferenceType()))
+            {
+                return true;
+            }
+            const clang::CXXRecordDecl* RD = VD->getType()->getBaseElementTypeUnsafe()->getAsCXXRecordDecl();
+            return RD != nullptr && RD->hasDefinition() && !RD->hasTrivialDestructor();
         }
-        // Cleanup after we exit.
-        llvm::FileRemover ObjectRemover(ObjectFile);
 
-        generate_exe(ObjectFile, ExeFile, LinkerOptions);
+        // The target and the language options are shared between the
+        // interpreter and the ahead-of-time code generation.
+        struct OptionsRestorer
+        {
+            clang::CompilerInstance& m_CI;
+            clang::TargetOptions m_TargetOpts;
+            unsigned m_FastMath, m_FiniteMathOnly;
+            clang::SanitizerSet m_Sanitize;
+            OptionsRestorer(clang::CompilerInstance& CI)
+                : m_CI(CI), m_TargetOpts(CI.getTargetOpts()),
+                  m_FastMath(CI.getLangOpts().FastMath),
+                  m_FiniteMathOnly(CI.getLangOpts().FiniteMathOnly),
+                  m_Sanitize(CI.getLangOpts().Sanitize) {}
+            ~OptionsRestorer()
+            {
+                auto& TargetOpts = m_CI.getTargetOpts();
+                TargetOpts.CPU = m_TargetOpts.CPU;
+                TargetOpts.Features = m_TargetOpts.Features;
+                TargetOpts.FeaturesAsWritten = m_TargetOpts.FeaturesAsWritten;
+                TargetOpts.FeatureMap = m_TargetOpts.FeatureMap;
+                m_CI.getTarget().setCPU(m_TargetOpts.CPU);
+                m_CI.getLangOpts().FastMath = m_FastMath;
+                m_CI.getLangOpts().FiniteMathOnly = m_FiniteMathOnly;
+                m_CI.getLangOpts().Sanitize = m_Sanitize;
+            }
+        };
 
-        if (SanitizeThread)
+        std::string objectCacheDirectory()
         {
-            SanitizeOpts.set(clang::SanitizerKind::Thread, false);
+            llvm::SmallString<256> Path;
+            if (!llvm::sys::path::user_cache_directory(Path, "xeus-cling", "objects") ||
+                llvm::sys::fs::create_directories(Path))
+            {
+                return "";
+            }
+            return Path.str();
+        }
+    }
+
+    bool executable::generate_objs(std::vector<std::string>& ObjectFiles,
+                                   std::vector<std::string>& TemporaryFiles,
+                                   const clang::CodeGenOptions& CodeGenOpts,
+                                   bool EmitBitcode, bool UseCache,
+                                   bool OnlyReachable)
+    {
+        auto* CI = m_interpreter.getCI();
+        auto& SM = CI->getSourceManager();
+
+        std::string CacheDir = UseCache ? objectCacheDirectory() : "";
+
+        // The object depends on the options of the code generator and on the
+        // declarations of all the transactions, which are hashed in order.
+        // The wrappers of the previous runs of %%executable cells are left
+        // out of the object and of the key.
+        std::string CurrentWrapper = MainWrapperPrefix + std::to_string(m_unique - 1);
+        llvm::MD5 Hash;
+        Hash.update(codeGenKey(*CI, CodeGenOpts, EmitBitcode));
+        std::vector<std::vector<clang::Decl*>> TransactionDecls;
+        for (const cling::Transaction* T = m_interpreter.getFirstTransaction();
+             T != nullptr; T = T->getNext())
+        {
+            std::vector<clang::Decl*> AllDecls, Decls;
+            FindTopLevelDecls Visitor(Decls);
+            collectTransactionDecls(*T, Visitor, AllDecls);
+            if (isPreviousMainWrapper(AllDecls, CurrentWrapper))
+            {
+                continue;
+            }
+            hashTransaction(Hash, SM, AllDecls);
+            TransactionDecls.push_back(std::move(Decls));
+        }
+
+        FindReachableDecls Reachable;
+        std::size_t Total = 0;
+        if (OnlyReachable)
+        {
+            // The last transaction is the one defining main().
+            for (std::size_t I = 0; I < TransactionDecls.size(); ++I)
+            {
+                for (clang::Decl* D : TransactionDecls[I])
+                {
+                    if (I + 1 == TransactionDecls.size() || hasDynamicInitialization(CI->getASTContext(), D))
+                    {
+                        Reachable.addRoot(D);
+                    }
+                }
+                Total += TransactionDecls[I].size();
+            }
+            Reachable.run();
+        }
+
+        // All the declarations are emitted into a single module: the inline
+        // functions and the template instantiations are only emitted where
+        // they are used, and the functions and variables with internal
+        // linkage must not be duplicated across objects.
+        std::vector<clang::Decl*> Decls;
+        std::string Selection;
+        for (const auto& TDecls : TransactionDecls)
+        {
+            for (clang::Decl* D : TDecls)
+            {
+                bool Selected = !OnlyReachable || Reachable.isReachable(D);
+                if (Selected)
+                {
+                    Decls.push_back(D);
+                }
+                Selection += Selected ? '1' : '0';
+            }
+        }
+        if (OnlyReachable)
+        {
+            std::cout << "Emitting " << Decls.size() << " of " << Total
+                      << " declarations reachable from main" << std::endl;
+        }
+
+        Hash.update(Selection);
+        llvm::MD5::MD5Result Result;
+        Hash.final(Result);
+        llvm::SmallString<32> Digest;
+        llvm::MD5::stringifyResult(Result, Digest);
+
+        std::string ObjectFile;
+        if (!CacheDir.empty())
+        {
+            llvm::SmallString<256> CachePath(CacheDir);
+            llvm::sys::path::append(CachePath, "llvmcache-" + Digest.str() + ".o");
+            ObjectFile = CachePath.str();
+            auto Policy = llvm::parseCachePruningPolicy("prune_interval=1h:prune_after=168h");
+            if (Policy)
+            {
+                llvm::pruneCache(CacheDir, *Policy);
+            }
+            else
+            {
+                llvm::consumeError(Policy.takeError());
+            }
+            if (llvm::sys::fs::exists(ObjectFile))
+            {
+                std::cout << "Reusing the cached object file" << std::endl;
+                ObjectFiles.push_back(ObjectFile);
+                return true;
+            }
+        }
+
+        // The object is written to a temporary file first so that a cache
+        // entry is never seen partially written.
+        llvm::SmallString<64> ObjectFilePath;
+        std::error_code EC = llvm::sys::fs::createTemporaryFile(
+            "object", "o", ObjectFilePath);
+        if (EC)
+        {
+            std::cerr << "Could not create temporary object file:" << std::endl
+                      << EC.message() << std::endl;
+            return false;
+        }
+        TemporaryFiles.push_back(ObjectFilePath.str());
+
+        if (!generate_obj(Decls, CodeGenOpts, EmitBitcode, ObjectFilePath.str()))
+        {
+            return false;
+        }
+
+        if (ObjectFile.empty() || llvm::sys::fs::rename(ObjectFilePath, ObjectFile))
+        {
+            ObjectFile = ObjectFilePath.str();
+        }
+        else
+        {
+            TemporaryFiles.pop_back();
+        }
+        ObjectFiles.push_back(ObjectFile);
+        return true;
+    }
+
+    bool executable::generate_obj(const std::vector<clang::Decl*>& Decls,
+                                  const clang::CodeGenOptions& CodeGenOpts,
+                                  bool EmitBitcode,
+                                  const std::string& ObjectFile)
+    {
+        // Generate LLVM IR for the declarations.
+        auto* CI = m_interpreter.getCI();
+        auto* Context = m_interpreter.getLLVMContext();
+        auto& AST = CI->getASTContext();
+        auto& HeaderSearchOpts = CI->getHeaderSearchOpts();
+
+        std::unique_ptr<clang::CodeGenerator> CG(clang::CreateLLVMCodeGen(
+            CI->getDiagnostics(), "object", HeaderSearchOpts,
+            CI->getPreprocessorOpts(), CodeGenOpts, *Context));
+        CG->Initialize(AST);
+
+        for (clang::Decl* D : Decls)
+        {
+            CG->HandleTopLevelDecl(clang::DeclGroupRef(D));
+        }
+
+        CG->HandleTranslationUnit(AST);
+
+        // Generate object code from LLVM IR.
+        std::error_code EC;
+        std::unique_ptr<llvm::raw_pwrite_stream> OS(
+            new llvm::raw_fd_ostream(ObjectFile, EC, llvm::sys::fs::F_None));
+        if (EC)
+        {
+            std::cerr << "Could not open object file:" << std::endl
+                      << EC.message() << std::endl;
+            return false;
+        }
+
+        auto DataLayout = AST.getTargetInfo().getDataLayout();
+        EmitBackendOutput(CI->getDiagnostics(), HeaderSearchOpts,
+                          CodeGenOpts, CI->getTargetOpts(),
+                          CI->getLangOpts(), DataLayout, CG->GetModule(),
+                          EmitBitcode ? clang::Backend_EmitBC : clang::Backend_EmitObj,
+                          std::move(OS));
+        return true;
+    }
+
+    std::vector<std::string> executable::link_command(const std::vector<std::string>& ObjectFiles,
+                                                      const std::string& ExeFile,
+                                                      const std::vector<std::string>& LinkerOptions)
+    {
+        auto& HeaderSearchOpts = m_interpreter.getCI()->getHeaderSearchOpts();
+        // Link with the clang++ installed next to the resource directory.
+        llvm::StringRef InstallDir = llvm::sys::path::parent_path(
+            llvm::sys::path::parent_path(
+                llvm::sys::path::parent_path(HeaderSearchOpts.ResourceDir)));
+        llvm::SmallString<256> Compiler(InstallDir);
+        llvm::sys::path::append(Compiler, "bin", "clang++");
+
+        std::vector<std::string> Command = {Compiler.str()};
+        Command.insert(Command.end(), ObjectFiles.begin(), ObjectFiles.end());
+        Command.insert(Command.end(), LinkerOptions.begin(), LinkerOptions.end());
+        Command.push_back("-o");
+        Command.push_back(ExeFile);
+        return Command;
+    }
+
+    bool executable::generate_exe(const std::vector<std::string>& ObjectFiles,
+                                  const std::string& ExeFile,
+                                  const std::vector<std::string>& LinkerOptions)
+    {
+        // Generate executable by linking the created object code.
+        std::vector<std::string> Command = link_command(ObjectFiles, ExeFile, LinkerOptions);
+
+        // Construct arguments to linker command.
+        llvm::SmallVector<const char*, 16> Args;
+        for (auto& Arg : Command)
+        {
+            Args.push_back(Arg.c_str());
+        }
+        Args.push_back(NULL);
+
+        // Redirect output and error streams from linker.
+        llvm::SmallString<64> OutputFile, ErrorFile;
+        llvm::sys::fs::createTemporaryFile("linker", "out", OutputFile);
+        llvm::sys::fs::createTemporaryFile("linker", "err", ErrorFile);
+        llvm::FileRemover OutputRemover(OutputFile.c_str());
+        llvm::FileRemover ErrorRemover(ErrorFile.c_str());
+
+        llvm::StringRef OutputFileStr(OutputFile);
+        llvm::StringRef ErrorFileStr(ErrorFile);
+        const llvm::StringRef* Redirects[] = {nullptr, &OutputFileStr,
+                                              &ErrorFileStr};
+
+        // Finally run the linker.
+        int ret = llvm::sys::ExecuteAndWait(Command.front(), Args.data(), nullptr,
+                                            Redirects);
+
+        // Read back output and error streams.
+        llvm::StringRef OutputStr, ErrorStr;
+        auto OutputBuf = llvm::MemoryBuffer::getFile(OutputFileStr);
+        if (OutputBuf)
+        {
+            OutputStr = OutputBuf.get()->getBuffer();
+        }
+        auto ErrorBuf = llvm::MemoryBuffer::getFile(ErrorFileStr);
+        if (ErrorBuf)
+        {
+            ErrorStr = ErrorBuf.get()->getBuffer();
+        }
+
+        // Forward to user.
+        if (!OutputStr.empty())
+        {
+            std::cout << "---" << std::endl;
+            std::cout << OutputStr.str();
+        }
+        if (!ErrorStr.empty())
+        {
+            std::cerr << ErrorStr.str();
+            return false;
+        }
+        else if (ret != 0)
+        {
+            // At least let the user know that something went wrong.
+            std::cerr << "Could not link executable" << std::endl;
+            return false;
+        }
+
+        // Return success!
+        return true;
+    }
+
+    namespace
+    {
+        // Progress of a link running in the background, shown in a display
+        // updated in place, also after the cell that started it completed.
+        class build_display
+        {
+        public:
+
+            build_display(const std::string& title)
+                : m_id(xeus::new_xguid()), m_title(title),
+                  m_start(std::chrono::steady_clock::now()), m_last(m_start)
+            {
+            }
+
+            void append(const char* data, std::size_t size)
+            {
+                m_log.append(data, size);
+                // Coalesce the output of the linker into a few updates.
+                auto now = std::chrono::steady_clock::now();
+                if (now - m_last > std::chrono::milliseconds(250))
+                {
+                    publish("running", true);
+                    m_last = now;
+                }
+            }
+
+            void publish(const std::string& status, bool update) const
+            {
+                std::ostringstream text;
+                text << m_title << ": " << status << " after " << std::fixed << std::setprecision(1)
+                     << std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count()
+                     << " s";
+                if (!m_log.empty())
+                {
+                    text << "\n---\n" << m_log;
+                }
+
+                nl::json data;
+                data["text/plain"] = text.str();
+                nl::json transient;
+                transient["display_id"] = m_id;
+                if (update)
+                {
+                    xeus::get_interpreter().update_display_data(std::move(data), nl::json::object(),
+                                                                std::move(transient));
+                }
+                else
+                {
+                    xeus::get_interpreter().display_data(std::move(data), nl::json::object(),
+                                                         std::move(transient));
+                }
+            }
+
+        private:
+
+            xeus::xguid m_id;
+            std::string m_title;
+            std::string m_log;
+            std::chrono::steady_clock::time_point m_start;
+            std::chrono::steady_clock::time_point m_last;
+        };
+    }
+
+    link_threads::~link_threads()
+    {
+        for (auto& link : m_threads)
+        {
+            link.thread.join();
+        }
+    }
+
+    void link_threads::start(std::function<void()> link)
+    {
+        // The links that completed since the last one are joined first.
+        for (auto it = m_threads.begin(); it != m_threads.end();)
+        {
+            if (*it->finished)
+            {
+                it->thread.join();
+                it = m_threads.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+
+        auto finished = std::make_shared<std::atomic<bool>>(false);
+        std::thread thread([link, finished]()
+        {
+            link();
+            *finished = true;
+        });
+        m_threads.push_back({std::move(thread), std::move(finished)});
+    }
+
+    void executable::link_in_background(const std::vector<std::string>& ObjectFiles,
+                                        std::vector<std::string> TemporaryFiles,
+                                        const std::string& ExeFile,
+                                        const std::vector<std::string>& LinkerOptions)
+    {
+        std::vector<std::string> Command = link_command(ObjectFiles, ExeFile, LinkerOptions);
+        build_display Display("Linking " + ExeFile);
+        Display.publish("started", false);
+
+        p_links->start([Command, TemporaryFiles, Display]() mutable
+        {
+            auto Append = [&Display](const char* Data, std::size_t Size)
+            {
+                Display.append(Data, Size);
+            };
+            int Status = run_process(Command, Append, Append);
+            for (auto& TemporaryFile : TemporaryFiles)
+            {
+                llvm::sys::fs::remove(TemporaryFile);
+            }
+            Display.publish(Status == 0 ? "done" : "failed with exit status " + std::to_string(Status), true);
+        });
+    }
+
+    void executable::operator()(const std::string& line, const std::string& cell)
+    {
+        auto options = get_options();
+        auto parsed = options.parse(line);
+
+        std::string ExeFile = parsed["filename"].as<std::string>();
+        if (ExeFile.empty())
+        {
+            std::cerr << "UsageError: "
+                      << "the following arguments are required: filename"
+                      << std::endl;
+            return;
+        }
+        std::vector<std::string> LinkerOptions =
+            parsed["options"].as<std::vector<std::string>>();
+
+        // Executables instrumented with XRay are run to collect the trace.
+        bool XRay =
+            (std::find(LinkerOptions.begin(), LinkerOptions.end(),
+                       "-fxray-instrument") != LinkerOptions.end());
+        bool Run = parsed.count("run") || XRay;
+        bool Background = parsed.count("background") != 0;
+        if (Background && (Run || parsed.count("pgo")))
+        {
+            std::cerr << "UsageError: --background cannot be combined with --run, --pgo "
+                      << "or -fxray-instrument" << std::endl;
+            return;
+        }
+        if (XRay && parsed.count("pgo"))
+        {
+            std::cerr << "UsageError: --pgo cannot be combined with -fxray-instrument"
+                      << std::endl;
+            return;
+        }
+#if defined(_WIN32)
+        if (Background)
+        {
+            std::cerr << "UsageError: --background is not supported on Windows" << std::endl;
+            return;
+        }
+#endif
+
+        std::string main, unique_fn;
+        generate_fns(cell, main, unique_fn);
+        // First declare the unique_fn that is not unloaded.
+        auto result = m_interpreter.declare(unique_fn);
+        if (result != cling::Interpreter::kSuccess)
+        {
+            return;
+        }
+
+        // Now declare main() function.
+        cling::Transaction* t = nullptr;
+        result = m_interpreter.declare(main, &t);
+        if (result != cling::Interpreter::kSuccess || t == nullptr)
+        {
+            return;
+        }
+
+        // Make sure to unload the transaction that added the main() function.
+        // This enables repeated execution of a %%executable cell.
+        struct Unloader
+        {
+            cling::Interpreter& m_interpreter;
+            cling::Transaction& m_transaction;
+            Unloader(cling::Interpreter& i, cling::Transaction& t)
+                : m_interpreter(i), m_transaction(t) {}
+            ~Unloader()
+            {
+                m_interpreter.unload(m_transaction);
+            }
+        }
+        unloader(m_interpreter, *t);
+
+        // Enable debug information if user requested -g in the linker options.
+        bool EnableDebugInfo =
+            (std::find(LinkerOptions.begin(), LinkerOptions.end(),
+                       "-g") != LinkerOptions.end());
+        if (EnableDebugInfo)
+        {
+            std::cout << "Enabling debug information" << std::endl;
+        }
+
+        auto* CI = m_interpreter.getCI();
+
+        // The target and the language options are shared with the
+        // interpreter: restore them once the objects are generated.
+        OptionsRestorer restorer(*CI);
+
+        // Enable TSan instrumentation if user requested -fsanitize=thread in
+        // the linker options.
+        bool SanitizeThread =
+            (std::find(LinkerOptions.begin(), LinkerOptions.end(),
+                       "-fsanitize=thread") != LinkerOptions.end());
+        if (SanitizeThread)
+        {
+            std::cout << "Enabling instrumentation for ThreadSanitizer"
+                      << std::endl;
+            CI->getLangOpts().Sanitize.set(clang::SanitizerKind::Thread, true);
+
+            // Imply debug information because it gives the user a clue which
+            // line of the input caused the race.
+            EnableDebugInfo = true;
+        }
+
+        // Generate relocations suitable for dynamic linking.
+        auto CodeGenOpts = CI->getCodeGenOpts();
+        CodeGenOpts.RelocationModel = "pic";
+
+        // Enable debug information if requested.
+        if (EnableDebugInfo)
+        {
+            CodeGenOpts.setDebugInfo(
+                clang::codegenoptions::DebugInfoKind::FullDebugInfo);
+        }
+
+        // Build with the optimization level requested with -O<n> in the
+        // linker options, instead of the one of the interpreter.
+        int OptLevel = get_optlevel(LinkerOptions);
+        if (OptLevel >= 0)
+        {
+            std::cout << "Optimizing with -O" << OptLevel << std::endl;
+            CodeGenOpts.OptimizationLevel = OptLevel;
+            CodeGenOpts.setInlining(OptLevel > 1
+                ? clang::CodeGenOptions::NormalInlining
+                : clang::CodeGenOptions::OnlyAlwaysInlining);
+        }
+
+        // Generate code for the CPU requested with -march=<cpu>.
+        std::string CPU = get_march(LinkerOptions);
+        if (!CPU.empty())
+        {
+            if (!set_target_cpu(m_interpreter, CPU))
+            {
+                std::cerr << "Unknown CPU " << CPU << std::endl;
+                return;
+            }
+            std::cout << "Generating code for " << CI->getTargetOpts().CPU << std::endl;
+        }
+
+        // Relax the floating-point semantics if requested with -ffast-math,
+        // which the linker also gets to set the flush-to-zero mode.
+        if (std::find(LinkerOptions.begin(), LinkerOptions.end(),
+                      "-ffast-math") != LinkerOptions.end())
+        {
+            std::cout << "Enabling fast floating-point math" << std::endl;
+            CI->getLangOpts().FastMath = 1;
+            CI->getLangOpts().FiniteMathOnly = 1;
+            CodeGenOpts.UnsafeFPMath = 1;
+            CodeGenOpts.NoInfsFPMath = 1;
+            CodeGenOpts.NoNaNsFPMath = 1;
+            CodeGenOpts.NoSignedZeros = 1;
+            CodeGenOpts.LessPreciseFPMAD = 1;
+        }
+
+        // With -flto, the objects hold bitcode optimized together at link time.
+        bool EmitBitcode =
+            (std::find(LinkerOptions.begin(), LinkerOptions.end(),
+                       "-flto") != LinkerOptions.end());
+        if (EmitBitcode)
+        {
+            std::cout << "Enabling link-time optimization" << std::endl;
+            CodeGenOpts.PrepareForLTO = 1;
+        }
+
+        // Instrument the functions with XRay sleds if requested with
+        // -fxray-instrument, which the linker also gets to add the runtime.
+        if (XRay)
+        {
+            std::cout << "Enabling XRay instrumentation" << std::endl;
+            CodeGenOpts.XRayInstrumentFunctions = 1;
+            const std::string ThresholdOption = "-fxray-instruction-threshold=";
+            for (const auto& Option : LinkerOptions)
+            {
+                if (Option.compare(0, ThresholdOption.size(), ThresholdOption) == 0)
+                {
+                    CodeGenOpts.XRayInstructionThreshold =
+                        static_cast<unsigned>(std::strtoul(Option.c_str() + ThresholdOption.size(), nullptr, 10));
+                }
+            }
+        }
+
+        std::vector<std::string> Args;
+        if (parsed.count("arg"))
+        {
+            Args = parsed["arg"].as<std::vector<std::string>>();
+        }
+
+        if (parsed.count("pgo"))
+        {
+            if (OptLevel < 0)
+            {
+                CodeGenOpts.OptimizationLevel = 2;
+                CodeGenOpts.setInlining(clang::CodeGenOptions::NormalInlining);
+            }
+            build_pgo(CodeGenOpts, EmitBitcode, !parsed.count("all-decls"),
+                      ExeFile, LinkerOptions, Args, parsed["repeat"].as<std::size_t>());
+            return;
+        }
+
+        std::cout << "Writing executable to " << ExeFile << std::endl;
+
+        std::vector<std::string> ObjectFiles, TemporaryFiles;
+        bool Generated = generate_objs(ObjectFiles, TemporaryFiles,
+                                       CodeGenOpts, EmitBitcode,
+                                       !parsed.count("no-cache"),
+                                       !parsed.count("all-decls"));
+        // The objects are emitted from the AST of the interpreter, only the
+        // link can run in the background, which then owns the temporary files.
+        if (Generated && Background)
+        {
+            link_in_background(ObjectFiles, std::move(TemporaryFiles), ExeFile, LinkerOptions);
+            TemporaryFiles.clear();
+        }
+
+        // Cleanup after we exit.
+        std::vector<std::unique_ptr<llvm::FileRemover>> ObjectRemovers;
+        for (auto& TemporaryFile : TemporaryFiles)
+        {
+            ObjectRemovers.emplace_back(new llvm::FileRemover(TemporaryFile));
+        }
+
+        if (Generated && !Background && generate_exe(ObjectFiles, ExeFile, LinkerOptions) && Run)
+        {
+            if (XRay)
+            {
+                run_xray(ExeFile, Args, parsed["repeat"].as<std::size_t>());
+            }
+            else
+            {
+                run_exe(ExeFile, Args, parsed["repeat"].as<std::size_t>());
+            }
+        }
+    }
+
+    double executable::run_exe(const std::string& ExeFile,
+                               const std::vector<std::string>& Args,
+                               std::size_t Repeat,
+                               const std::vector<std::string>& Env)
+    {
+        llvm::SmallString<256> ExePath(ExeFile);
+        llvm::sys::fs::make_absolute(ExePath);
+        std::vector<std::string> Command = {ExePath.str()};
+        Command.insert(Command.end(), Args.begin(), Args.end());
+
+        auto Forward = [](std::ostream& os)
+        {
+            return [&os](const char* Data, std::size_t Size)
+            {
+                os.write(Data, static_cast<std::streamsize>(Size));
+                os.flush();
+            };
+        };
+
+        std::vector<double> WallTimes;
+        for (std::size_t I = 0; I < std::max<std::size_t>(Repeat, 1); ++I)
+        {
+            process_usage Usage;
+            int Status = run_process(Command, Forward(std::cout), Forward(std::cerr), &Usage, Env);
+            if (Status < 0)
+            {
+                return -1.;
+            }
+
+            std::ostringstream Report;
+            Report << std::fixed << std::setprecision(3)
+                   << "--- run " << I + 1 << ": wall " << Usage.wall_time << " s, user "
+                   << Usage.user_time << " s, sys " << Usage.system_time << " s, max RSS "
+                   << format_memory(static_cast<double>(Usage.max_rss));
+            if (Status != 0)
+            {
+                Report << ", exit status " << Status;
+            }
+            std::cout << Report.str() << std::endl;
+            WallTimes.push_back(Usage.wall_time);
+            if (Status != 0)
+            {
+                return -1.;
+            }
+        }
+
+        double MinWallTime = *std::min_element(WallTimes.begin(), WallTimes.end());
+
+        if (WallTimes.size() > 1)
+        {
+            double Mean = 0.;
+            for (double Time : WallTimes)
+            {
+                Mean += Time;
+            }
+            Mean /= WallTimes.size();
+            std::ostringstream Summary;
+            Summary << std::fixed << std::setprecision(3) << "--- wall time: min "
+                    << MinWallTime << " s, mean " << Mean << " s over " << WallTimes.size()
+                    << " runs";
+            std::cout << Summary.str() << std::endl;
+        }
+        return MinWallTime;
+    }
+
+    void executable::run_xray(const std::string& ExeFile,
+                              const std::vector<std::string>& Args,
+                              std::size_t Repeat)
+    {
+        llvm::SmallString<128> LogDir;
+        std::error_code EC = llvm::sys::fs::createUniqueDirectory("xeus-cling-xray", LogDir);
+        if (EC)
+        {
+            std::cerr << "Could not create temporary directory:" << std::endl
+                      << EC.message() << std::endl;
+            return;
+        }
+        struct DirectoryRemover
+        {
+            std::string m_path;
+            ~DirectoryRemover() { llvm::sys::fs::remove_directories(m_path); }
+        }
+        remover{LogDir.str()};
+
+        // The instrumentation is patched in before main, and each run writes
+        // its calls to a log in the temporary directory. The options exported
+        // by the user are kept, but come first so that these ones win.
+        llvm::SmallString<128> LogBase(LogDir);
+        llvm::sys::path::append(LogBase, "xray-log.");
+        std::string Options = "XRAY_OPTIONS=";
+        if (const char* Inherited = std::getenv("XRAY_OPTIONS"))
+        {
+            Options += std::string(Inherited) + " ";
+        }
+        Options += "patch_premain=true xray_naive_log=true xray_logfile_base=" + LogBase.str().str();
+        if (run_exe(ExeFile, Args, Repeat, {Options}) < 0.)
+        {
+            return;
+        }
+
+        std::vector<std::string> LogFiles;
+        for (llvm::sys::fs::directory_iterator It(LogDir, EC), End; It != End && !EC; It.increment(EC))
+        {
+            LogFiles.push_back(It->path());
+        }
+        std::sort(LogFiles.begin(), LogFiles.end());
+        xray_report(ExeFile, LogFiles, 20, ExeFile + ".xray.json");
+    }
+
+    namespace
+    {
+        // Merges raw profiles into an indexed profile, as llvm-profdata does.
+        bool mergeProfiles(const std::vector<std::string>& RawProfiles,
+                           const std::string& Output)
+        {
+            llvm::InstrProfWriter Writer;
+            for (const auto& RawProfile : RawProfiles)
+            {
+                auto ReaderOrErr = llvm::InstrProfReader::create(RawProfile);
+                if (!ReaderOrErr)
+                {
+                    std::cerr << "Could not read profile " << RawProfile << ": "
+                              << llvm::toString(ReaderOrErr.takeError()) << std::endl;
+                    return false;
+                }
+                auto Reader = std::move(ReaderOrErr.get());
+                for (auto& Record : *Reader)
+                {
+                    Writer.addRecord(std::move(Record), 1, [](llvm::Error E)
+                    {
+                        std::cerr << "Warning: " << llvm::toString(std::move(E)) << std::endl;
+                    });
+                }
+                if (Reader->hasError())
+                {
+                    std::cerr << "Could not read profile " << RawProfile << ": "
+                              << llvm::toString(Reader->getError()) << std::endl;
+                    return false;
+                }
+            }
+
+            std::error_code EC;
+            llvm::raw_fd_ostream OS(Output, EC, llvm::sys::fs::F_None);
+            if (EC)
+            {
+                std::cerr << "Could not write profile " << Output << ": "
+                          << EC.message() << std::endl;
+                return false;
+            }
+            Writer.write(OS);
+            return true;
+        }
+    }
+
+    void executable::build_pgo(const clang::CodeGenOptions& CodeGenOpts,
+                               bool EmitBitcode, bool OnlyReachable,
+                               const std::string& ExeFile,
+                               const std::vector<std::string>& LinkerOptions,
+                               const std::vector<std::string>& Args,
+                               std::size_t Repeat)
+    {
+        llvm::SmallString<128> WorkDir;
+        std::error_code EC = llvm::sys::fs::createUniqueDirectory("xeus-cling-pgo", WorkDir);
+        if (EC)
+        {
+            std::cerr << "Could not create temporary directory:" << std::endl
+                      << EC.message() << std::endl;
+            return;
+        }
+        struct DirectoryRemover
+        {
+            std::string m_path;
+            ~DirectoryRemover() { llvm::sys::fs::remove_directories(m_path); }
+        }
+        remover{WorkDir.str()};
+
+        auto WorkFile = [&WorkDir](const char* Name)
+        {
+            llvm::SmallString<128> Path(WorkDir);
+            llvm::sys::path::append(Path, Name);
+            return Path.str().str();
+        };
+        std::string BaselineExe = WorkFile("baseline");
+        std::string InstrumentedExe = WorkFile("instrumented");
+        std::string RawProfile = WorkFile("train.profraw");
+        std::string Profile = WorkFile("train.profdata");
+
+        // The instrumented and profile-guided builds do not use the object
+        // cache, whose key does not cover the profiles.
+        auto Build = [&](const clang::CodeGenOptions& Opts, bool UseCache,
+                         const std::vector<std::string>& Options,
+                         const std::string& Exe)
+        {
+            std::vector<std::string> ObjectFiles, TemporaryFiles;
+            bool Generated = generate_objs(ObjectFiles, TemporaryFiles, Opts,
+                                           EmitBitcode, UseCache, OnlyReachable);
+            bool Linked = Generated && generate_exe(ObjectFiles, Exe, Options);
+            for (auto& TemporaryFile : TemporaryFiles)
+            {
+                llvm::sys::fs::remove(TemporaryFile);
+            }
+            return Linked;
+        };
+
+        std::cout << "--- Building the baseline executable" << std::endl;
+        if (!Build(CodeGenOpts, true, LinkerOptions, BaselineExe))
+        {
+            return;
+        }
+
+        std::cout << "--- Building the instrumented executable" << std::endl;
+        auto InstrumentedOpts = CodeGenOpts;
+        InstrumentedOpts.setProfileInstr(clang::CodeGenOptions::ProfileClangInstr);
+        std::vector<std::string> InstrumentedOptions = LinkerOptions;
+        InstrumentedOptions.push_back("-fprofile-instr-generate");
+        if (!Build(InstrumentedOpts, false, InstrumentedOptions, InstrumentedExe))
+        {
+            return;
+        }
+
+        std::cout << "--- Training run" << std::endl;
+        if (run_exe(InstrumentedExe, Args, 1, {"LLVM_PROFILE_FILE=" + RawProfile}) < 0.)
+        {
+            return;
+        }
+        if (!mergeProfiles({RawProfile}, Profile))
+        {
+            return;
+        }
+
+        std::cout << "--- Building the profile-guided executable " << ExeFile << std::endl;
+        auto OptimizedOpts = CodeGenOpts;
+        OptimizedOpts.setProfileUse(clang::CodeGenOptions::ProfileClangInstr);
+        OptimizedOpts.ProfileInstrumentUsePath = Profile;
+        if (!Build(OptimizedOpts, false, LinkerOptions, ExeFile))
+        {
+            return;
+        }
+
+        std::cout << "--- Baseline runs" << std::endl;
+        double BaselineTime = run_exe(BaselineExe, Args, Repeat);
+        std::cout << "--- Profile-guided runs" << std::endl;
+        double OptimizedTime = run_exe(ExeFile, Args, Repeat);
+        if (BaselineTime > 0. && OptimizedTime > 0.)
+        {
+            std::ostringstream Report;
+            Report << std::fixed << std::setprecision(2)
+                   << "Speedup of the profile-guided build: "
+                   << BaselineTime / OptimizedTime << "x";
+            std::cout << Report.str() << std::endl;
+        }
+    }
+
+    xoptions native::get_options()
+    {
+        xoptions options{"native", "compile the functions of a cell into a shared library"};
+        options.add_options()
+            ("o,options", "options",
+             cxxopts::value<std::vector<std::string>>()->default_value(""));
+        options.parse_positional({"options"});
+        return options;
+    }
+
+    namespace
+    {
+        bool isFromCell(const clang::SourceManager& SM, const clang::Decl* D)
+        {
+            clang::SourceLocation Loc = SM.getExpansionLoc(D->getLocation());
+            return Loc.isValid() && SM.getFileEntryForID(SM.getFileID(Loc)) == nullptr;
+        }
+
+        // Collects the declarations that must be restored once the
+        // definitions of a cell are replaced by native code. Only functions,
+        // namespaces and linkage specifications are accepted: anything else
+        // would disappear with the definitions.
+        bool collectPrototypes(clang::Decl* D, const clang::SourceManager& SM,
+                               const clang::LangOptions& LangOpts,
+                               std::string& Prototypes,
+                               std::vector<const clang::FunctionDecl*>& Functions)
+        {
+            if (llvm::isa<clang::EmptyDecl>(D))
+            {
+                return true;
+            }
+
+            auto collectChildren = [&](clang::DeclContext* DC, std::string& Inner)
+            {
+                for (clang::Decl* Child : DC->decls())
+                {
+                    if (!collectPrototypes(Child, SM, LangOpts, Inner, Functions))
+                    {
+                        return false;
+                    }
+                }
+                return true;
+            };
+
+            if (auto* NS = llvm::dyn_cast<clang::NamespaceDecl>(D))
+            {
+                // The functions of anonymous namespaces have internal
+                // linkage and are not bound.
+                std::string Inner;
+                if (!collectChildren(NS, Inner))
+                {
+                    return false;
+                }
+                if (!NS->isAnonymousNamespace() && !Inner.empty())
+                {
+                    Prototypes += std::string(NS->isInline() ? "inline " : "") + "namespace " +
+                                  NS->getNameAsString() + " {\n" + Inner + "}\n";
+                }
+                return true;
+            }
+
+            if (auto* LS = llvm::dyn_cast<clang::LinkageSpecDecl>(D))
+            {
+                std::string Inner;
+                if (!collectChildren(LS, Inner))
+                {
+                    return false;
+                }
+                if (!Inner.empty())
+                {
+                    Prototypes += LS->getLanguage() == clang::LinkageSpecDecl::lang_c
+                        ? "extern \"C\" {\n" : "extern \"C++\" {\n";
+                    Prototypes += Inner + "}\n";
+                }
+                return true;
+            }
+
+            auto* FD = llvm::dyn_cast<clang::FunctionDecl>(D);
+            if (FD == nullptr || llvm::isa<clang::CXXMethodDecl>(FD))
+            {
+                std::cerr << "UsageError: %%native only accepts functions, namespaces and "
+                          << "extern \"C\" blocks, declare the " << D->getDeclKindName()
+                          << " in a previous cell" << std::endl;
+                return false;
+            }
+            std::string Name = FD->getQualifiedNameAsString();
+            if (FD->isInlined() || FD->isConstexpr())
+            {
+                std::cerr << "UsageError: " << Name << " is inline and would be compiled by the "
+                          << "JIT where it is used, declare it in a regular cell" << std::endl;
+                return false;
+            }
+
+            // Declarations of functions defined elsewhere are kept as written.
+            if (!FD->doesThisDeclarationHaveABody())
+            {
+                clang::CharSourceRange Range = clang::CharSourceRange::getTokenRange(FD->getSourceRange());
+                Prototypes += clang::Lexer::getSourceText(Range, SM, LangOpts).str() + ";\n";
+                return true;
+            }
+
+            // Functions with internal linkage are only helpers of the others.
+            if (FD->getFormalLinkage() != clang::ExternalLinkage)
+            {
+                return true;
+            }
+            clang::CharSourceRange Range = clang::CharSourceRange::getCharRange(
+                FD->getLocStart(), FD->getBody()->getLocStart());
+            Prototypes += clang::Lexer::getSourceText(Range, SM, LangOpts).str() + ";\n";
+            Functions.push_back(FD);
+            return true;
+        }
+
+        // Adds the definitions of the previous cells that the functions of
+        // the cell use and that are only emitted where they are used: the
+        // inline functions, the template instantiations, the functions with
+        // internal linkage and the constants. The library gets its own copy,
+        // while what the JIT compiled with external linkage cannot be linked
+        // to, nor can the variables of the session be shared.
+        bool collectUsedDecls(clang::ASTContext& AST, std::vector<clang::Decl*>& Decls)
+        {
+            std::set<const clang::Decl*> Cell;
+            for (const clang::Decl* D : Decls)
+            {
+                Cell.insert(D->getCanonicalDecl());
+            }
+            auto Linkage = [&AST](const clang::Decl* D)
+            {
+                if (const auto* FD = llvm::dyn_cast<clang::FunctionDecl>(D))
+                {
+                    return AST.GetGVALinkageForFunction(FD);
+                }
+                return AST.GetGVALinkageForVariable(llvm::cast<clang::VarDecl>(D));
+            };
+            auto Definition = [](const clang::Decl* D) -> const clang::Decl*
+            {
+                if (const auto* FD = llvm::dyn_cast<clang::FunctionDecl>(D))
+                {
+                    const clang::FunctionDecl* Def = nullptr;
+                    return FD->hasBody(Def) && !Def->isDependentContext() ? Def : nullptr;
+                }
+                const clang::VarDecl* Def = llvm::cast<clang::VarDecl>(D)->getDefinition();
+                return Def != nullptr && !Def->getDeclContext()->isDependentContext() ? Def : nullptr;
+            };
+
+            // The functions provided by a library are not followed.
+            FindReachableDecls Reachable;
+            Reachable.setTraverse([&](const clang::Decl* D)
+            {
+                if (Cell.count(D->getCanonicalDecl()) != 0)
+                {
+                    return true;
+                }
+                const clang::Decl* Def = Definition(D);
+                return Def != nullptr && Linkage(Def) != clang::GVA_AvailableExternally &&
+                       Linkage(Def) != clang::GVA_StrongExternal;
+            });
+            for (clang::Decl* D : Decls)
+            {
+                Reachable.addRoot(D);
+            }
+            Reachable.run();
+
+            for (const clang::Decl* D : Reachable.decls())
+            {
+                const clang::Decl* Def = Definition(D);
+                if (Cell.count(D) != 0 || Def == nullptr || Linkage(Def) == clang::GVA_AvailableExternally)
+                {
+                    continue;
+                }
+                std::string Name = llvm::cast<clang::NamedDecl>(Def)->getQualifiedNameAsString();
+                if (const auto* VD = llvm::dyn_cast<clang::VarDecl>(Def))
+                {
+                    if (Linkage(VD) == clang::GVA_StrongExternal || !VD->getType().isConstQualified() ||
+                        hasDynamicInitialization(AST, VD))
+                    {
+                        std::cerr << "UsageError: the variable " << Name << " of the session cannot be "
+                                  << "used by native code, pass it as an argument" << std::endl;
+                        return false;
+                    }
+                }
+                else if (Linkage(Def) == clang::GVA_StrongExternal)
+                {
+                    std::cerr << "UsageError: " << Name << " is compiled by the JIT and cannot be "
+                              << "called by native code, define it inline or in the %%native cell"
+                              << std::endl;
+                    return false;
+                }
+                Decls.push_back(const_cast<clang::Decl*>(Def));
+            }
+            return true;
+        }
+    }
+
+    bool native::build_library(const cling::Transaction& T,
+                               const std::vector<std::string>& LinkerOptions,
+                               std::string& Prototypes,
+                               std::vector<std::string>& Symbols,
+                               std::string& Library)
+    {
+        auto* CI = m_interpreter.getCI();
+        auto& SM = CI->getSourceManager();
+        auto& AST = CI->getASTContext();
+        std::vector<const clang::FunctionDecl*> Functions;
+
+        for (auto I = T.decls_begin(), E = T.decls_end(); I != E; ++I)
+        {
+            if (I->m_Call != cling::Transaction::kCCIHandleTopLevelDecl)
+            {
+                continue;
+            }
+            for (clang::Decl* D : I->m_DGR)
+            {
+                // Headers included by the cell would be unloaded with it.
+                if (!isFromCell(SM, D))
+                {
+                    std::cerr << "UsageError: include the headers in a previous cell" << std::endl;
+                    return false;
+                }
+                if (!collectPrototypes(D, SM, CI->getLangOpts(), Prototypes, Functions))
+                {
+                    return false;
+                }
+            }
+        }
+        if (Functions.empty())
+        {
+            std::cerr << "UsageError: the cell does not define any function with external linkage"
+                      << std::endl;
+            return false;
+        }
+
+        // The functions bound by a previous run of %%native can be bound
+        // again, not the ones the JIT compiled.
+        std::unique_ptr<clang::MangleContext> Mangler(AST.createMangleContext());
+        for (const clang::FunctionDecl* FD : Functions)
+        {
+            std::string Symbol;
+            if (Mangler->shouldMangleDeclName(FD))
+            {
+                llvm::raw_string_ostream OS(Symbol);
+                Mangler->mangleName(FD, OS);
+            }
+            else
+            {
+                Symbol = FD->getName().str();
+            }
+            for (const clang::FunctionDecl* Prev = FD->getPreviousDecl(); Prev != nullptr;
+                 Prev = Prev->getPreviousDecl())
+            {
+                if (SM.getFileID(SM.getExpansionLoc(Prev->getLocation())) !=
+                    SM.getFileID(SM.getExpansionLoc(FD->getLocation())) &&
+                    (m_bound.count(Symbol) == 0 || Prev->doesThisDeclarationHaveABody()))
+                {
+                    std::cerr << "UsageError: " << FD->getQualifiedNameAsString()
+                              << " is already declared in the session and cannot be redefined "
+                              << "until the kernel is restarted" << std::endl;
+                    return false;
+                }
+            }
+            Symbols.push_back(Symbol);
+        }
+
+        // Generate position independent code at the requested level, -O3
+        // by default.
+        auto CodeGenOpts = CI->getCodeGenOpts();
+        CodeGenOpts.RelocationModel = "pic";
+        int OptLevel = get_optlevel(LinkerOptions);
+        if (OptLevel < 0)
+        {
+            OptLevel = 3;
+        }
+        CodeGenOpts.OptimizationLevel = OptLevel;
+        CodeGenOpts.setInlining(OptLevel > 1
+            ? clang::CodeGenOptions::NormalInlining
+            : clang::CodeGenOptions::OnlyAlwaysInlining);
+
+        OptionsRestorer restorer(*CI);
+        std::string CPU = get_march(LinkerOptions);
+        if (!CPU.empty() && !set_target_cpu(m_interpreter, CPU))
+        {
+            std::cerr << "Unknown CPU " << CPU << std::endl;
+            return false;
+        }
+
+        std::vector<clang::Decl*> Decls, AllDecls;
+        FindTopLevelDecls Visitor(Decls);
+        collectTransactionDecls(T, Visitor, AllDecls);
+        if (!collectUsedDecls(AST, Decls))
+        {
+            return false;
+        }
+
+        llvm::SmallString<64> ObjectFile, LibraryFile;
+        std::error_code EC = llvm::sys::fs::createTemporaryFile("native", "o", ObjectFile);
+        if (!EC)
+        {
+            EC = llvm::sys::fs::createTemporaryFile("native", "so", LibraryFile);
+        }
+        if (EC)
+        {
+            std::cerr << "Could not create temporary file:" << std::endl
+                      << EC.message() << std::endl;
+            return false;
+        }
+        llvm::FileRemover ObjectRemover(ObjectFile.c_str());
+        Library = LibraryFile.str();
+
+        std::vector<std::string> Options = LinkerOptions;
+        Options.push_back("-shared");
+        if (!generate_obj(Decls, CodeGenOpts, false, ObjectFile.str()) ||
+            !generate_exe({ObjectFile.str()}, Library, Options))
+        {
+            llvm::sys::fs::remove(Library);
+            return false;
+        }
+
+        std::cout << "Compiled " << Functions.size() << " functions with -O" << OptLevel << " for "
+                  << CI->getTargetOpts().CPU << std::endl;
+        return true;
+    }
+
+    void native::operator()(const std::string& line, const std::string& cell)
+    {
+        auto options = get_options();
+        auto parsed = options.parse(line);
+        std::vector<std::string> LinkerOptions =
+            parsed["options"].as<std::vector<std::string>>();
+
+        cling::Transaction* T = nullptr;
+        auto result = m_interpreter.declare(cell, &T);
+        if (result != cling::Interpreter::kSuccess || T == nullptr)
+        {
+            return;
+        }
+
+        // The definitions compiled by the JIT are replaced by the library,
+        // which is kept loaded until the end of the session.
+        std::string Prototypes, Library;
+        std::vector<std::string> Symbols;
+        bool Built = build_library(*T, LinkerOptions, Prototypes, Symbols, Library);
+        m_interpreter.unload(*T);
+        if (!Built)
+        {
+            return;
+        }
+
+        std::string Error;
+        auto Handle = llvm::sys::DynamicLibrary::getPermanentLibrary(Library.c_str(), &Error);
+        llvm::sys::fs::remove(Library);
+        if (!Handle.isValid())
+        {
+            std::cerr << "Could not load the library: " << Error << std::endl;
+            return;
+        }
+
+        // The functions are bound explicitly rather than through the first
+        // library defining them, so that running the cell again binds the new
+        // definitions in the subsequent cells.
+        for (const auto& Symbol : Symbols)
+        {
+            void* Address = Handle.getAddressOfSymbol(Symbol.c_str());
+            if (Address == nullptr)
+            {
+                std::cerr << "Could not find " << demangle(Symbol) << " in the library" << std::endl;
+                return;
+            }
+            llvm::sys::DynamicLibrary::AddSymbol(Symbol, Address);
+            m_bound.insert(Symbol);
         }
+        m_interpreter.declare(Prototypes);
     }
 }
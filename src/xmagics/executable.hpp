@@ -10,9 +10,18 @@
 #ifndef XMAGICS_EXECUTABLE_HPP
 #define XMAGICS_EXECUTABLE_HPP
 
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <set>
 #include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 
+#include "clang/AST/Decl.h"
+#include "clang/Basic/CodeGenOptions.h"
 #include "cling/Interpreter/Interpreter.h"
 
 #include "xeus-cling/xmagics.hpp"
@@ -20,25 +29,111 @@
 
 namespace xcpp
 {
+    /**
+     * Threads of the links running in the background. They publish their
+     * progress through the kernel, so they are joined before the magic that
+     * started them is destroyed, on %reset and when the kernel shuts down.
+     */
+    class link_threads
+    {
+    public:
+
+        link_threads() = default;
+        link_threads(const link_threads&) = delete;
+        link_threads& operator=(const link_threads&) = delete;
+        ~link_threads();
+
+        void start(std::function<void()> link);
+
+    private:
+
+        struct link_thread
+        {
+            std::thread thread;
+            std::shared_ptr<std::atomic<bool>> finished;
+        };
+
+        // Only accessed by the thread running the cells.
+        std::vector<link_thread> m_threads;
+    };
+
     class executable: public xmagic_cell
     {
     public:
 
-        executable(cling::Interpreter& i) : m_interpreter(i) {}
+        executable(cling::Interpreter& i)
+            : m_interpreter(i), p_links(std::make_shared<link_threads>())
+        {
+        }
         xoptions get_options();
         virtual void operator()(const std::string& line, const std::string& cell) override;
 
-    private:
+    protected:
 
         std::string generate_fns(const std::string& cell, std::string& main,
                                  std::string& unique_fn);
-        bool generate_obj(std::string& ObjectFile, bool EnableDebugInfo);
-        bool generate_exe(const std::string& ObjectFile,
+        bool generate_objs(std::vector<std::string>& ObjectFiles,
+                           std::vector<std::string>& TemporaryFiles,
+                           const clang::CodeGenOptions& CodeGenOpts,
+                           bool EmitBitcode, bool UseCache,
+                           bool OnlyReachable);
+        bool generate_obj(const std::vector<clang::Decl*>& Decls,
+                          const clang::CodeGenOptions& CodeGenOpts,
+                          bool EmitBitcode,
+                          const std::string& ObjectFile);
+        double run_exe(const std::string& ExeFile,
+                       const std::vector<std::string>& Args,
+                       std::size_t Repeat,
+                       const std::vector<std::string>& Env = {});
+        void run_xray(const std::string& ExeFile,
+                      const std::vector<std::string>& Args,
+                      std::size_t Repeat);
+        void build_pgo(const clang::CodeGenOptions& CodeGenOpts,
+                       bool EmitBitcode, bool OnlyReachable,
+                       const std::string& ExeFile,
+                       const std::vector<std::string>& LinkerOptions,
+                       const std::vector<std::string>& Args,
+                       std::size_t Repeat);
+        std::vector<std::string> link_command(const std::vector<std::string>& ObjectFiles,
+                                              const std::string& ExeFile,
+                                              const std::vector<std::string>& LinkerOptions);
+        bool generate_exe(const std::vector<std::string>& ObjectFiles,
                           const std::string& ExeFile,
                           const std::vector<std::string>& LinkerOptions);
+        void link_in_background(const std::vector<std::string>& ObjectFiles,
+                                std::vector<std::string> TemporaryFiles,
+                                const std::string& ExeFile,
+                                const std::vector<std::string>& LinkerOptions);
 
         cling::Interpreter& m_interpreter;
         unsigned int m_unique = 0;
+        // Shared by the copies of the magic, joined by the last one.
+        std::shared_ptr<link_threads> p_links;
+    };
+
+    /**
+     * %%native compiles the functions defined in a cell ahead of time into a
+     * shared library, and binds them in the session in place of the code the
+     * JIT would generate.
+     */
+    class native : public executable
+    {
+    public:
+
+        native(cling::Interpreter& i) : executable(i) {}
+        xoptions get_options();
+        virtual void operator()(const std::string& line, const std::string& cell) override;
+
+    private:
+
+        bool build_library(const cling::Transaction& T,
+                           const std::vector<std::string>& LinkerOptions,
+                           std::string& Prototypes,
+                           std::vector<std::string>& Symbols,
+                           std::string& Library);
+
+        // The symbols bound to the libraries of the previous runs.
+        std::set<std::string> m_bound;
     };
 }
 #endif
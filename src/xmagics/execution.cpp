@@ -16,6 +16,7 @@
 #include "cling/Interpreter/Value.h"
 #include "cling/Interpreter/Exception.h"
 #include "cling/Interpreter/Interpreter.h"
+#include "cling/Interpreter/Transaction.h"
 #include "cling/Utils/Output.h"
 
 #include "execution.hpp"
@@ -23,6 +24,47 @@
 
 namespace xcpp
 {
+    bool process_cell(cling::Interpreter& interpreter, const std::string& cell)
+    {
+        for (const auto& block : split_from_includes(cell))
+        {
+            if (trim(block).empty())
+            {
+                continue;
+            }
+
+            cling::Interpreter::CompilationResult compilation_result = cling::Interpreter::kFailure;
+            try
+            {
+                compilation_result = interpreter.process(block, nullptr, nullptr, true);
+            }
+            catch (cling::InterpreterException& e)
+            {
+                if (!e.diagnose())
+                {
+                    std::cerr << "Interpreter Exception: " << e.what() << std::endl;
+                }
+                return false;
+            }
+            catch (std::exception& e)
+            {
+                std::cerr << "Standard Exception: " << e.what() << std::endl;
+                return false;
+            }
+            catch (...)
+            {
+                std::cerr << "Error" << std::endl;
+                return false;
+            }
+
+            if (compilation_result != cling::Interpreter::kSuccess)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
     timeit::timeit(cling::Interpreter* p)
         : m_interpreter(p)
     {
@@ -59,6 +101,23 @@ namespace xcpp
         return timeit_code;
     }
 
+    cling::Interpreter::CompilationResult timeit::time_loop(std::size_t number, const std::string& code,
+                                                            double& seconds)
+    {
+        cling::Value output;
+        cling::Transaction* transaction = nullptr;
+        cling::Interpreter::CompilationResult compilation_result =
+            m_interpreter->process(inner(number, code).c_str(), &output, &transaction);
+        seconds = compilation_result == cling::Interpreter::kSuccess ? output.simplisticCastAs<double>() : 0.;
+        // Each loop is compiled once and never called again: unloading it
+        // keeps %timeit from growing the JIT memory on every call.
+        if (transaction != nullptr && m_interpreter->getLastTransaction() == transaction)
+        {
+            m_interpreter->unload(*transaction);
+        }
+        return compilation_result;
+    }
+
     std::string timeit::_format_time(double timespan, std::size_t precision) const
     {
         std::vector<std::string> units{"s", "ms", "us", "ns"};
@@ -111,7 +170,6 @@ namespace xcpp
         auto errorlevel = 0;
         std::string ename;
         std::string evalue;
-        cling::Value output;
         cling::Interpreter::CompilationResult compilation_result = cling::Interpreter::kSuccess;
 
         try
@@ -121,9 +179,9 @@ namespace xcpp
                 for (std::size_t n = 0; n < 10; ++n)
                 {
                     number = std::pow(10, n);
-                    std::string timeit_code = inner(number, code);
-                    compilation_result = m_interpreter->process(timeit_code.c_str(), &output);
-                    if (output.simplisticCastAs<double>() >= 0.2)
+                    double seconds = 0.;
+                    compilation_result = time_loop(number, code, seconds);
+                    if (compilation_result != cling::Interpreter::kSuccess || seconds >= 0.2)
                     {
                         break;
                     }
@@ -135,9 +193,9 @@ namespace xcpp
             double stdev = 0;
             for (std::size_t r = 0; r < repeat; ++r)
             {
-                std::string timeit_code = inner(number, code);
-                compilation_result = m_interpreter->process(timeit_code.c_str(), &output);
-                all_runs.push_back(output.simplisticCastAs<double>() / number);
+                double seconds = 0.;
+                compilation_result = time_loop(number, code, seconds);
+                all_runs.push_back(seconds / number);
                 mean += all_runs.back();
             }
             mean /= repeat;
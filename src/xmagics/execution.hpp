@@ -20,6 +20,13 @@
 
 namespace xcpp
 {
+    /**
+     * Processes the code of a cell body like a regular cell, includes being
+     * processed in separate blocks. Errors are reported on std::cerr and
+     * processing stops at the first one. Returns whether all blocks succeeded.
+     */
+    bool process_cell(cling::Interpreter& interpreter, const std::string& cell);
+
     class timeit : public xmagic_line_cell
     {
     public:
@@ -46,6 +53,8 @@ namespace xcpp
 
         xoptions get_options();
         std::string inner(std::size_t number, const std::string& code) const;
+        cling::Interpreter::CompilationResult time_loop(std::size_t number, const std::string& code,
+                                                        double& seconds);
         std::string _format_time(double timespan, std::size_t precision) const;
         void execute(std::string& line, std::string& cell);
     };
@@ -0,0 +1,596 @@
+/***********************************************************************************
+* Copyright (c) 2016, Johan Mabille, Loic Gouarin, Sylvain Corlay, Wolf Vollprecht *
+* Copyright (c) 2016, QuantStack                                                   *
+*                                                                                  *
+* Distributed under the terms of the BSD 3-Clause License.                         *
+*                                                                                  *
+* The full license is in the file LICENSE, distributed with this software.         *
+************************************************************************************/
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <exception>
+#include <iomanip>
+#include <iostream>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <cerrno>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "nlohmann/json.hpp"
+
+#include "cling/Interpreter/Transaction.h"
+
+#include "xeus/xguid.hpp"
+#include "xeus/xinterpreter.hpp"
+
+#include "xeus-cling/xoptions.hpp"
+
+#include "../xhtml.hpp"
+#include "../xparser.hpp"
+
+#include "forkmap.hpp"
+
+namespace nl = nlohmann;
+
+namespace xcpp
+{
+    namespace
+    {
+        // As in 1'000'000, rather than the start of a character literal.
+        bool is_digit_separator(const std::string& code, std::size_t i)
+        {
+            return i != 0 && std::isalnum(static_cast<unsigned char>(code[i - 1]));
+        }
+
+        // Calls f(i, depth, literal) for each character of the code outside
+        // of the comments, depth being the nesting level in brackets.
+        template <class F>
+        void scan_code(const std::string& code, F f)
+        {
+            int depth = 0;
+            for (std::size_t i = 0; i < code.size(); ++i)
+            {
+                char c = code[i];
+                char next = i + 1 < code.size() ? code[i + 1] : '\0';
+                if (c == '/' && next == '/')
+                {
+                    i = code.find('\n', i);
+                    if (i == std::string::npos)
+                    {
+                        return;
+                    }
+                    f(i, depth, false);
+                }
+                else if (c == '/' && next == '*')
+                {
+                    i = code.find("*/", i + 2);
+                    if (i == std::string::npos)
+                    {
+                        return;
+                    }
+                    ++i;
+                }
+                else if (c == '"' || (c == '\'' && !is_digit_separator(code, i)))
+                {
+                    f(i, depth, true);
+                    for (++i; i < code.size() && code[i] != c; ++i)
+                    {
+                        f(i, depth, true);
+                        if (code[i] == '\\' && i + 1 < code.size())
+                        {
+                            f(++i, depth, true);
+                        }
+                    }
+                    if (i < code.size())
+                    {
+                        f(i, depth, true);
+                    }
+                }
+                else if (c == '(' || c == '[' || c == '{')
+                {
+                    f(i, depth++, false);
+                }
+                else if (c == ')' || c == ']' || c == '}')
+                {
+                    f(i, --depth, false);
+                }
+                else
+                {
+                    f(i, depth, false);
+                }
+            }
+        }
+
+        std::string format_seconds(double seconds)
+        {
+            std::ostringstream os;
+            os << std::fixed << std::setprecision(2) << seconds;
+            return os.str();
+        }
+    }
+
+    std::vector<std::string> split_expressions(const std::string& list)
+    {
+        std::vector<std::size_t> commas;
+        scan_code(list, [&list, &commas](std::size_t i, int depth, bool literal)
+        {
+            if (!literal && depth == 0 && list[i] == ',')
+            {
+                commas.push_back(i);
+            }
+        });
+
+        std::vector<std::string> res;
+        std::size_t start = 0;
+        commas.push_back(list.size());
+        for (std::size_t comma : commas)
+        {
+            std::string expression = trim(list.substr(start, comma - start));
+            if (!expression.empty())
+            {
+                res.push_back(expression);
+            }
+            start = comma + 1;
+        }
+        return res;
+    }
+
+    void split_last_expression(const std::string& body, std::string& statements, std::string& expression)
+    {
+        // The expression follows the last statement, terminated by a
+        // semicolon or by a closing brace.
+        std::size_t end = 0;
+        bool trailing_code = false;
+        scan_code(body, [&body, &end, &trailing_code](std::size_t i, int depth, bool literal)
+        {
+            char c = body[i];
+            if (!literal && depth == 0 && (c == ';' || c == '}'))
+            {
+                end = i + 1;
+                trailing_code = false;
+            }
+            else if (!std::isspace(static_cast<unsigned char>(c)))
+            {
+                trailing_code = true;
+            }
+        });
+
+        if (trailing_code)
+        {
+            statements = body.substr(0, end);
+            expression = body.substr(end);
+        }
+        else
+        {
+            statements = body;
+            expression.clear();
+        }
+    }
+
+#if !defined(_WIN32)
+    namespace
+    {
+        // What a child reports, written over its pipe as a sequence of
+        // fields, each preceded by its size on a line.
+        struct run_result
+        {
+            std::string status = "pending";
+            std::string result;
+            std::string output;
+            double seconds = 0.;
+        };
+
+        void write_field(std::string& message, const std::string& field)
+        {
+            message += std::to_string(field.size()) + "\n" + field;
+        }
+
+        bool read_field(const std::string& message, std::size_t& pos, std::string& field)
+        {
+            std::size_t eol = message.find('\n', pos);
+            if (eol == std::string::npos)
+            {
+                return false;
+            }
+            std::size_t size = static_cast<std::size_t>(std::strtoul(message.c_str() + pos, nullptr, 10));
+            if (eol + 1 + size > message.size())
+            {
+                return false;
+            }
+            field = message.substr(eol + 1, size);
+            pos = eol + 1 + size;
+            return true;
+        }
+
+        bool parse_result(const std::string& message, run_result& res)
+        {
+            std::size_t pos = 0;
+            std::string seconds;
+            if (!read_field(message, pos, res.status) || !read_field(message, pos, res.result) ||
+                !read_field(message, pos, res.output) || !read_field(message, pos, seconds))
+            {
+                return false;
+            }
+            res.seconds = std::atof(seconds.c_str());
+            return true;
+        }
+
+        void write_all(int fd, const std::string& data)
+        {
+            std::size_t written = 0;
+            while (written < data.size())
+            {
+                ssize_t n = ::write(fd, data.data() + written, data.size() - written);
+                if (n < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (n <= 0)
+                {
+                    return;
+                }
+                written += static_cast<std::size_t>(n);
+            }
+        }
+
+        using run_function = void (*)(unsigned long, std::string*);
+
+        // Runs in the forked child: the sockets and the threads of the
+        // kernel are not usable there, so the output is captured and sent
+        // to the parent along with the result.
+        [[noreturn]] void run_child(run_function run, std::size_t index, int fd)
+        {
+            std::ostringstream output;
+            std::cout.rdbuf(output.rdbuf());
+            std::cerr.rdbuf(output.rdbuf());
+
+            std::string status = "ok";
+            std::string result;
+            auto start = std::chrono::steady_clock::now();
+            try
+            {
+                run(static_cast<unsigned long>(index), &result);
+            }
+            catch (std::exception& e)
+            {
+                status = "error";
+                result = e.what();
+            }
+            catch (...)
+            {
+                status = "error";
+                result = "unknown exception";
+            }
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            std::string message;
+            write_field(message, status);
+            write_field(message, result);
+            write_field(message, output.str());
+            write_field(message, std::to_string(seconds));
+            write_all(fd, message);
+            // Skip the static destructors and the atexit handlers of the
+            // kernel, which belong to the parent.
+            _exit(0);
+        }
+
+        // The text of a result, sent as a mime bundle.
+        std::string result_text(const run_result& r)
+        {
+            if (r.status != "ok" || r.result.empty())
+            {
+                return r.result;
+            }
+            try
+            {
+                nl::json bundle = nl::json::parse(r.result);
+                return bundle.value("text/plain", bundle.dump());
+            }
+            catch (std::exception&)
+            {
+                return r.result;
+            }
+        }
+
+        class sweep_display
+        {
+        public:
+
+            sweep_display(const std::string& variable, const std::vector<std::string>& values,
+                          const std::vector<run_result>& results)
+                : m_id(xeus::new_xguid()), m_variable(variable), m_values(values), m_results(results)
+            {
+            }
+
+            void publish(bool update) const
+            {
+                std::ostringstream text;
+                std::vector<std::vector<std::string>> rows;
+                for (std::size_t i = 0; i < m_values.size(); ++i)
+                {
+                    const run_result& r = m_results[i];
+                    std::string result = result_text(r);
+                    bool done = r.status != "pending" && r.status != "running";
+                    std::string seconds = done ? format_seconds(r.seconds) : "";
+                    rows.push_back({html_escape(m_values[i]), r.status, seconds,
+                                    "<pre>" + html_escape(result) + "</pre>",
+                                    "<pre>" + html_escape(r.output) + "</pre>"});
+                    text << m_variable << " = " << m_values[i] << ": " << r.status;
+                    if (done)
+                    {
+                        text << " in " << seconds << " s";
+                    }
+                    if (!result.empty())
+                    {
+                        text << ", " << result;
+                    }
+                    text << "\n";
+                    if (!r.output.empty())
+                    {
+                        std::istringstream lines(r.output);
+                        std::string line;
+                        while (std::getline(lines, line))
+                        {
+                            text << "    " << line << "\n";
+                        }
+                    }
+                }
+
+                nl::json data;
+                data["text/plain"] = text.str();
+                data["text/html"] = html_table({html_escape(m_variable), "Status", "Time (s)", "Result", "Output"}, rows);
+                nl::json transient;
+                transient["display_id"] = m_id;
+                if (update)
+                {
+                    xeus::get_interpreter().update_display_data(std::move(data), nl::json::object(),
+                                                                std::move(transient));
+                }
+                else
+                {
+                    xeus::get_interpreter().display_data(std::move(data), nl::json::object(),
+                                                         std::move(transient));
+                }
+            }
+
+        private:
+
+            xeus::xguid m_id;
+            const std::string& m_variable;
+            const std::vector<std::string>& m_values;
+            const std::vector<run_result>& m_results;
+        };
+
+        struct child
+        {
+            pid_t pid;
+            int fd;
+            std::size_t index;
+            std::string message;
+        };
+
+        std::size_t run_sweep(run_function run, std::size_t jobs, const sweep_display& display,
+                              std::vector<run_result>& results)
+        {
+            std::vector<child> running;
+            std::size_t next = 0;
+            std::size_t failures = 0;
+            bool changed = false;
+            while (next < results.size() || !running.empty())
+            {
+                while (next < results.size() && running.size() < jobs)
+                {
+                    std::size_t index = next++;
+                    int fds[2];
+                    if (pipe(fds) != 0)
+                    {
+                        results[index].status = "error";
+                        results[index].result = "cannot create a pipe";
+                        ++failures;
+                        continue;
+                    }
+                    pid_t pid = fork();
+                    if (pid == 0)
+                    {
+                        close(fds[0]);
+                        run_child(run, index, fds[1]);
+                    }
+                    close(fds[1]);
+                    if (pid < 0)
+                    {
+                        close(fds[0]);
+                        results[index].status = "error";
+                        results[index].result = "cannot fork";
+                        ++failures;
+                        continue;
+                    }
+                    results[index].status = "running";
+                    running.push_back({pid, fds[0], index, ""});
+                    changed = true;
+                }
+                if (running.empty())
+                {
+                    break;
+                }
+                if (changed)
+                {
+                    display.publish(true);
+                    changed = false;
+                }
+
+                std::vector<pollfd> fds;
+                for (const auto& c : running)
+                {
+                    fds.push_back({c.fd, POLLIN, 0});
+                }
+                if (poll(fds.data(), fds.size(), -1) < 0)
+                {
+                    if (errno == EINTR)
+                    {
+                        continue;
+                    }
+                    break;
+                }
+
+                for (std::size_t i = fds.size(); i-- > 0;)
+                {
+                    if (fds[i].revents == 0)
+                    {
+                        continue;
+                    }
+                    child& c = running[i];
+                    char buffer[4096];
+                    ssize_t n = read(c.fd, buffer, sizeof(buffer));
+                    if (n > 0)
+                    {
+                        c.message.append(buffer, static_cast<std::size_t>(n));
+                        continue;
+                    }
+                    if (n < 0 && errno == EINTR)
+                    {
+                        continue;
+                    }
+
+                    // The child closed its end of the pipe.
+                    close(c.fd);
+                    int status = 0;
+                    while (waitpid(c.pid, &status, 0) < 0 && errno == EINTR)
+                    {
+                    }
+                    run_result& r = results[c.index];
+                    if (!parse_result(c.message, r))
+                    {
+                        r.status = "error";
+                        r.result = WIFSIGNALED(status)
+                            ? "killed by signal " + std::to_string(WTERMSIG(status))
+                            : "exited with status " + std::to_string(WEXITSTATUS(status));
+                    }
+                    if (r.status != "ok")
+                    {
+                        ++failures;
+                    }
+                    running.erase(running.begin() + static_cast<std::ptrdiff_t>(i));
+                    changed = true;
+                }
+            }
+            display.publish(true);
+            return failures;
+        }
+
+        std::atomic<std::size_t> sweep_count(0);
+    }
+#endif
+
+    xoptions forkmap::get_options()
+    {
+        xoptions options{"forkmap", "Run the cell for each value of a variable, in forked processes"};
+        options.add_options()
+            ("j,jobs", "maximum number of processes running at the same time, the number of cores by default",
+             cxxopts::value<std::size_t>());
+        return options;
+    }
+
+    void forkmap::operator()(const std::string& line, const std::string& cell)
+    {
+#if defined(_WIN32)
+        std::cerr << "UsageError: %%forkmap is not supported on Windows" << std::endl;
+#else
+        std::smatch match;
+        static const std::regex line_re("^\\s*([A-Za-z_]\\w*)\\s+in\\s+\\{(.*)\\}(.*)$");
+        if (!std::regex_match(line, match, line_re))
+        {
+            std::cerr << "UsageError: %%forkmap requires a variable and values, as in %%forkmap x in {1, 2, 3}\n";
+            return;
+        }
+        std::string variable = match[1];
+        std::vector<std::string> values = split_expressions(match[2]);
+        if (values.empty())
+        {
+            std::cerr << "UsageError: %%forkmap requires at least one value\n";
+            return;
+        }
+
+        auto options = get_options();
+        auto result = options.parse(match[3]);
+        std::size_t jobs = result.count("jobs") ? result["jobs"].as<std::size_t>()
+                                                : static_cast<std::size_t>(std::thread::hardware_concurrency());
+        jobs = std::max<std::size_t>(1, std::min(jobs, values.size()));
+
+        // The includes go to the global scope, the rest of the cell is the
+        // body of the function run by the children.
+        std::string includes = "#include <initializer_list>\n#include <string>\n#include \"xcpp/xmime.hpp\"\n";
+        std::string body;
+        std::istringstream lines(cell);
+        std::string cell_line;
+        while (std::getline(lines, cell_line))
+        {
+            std::string& target = trim(cell_line).compare(0, 8, "#include") == 0 ? includes : body;
+            target += cell_line + "\n";
+        }
+        if (m_interpreter.declare(includes) != cling::Interpreter::kSuccess)
+        {
+            return;
+        }
+
+        std::string statements, expression;
+        split_last_expression(body, statements, expression);
+        std::string function = "__xcpp_forkmap_" + std::to_string(++sweep_count);
+        std::ostringstream code;
+        code << "extern \"C\" void " << function << "(unsigned long __xcpp_index, std::string* __xcpp_result)\n"
+             << "{\n"
+             << "    auto __xcpp_values = {";
+        for (std::size_t i = 0; i < values.size(); ++i)
+        {
+            code << (i == 0 ? "" : ", ") << "\n" << values[i];
+        }
+        code << "\n};\n"
+             << "    auto " << variable << " = *(__xcpp_values.begin() + __xcpp_index);\n"
+             << statements << "\n";
+        if (!expression.empty())
+        {
+            code << "    using ::xcpp::mime_bundle_repr;\n"
+                 << "    *__xcpp_result = mime_bundle_repr(\n" << expression << "\n).dump();\n";
+        }
+        code << "}\n";
+
+        // Compiled once, in the parent: the children inherit the code.
+        cling::Transaction* transaction = nullptr;
+        if (m_interpreter.declare(code.str(), &transaction) != cling::Interpreter::kSuccess)
+        {
+            return;
+        }
+        auto run = reinterpret_cast<run_function>(m_interpreter.getAddressOfGlobal(function));
+        if (run != nullptr)
+        {
+            std::vector<run_result> results(values.size());
+            sweep_display display(variable, values, results);
+            display.publish(false);
+            std::size_t failures = run_sweep(run, jobs, display, results);
+            if (failures != 0)
+            {
+                std::cerr << failures << " of " << values.size() << " runs failed" << std::endl;
+            }
+        }
+
+        // The function is not called again.
+        if (transaction != nullptr && m_interpreter.getLastTransaction() == transaction)
+        {
+            m_interpreter.unload(*transaction);
+        }
+#endif
+    }
+}
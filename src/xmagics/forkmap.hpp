@@ -0,0 +1,56 @@
+/***********************************************************************************
+* Copyright (c) 2016, Johan Mabille, Loic Gouarin, Sylvain Corlay, Wolf Vollprecht *
+* Copyright (c) 2016, QuantStack                                                   *
+*                                                                                  *
+* Distributed under the terms of the BSD 3-Clause License.                         *
+*                                                                                  *
+* The full license is in the file LICENSE, distributed with this software.         *
+************************************************************************************/
+
+#ifndef XMAGICS_FORKMAP_HPP
+#define XMAGICS_FORKMAP_HPP
+
+#include <string>
+#include <vector>
+
+#include "cling/Interpreter/Interpreter.h"
+
+#include "xeus-cling/xmagics.hpp"
+#include "xeus-cling/xoptions.hpp"
+
+namespace xcpp
+{
+    /**
+     * Splits a comma separated list of C++ expressions, ignoring the commas
+     * nested in brackets and literals.
+     */
+    std::vector<std::string> split_expressions(const std::string& list);
+
+    /**
+     * Splits a cell body into its statements and its last expression, the
+     * one written without a semicolon whose value a cell displays. The
+     * expression is empty if the body ends with a statement.
+     */
+    void split_last_expression(const std::string& body, std::string& statements, std::string& expression);
+
+    /**
+     * %%forkmap compiles the cell once as a function of the variable, then
+     * runs it for each value in a forked child, which inherits the state of
+     * the interpreter. The children report their result over a pipe and the
+     * results are gathered in a table.
+     */
+    class forkmap : public xmagic_cell
+    {
+    public:
+
+        forkmap(cling::Interpreter& i) : m_interpreter(i) {}
+
+        xoptions get_options();
+        virtual void operator()(const std::string& line, const std::string& cell) override;
+
+    private:
+
+        cling::Interpreter& m_interpreter;
+    };
+}
+#endif
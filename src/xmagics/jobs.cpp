@@ -0,0 +1,504 @@
+/***********************************************************************************
+* Copyright (c) 2016, Johan Mabille, Loic Gouarin, Sylvain Corlay, Wolf Vollprecht *
+* Copyright (c) 2016, QuantStack                                                   *
+*                                                                                  *
+* Distributed under the terms of the BSD 3-Clause License.                         *
+*                                                                                  *
+* The full license is in the file LICENSE, distributed with this software.         *
+************************************************************************************/
+
+#include <algorithm>
+#include <cstdlib>
+#include <exception>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "nlohmann/json.hpp"
+
+#include "xeus/xinterpreter.hpp"
+
+#include "xcpp/xjob.hpp"
+#include "xeus-cling/xbuffer.hpp"
+#include "xeus-cling/xoptions.hpp"
+
+#include "../xhtml.hpp"
+#include "../xparser.hpp"
+
+#include "jobs.hpp"
+
+namespace nl = nlohmann;
+
+namespace xcpp
+{
+    namespace
+    {
+        // Stop flag of the job running on this thread, if any.
+        thread_local const std::atomic<bool>* current_stop = nullptr;
+
+        double elapsed(const job_registry::job& j, bool running)
+        {
+            auto end = running ? std::chrono::steady_clock::now() : j.end;
+            return std::chrono::duration<double>(end - j.start).count();
+        }
+
+        std::string format_seconds(double seconds)
+        {
+            std::ostringstream os;
+            os << std::fixed << std::setprecision(1) << seconds;
+            return os.str();
+        }
+
+        std::string default_name(const std::string& cell)
+        {
+            // The first line of code, shortened.
+            std::istringstream lines(cell);
+            std::string line;
+            while (std::getline(lines, line))
+            {
+                line = trim(line);
+                if (!line.empty() && line.compare(0, 8, "#include") != 0)
+                {
+                    return line.size() > 40 ? line.substr(0, 37) + "..." : line;
+                }
+            }
+            return "";
+        }
+
+        std::vector<std::size_t> parse_ids(const std::vector<std::string>& args, bool& valid)
+        {
+            std::vector<std::size_t> res;
+            valid = true;
+            for (const auto& arg : args)
+            {
+                char* end = nullptr;
+                unsigned long id = std::strtoul(arg.c_str(), &end, 10);
+                if (arg.empty() || *end != '\0' || id == 0)
+                {
+                    std::cerr << "UsageError: invalid job id " << arg << "\n";
+                    valid = false;
+                    continue;
+                }
+                res.push_back(static_cast<std::size_t>(id));
+            }
+            return res;
+        }
+    }
+
+    bool stop_requested() noexcept
+    {
+        return current_stop != nullptr && current_stop->load();
+    }
+
+    /****************
+     * job_registry *
+     ****************/
+
+    std::shared_ptr<job_registry::job> job_registry::add(const std::string& name)
+    {
+        auto res = std::make_shared<job>();
+        res->name = name;
+        res->display_id = xeus::new_xguid();
+        res->start = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> lock(m_mutex);
+        res->id = m_next_id++;
+        m_jobs[res->id] = res;
+        return res;
+    }
+
+    void job_registry::start(job& j, std::thread thread)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        j.thread = std::move(thread);
+    }
+
+    void job_registry::finish(job& j, const std::string& state, const std::string& error)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            j.end = std::chrono::steady_clock::now();
+            j.running = false;
+            j.state = state;
+            j.error = error;
+        }
+        m_finished.notify_all();
+    }
+
+    std::shared_ptr<job_registry::job> job_registry::find(std::size_t id) const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_jobs.find(id);
+        return it == m_jobs.end() ? nullptr : it->second;
+    }
+
+    std::vector<std::shared_ptr<job_registry::job>> job_registry::jobs() const
+    {
+        std::vector<std::shared_ptr<job>> res;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const auto& j : m_jobs)
+        {
+            res.push_back(j.second);
+        }
+        return res;
+    }
+
+    std::vector<job_registry::job_status> job_registry::status() const
+    {
+        std::vector<job_status> res;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const auto& j : m_jobs)
+        {
+            res.push_back({j.first, j.second->name, j.second->state, elapsed(*j.second, j.second->running)});
+        }
+        return res;
+    }
+
+    std::size_t job_registry::running() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return static_cast<std::size_t>(std::count_if(m_jobs.begin(), m_jobs.end(),
+                                                       [](const std::pair<const std::size_t, std::shared_ptr<job>>& j)
+                                                       {
+                                                           return j.second->running;
+                                                       }));
+    }
+
+    bool job_registry::wait(const std::vector<std::size_t>& ids, double timeout)
+    {
+        auto finished = [this, &ids]()
+        {
+            for (const auto& j : m_jobs)
+            {
+                bool waited = ids.empty() || std::find(ids.begin(), ids.end(), j.first) != ids.end();
+                if (waited && j.second->running)
+                {
+                    return false;
+                }
+            }
+            return true;
+        };
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (timeout > 0.)
+        {
+            return m_finished.wait_for(lock, std::chrono::duration<double>(timeout), finished);
+        }
+        m_finished.wait(lock, finished);
+        return true;
+    }
+
+    void job_registry::publish(const job& j, bool update) const
+    {
+        std::ostringstream text;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            text << "Job " << j.id;
+            if (!j.name.empty())
+            {
+                text << " (" << j.name << ")";
+            }
+            text << ": " << j.state;
+            if (!j.running)
+            {
+                text << " after " << format_seconds(elapsed(j, false)) << " s";
+            }
+            if (!j.error.empty())
+            {
+                text << ": " << j.error;
+            }
+        }
+
+        nl::json data;
+        data["text/plain"] = text.str();
+        nl::json transient;
+        transient["display_id"] = j.display_id;
+        if (update)
+        {
+            xeus::get_interpreter().update_display_data(std::move(data), nl::json::object(), std::move(transient));
+        }
+        else
+        {
+            xeus::get_interpreter().display_data(std::move(data), nl::json::object(), std::move(transient));
+        }
+    }
+
+    void job_registry::publish_finished()
+    {
+        std::vector<std::shared_ptr<job>> finished;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (const auto& j : m_jobs)
+            {
+                if (!j.second->running && !j.second->published)
+                {
+                    j.second->published = true;
+                    finished.push_back(j.second);
+                }
+            }
+        }
+        for (const auto& j : finished)
+        {
+            publish(*j, true);
+        }
+    }
+
+    void job_registry::stop_all()
+    {
+        std::vector<std::thread> threads;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (const auto& j : m_jobs)
+            {
+                j.second->stop = true;
+                if (j.second->thread.joinable())
+                {
+                    threads.push_back(std::move(j.second->thread));
+                }
+            }
+        }
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+    }
+
+    /**************
+     * background *
+     **************/
+
+    xoptions background::get_options()
+    {
+        xoptions options{"background", "Run the cell on a thread of its own while the kernel runs the next cells"};
+        options.add_options()
+            ("n,name", "name of the job shown by %jobs", cxxopts::value<std::string>());
+        return options;
+    }
+
+    void background::operator()(const std::string& line, const std::string& cell)
+    {
+        auto options = get_options();
+        auto result = options.parse(line);
+
+        // The includes go to the global scope, the rest of the cell is the
+        // body of the function run by the job.
+        std::string includes = "#include \"xcpp/xjob.hpp\"\n";
+        std::string body;
+        std::istringstream lines(cell);
+        std::string cell_line;
+        while (std::getline(lines, cell_line))
+        {
+            std::string& target = trim(cell_line).compare(0, 8, "#include") == 0 ? includes : body;
+            target += cell_line + "\n";
+        }
+        if (trim(body).empty())
+        {
+            std::cerr << "UsageError: %%background requires code to run\n";
+            return;
+        }
+
+        if (m_interpreter.declare(includes) != cling::Interpreter::kSuccess)
+        {
+            return;
+        }
+
+        std::string name = result.count("name") ? result["name"].as<std::string>() : default_name(body);
+        auto job = m_jobs->add(name);
+        std::string function = "__xcpp_background_" + std::to_string(job->id);
+        std::string code = "extern \"C\" void " + function + "()\n{\n" + body + "}\n";
+        void* address = nullptr;
+        if (m_interpreter.declare(code) == cling::Interpreter::kSuccess)
+        {
+            address = m_interpreter.getAddressOfGlobal(function);
+        }
+        if (address == nullptr)
+        {
+            // The job has no display, the compilation errors are shown instead.
+            job->published = true;
+            m_jobs->finish(*job, "failed", "compilation failed");
+            return;
+        }
+        m_jobs->publish(*job, false);
+
+        // Output of the job goes to this cell even after it completed: the
+        // job thread is attributed to it before the magic returns.
+        auto run = reinterpret_cast<void (*)()>(address);
+        auto cout_buffer = dynamic_cast<xoutput_buffer*>(std::cout.rdbuf());
+        auto cerr_buffer = dynamic_cast<xoutput_buffer*>(std::cerr.rdbuf());
+        auto jobs = m_jobs;
+        std::promise<void> started;
+        std::future<void> ready = started.get_future();
+        std::thread thread([run, job, jobs, cout_buffer, cerr_buffer, started = std::move(started)]() mutable
+        {
+            if (cout_buffer != nullptr)
+            {
+                cout_buffer->track_thread();
+            }
+            if (cerr_buffer != nullptr)
+            {
+                cerr_buffer->track_thread();
+            }
+            started.set_value();
+
+            current_stop = &job->stop;
+            std::string state = "done";
+            std::string error;
+            try
+            {
+                run();
+            }
+            catch (std::exception& e)
+            {
+                state = "failed";
+                error = e.what();
+            }
+            catch (...)
+            {
+                state = "failed";
+                error = "unknown exception";
+            }
+            current_stop = nullptr;
+            if (state == "done" && job->stop)
+            {
+                state = "stopped";
+            }
+            std::cout.flush();
+            std::cerr.flush();
+            // The display is updated by the kernel thread.
+            jobs->finish(*job, state, error);
+        });
+        ready.wait();
+        m_jobs->start(*job, std::move(thread));
+    }
+
+    /********
+     * jobs *
+     ********/
+
+    void jobs::operator()(const std::string& /*line*/)
+    {
+        auto all = m_jobs->status();
+        if (all.empty())
+        {
+            std::cout << "No background jobs" << std::endl;
+            return;
+        }
+
+        std::ostringstream text;
+        std::vector<std::vector<std::string>> rows;
+        for (const auto& j : all)
+        {
+            rows.push_back({std::to_string(j.id), html_escape(j.name), j.state, format_seconds(j.seconds)});
+            text << std::setw(4) << j.id << "  " << std::setw(8) << std::left << j.state << std::right
+                 << std::setw(10) << format_seconds(j.seconds) << " s  " << j.name << "\n";
+        }
+
+        nl::json pub_data;
+        pub_data["text/plain"] = text.str();
+        pub_data["text/html"] = html_table({"Job", "Name", "State", "Elapsed (s)"}, rows);
+        xeus::get_interpreter().display_data(std::move(pub_data), nl::json::object(), nl::json::object());
+    }
+
+    /************
+     * wait_job *
+     ************/
+
+    xoptions wait_job::get_options()
+    {
+        xoptions options{"wait", "Wait for background jobs to finish, all the running ones by default"};
+        options.add_options()
+            ("t,timeout", "give up after the given number of seconds", cxxopts::value<double>())
+            ("ids", "ids of the jobs", cxxopts::value<std::vector<std::string>>());
+        options.parse_positional("ids");
+        return options;
+    }
+
+    void wait_job::operator()(const std::string& line)
+    {
+        auto options = get_options();
+        auto result = options.parse(line);
+        bool valid = true;
+        std::vector<std::size_t> ids;
+        if (result.count("ids"))
+        {
+            ids = parse_ids(result["ids"].as<std::vector<std::string>>(), valid);
+        }
+        for (std::size_t id : ids)
+        {
+            if (m_jobs->find(id) == nullptr)
+            {
+                std::cerr << "UsageError: no job " << id << "\n";
+                valid = false;
+            }
+        }
+        if (!valid)
+        {
+            return;
+        }
+
+        double timeout = result.count("timeout") ? result["timeout"].as<double>() : 0.;
+        if (!m_jobs->wait(ids, timeout))
+        {
+            std::cerr << "Timed out after " << timeout << " s, " << m_jobs->running() << " jobs still running"
+                      << std::endl;
+        }
+    }
+
+    /************
+     * kill_job *
+     ************/
+
+    xoptions kill_job::get_options()
+    {
+        xoptions options{"kill", "Ask background jobs to stop, see xcpp::stop_requested"};
+        options.add_options()
+            ("a,all", "stop all the running jobs")
+            ("ids", "ids of the jobs", cxxopts::value<std::vector<std::string>>());
+        options.parse_positional("ids");
+        return options;
+    }
+
+    void kill_job::operator()(const std::string& line)
+    {
+        auto options = get_options();
+        auto result = options.parse(line);
+        std::vector<std::shared_ptr<job_registry::job>> targets;
+        if (result.count("all"))
+        {
+            targets = m_jobs->jobs();
+        }
+        else if (result.count("ids"))
+        {
+            bool valid = true;
+            for (std::size_t id : parse_ids(result["ids"].as<std::vector<std::string>>(), valid))
+            {
+                auto j = m_jobs->find(id);
+                if (j == nullptr)
+                {
+                    std::cerr << "UsageError: no job " << id << "\n";
+                    return;
+                }
+                targets.push_back(j);
+            }
+            if (!valid)
+            {
+                return;
+            }
+        }
+        else
+        {
+            std::cerr << "UsageError: %kill requires job ids or --all\n";
+            return;
+        }
+
+        for (const auto& j : targets)
+        {
+            j->stop = true;
+        }
+        std::cout << "Stop requested, the jobs return at their next check of xcpp::stop_requested()" << std::endl;
+    }
+}
@@ -0,0 +1,168 @@
+/***********************************************************************************
+* Copyright (c) 2016, Johan Mabille, Loic Gouarin, Sylvain Corlay, Wolf Vollprecht *
+* Copyright (c) 2016, QuantStack                                                   *
+*                                                                                  *
+* Distributed under the terms of the BSD 3-Clause License.                         *
+*                                                                                  *
+* The full license is in the file LICENSE, distributed with this software.         *
+************************************************************************************/
+
+#ifndef XMAGICS_JOBS_HPP
+#define XMAGICS_JOBS_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cling/Interpreter/Interpreter.h"
+
+#include "xeus/xguid.hpp"
+
+#include "xeus-cling/xmagics.hpp"
+#include "xeus-cling/xoptions.hpp"
+
+namespace xcpp
+{
+    /**
+     * The %%background jobs of the session, shared by the magics managing
+     * them and by the interpreter, which is not reset while a job runs the
+     * code it compiled.
+     */
+    class job_registry
+    {
+    public:
+
+        struct job
+        {
+            std::size_t id = 0;
+            std::string name;
+            xeus::xguid display_id;
+            std::chrono::steady_clock::time_point start;
+            std::chrono::steady_clock::time_point end;
+            // Whether the display shows the state the job finished in, only
+            // used by the kernel thread.
+            bool published = false;
+            // The fields below are guarded by the mutex of the registry.
+            bool running = true;
+            // "done", "failed" or "stopped" once the job returned.
+            std::string state = "running";
+            std::string error;
+            std::thread thread;
+            std::atomic<bool> stop{false};
+        };
+
+        // Snapshot of a job for %jobs.
+        struct job_status
+        {
+            std::size_t id;
+            std::string name;
+            std::string state;
+            double seconds;
+        };
+
+        std::shared_ptr<job> add(const std::string& name);
+        // Records the thread running the job, joined by stop_all.
+        void start(job& j, std::thread thread);
+        void finish(job& j, const std::string& state, const std::string& error);
+
+        std::shared_ptr<job> find(std::size_t id) const;
+        std::vector<std::shared_ptr<job>> jobs() const;
+        std::vector<job_status> status() const;
+        std::size_t running() const;
+
+        // Waits for the given jobs, all the running ones if empty, at most
+        // timeout seconds if positive. Returns whether they all finished.
+        bool wait(const std::vector<std::size_t>& ids, double timeout);
+
+        // Shows the state of the job in its display, published by the cell
+        // that started it. Only called by the kernel thread.
+        void publish(const job& j, bool update) const;
+
+        // Updates the displays of the jobs that finished since the last call,
+        // from the kernel thread at the end of each cell.
+        void publish_finished();
+
+        // Asks all the jobs to stop and waits for them, before the
+        // interpreter whose code they run is destroyed.
+        void stop_all();
+
+    private:
+
+        mutable std::mutex m_mutex;
+        std::condition_variable m_finished;
+        std::map<std::size_t, std::shared_ptr<job>> m_jobs;
+        std::size_t m_next_id = 1;
+    };
+
+    /**
+     * %%background compiles the cell as the body of a function on the main
+     * interpreter, then calls it on a thread of its own: the cell returns
+     * at once and the kernel keeps running the next cells.
+     */
+    class background : public xmagic_cell
+    {
+    public:
+
+        background(cling::Interpreter& i, std::shared_ptr<job_registry> jobs)
+            : m_interpreter(i), m_jobs(std::move(jobs))
+        {
+        }
+
+        xoptions get_options();
+        virtual void operator()(const std::string& line, const std::string& cell) override;
+
+    private:
+
+        cling::Interpreter& m_interpreter;
+        std::shared_ptr<job_registry> m_jobs;
+    };
+
+    class jobs : public xmagic_line
+    {
+    public:
+
+        jobs(std::shared_ptr<job_registry> jobs) : m_jobs(std::move(jobs)) {}
+
+        virtual void operator()(const std::string& line) override;
+
+    private:
+
+        std::shared_ptr<job_registry> m_jobs;
+    };
+
+    class wait_job : public xmagic_line
+    {
+    public:
+
+        wait_job(std::shared_ptr<job_registry> jobs) : m_jobs(std::move(jobs)) {}
+
+        xoptions get_options();
+        virtual void operator()(const std::string& line) override;
+
+    private:
+
+        std::shared_ptr<job_registry> m_jobs;
+    };
+
+    class kill_job : public xmagic_line
+    {
+    public:
+
+        kill_job(std::shared_ptr<job_registry> jobs) : m_jobs(std::move(jobs)) {}
+
+        xoptions get_options();
+        virtual void operator()(const std::string& line) override;
+
+    private:
+
+        std::shared_ptr<job_registry> m_jobs;
+    };
+}
+#endif
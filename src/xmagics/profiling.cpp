@@ -0,0 +1,892 @@
+/***********************************************************************************
+* Copyright (c) 2016, Johan Mabille, Loic Gouarin, Sylvain Corlay, Wolf Vollprecht *
+* Copyright (c) 2016, QuantStack                                                   *
+*                                                                                  *
+* Distributed under the terms of the BSD 3-Clause License.                         *
+*                                                                                  *
+* The full license is in the file LICENSE, distributed with this software.         *
+************************************************************************************/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <regex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <csignal>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <sys/time.h>
+#endif
+
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/Casting.h"
+#include "llvm/Support/Timer.h"
+#include "llvm/Support/raw_ostream.h"
+#include "clang/AST/Decl.h"
+#include "clang/AST/DeclCXX.h"
+#include "clang/AST/DeclTemplate.h"
+#include "clang/AST/Stmt.h"
+#include "clang/Basic/SourceManager.h"
+#include "clang/Lex/PPCallbacks.h"
+#include "clang/Lex/Preprocessor.h"
+#include "cling/Interpreter/Interpreter.h"
+#include "cling/Interpreter/InterpreterCallbacks.h"
+#include "cling/Interpreter/Transaction.h"
+
+#include "nlohmann/json.hpp"
+
+#include "xeus/xinterpreter.hpp"
+
+#include "execution.hpp"
+#include "profiling.hpp"
+#include "../xdemangle.hpp"
+#include "../xhtml.hpp"
+#include "../xjit.hpp"
+
+namespace nl = nlohmann;
+
+namespace xcpp
+{
+    using clock_type = std::chrono::steady_clock;
+
+    struct include_timing
+    {
+        std::string file;
+        std::size_t depth;
+        // Microseconds since the beginning of the cell.
+        double start;
+        double inclusive;
+        double self;
+    };
+
+    /**
+     * Times the files entered by the preprocessor. Cells are entered as
+     * memory buffers without a file entry and only act as parents of the
+     * headers they include.
+     */
+    class include_recorder
+    {
+    public:
+
+        void start()
+        {
+            m_timings.clear();
+            m_stack.clear();
+            m_origin = clock_type::now();
+            m_active = true;
+        }
+
+        void stop()
+        {
+            m_active = false;
+            m_stack.clear();
+        }
+
+        void enter(std::string file)
+        {
+            if (!m_active)
+            {
+                return;
+            }
+            m_stack.push_back({std::move(file), clock_type::now(), 0.});
+        }
+
+        void exit()
+        {
+            if (!m_active || m_stack.empty())
+            {
+                return;
+            }
+            open_file current = std::move(m_stack.back());
+            m_stack.pop_back();
+            double inclusive = elapsed(current.start);
+            if (!m_stack.empty())
+            {
+                m_stack.back().children += inclusive;
+            }
+            if (!current.file.empty())
+            {
+                std::size_t depth = std::count_if(m_stack.begin(), m_stack.end(), [](const open_file& f)
+                {
+                    return !f.file.empty();
+                });
+                m_timings.push_back({current.file, depth, elapsed_since_origin(current.start),
+                                     inclusive, inclusive - current.children});
+            }
+        }
+
+        const std::vector<include_timing>& timings() const
+        {
+            return m_timings;
+        }
+
+    private:
+
+        struct open_file
+        {
+            std::string file;
+            clock_type::time_point start;
+            double children;
+        };
+
+        double elapsed(clock_type::time_point start) const
+        {
+            return std::chrono::duration<double, std::micro>(clock_type::now() - start).count();
+        }
+
+        double elapsed_since_origin(clock_type::time_point t) const
+        {
+            return std::chrono::duration<double, std::micro>(t - m_origin).count();
+        }
+
+        bool m_active = false;
+        clock_type::time_point m_origin;
+        std::vector<open_file> m_stack;
+        std::vector<include_timing> m_timings;
+    };
+
+    /**
+     * Times the execution of the code of a cell, which cling brackets with
+     * the callbacks locking the compilation during user code execution, so
+     * that it can be told apart from the compilation.
+     */
+    class execution_timer
+    {
+    public:
+
+        void start()
+        {
+            m_active = true;
+            m_depth = 0;
+            m_elapsed = 0.;
+        }
+
+        void stop()
+        {
+            m_active = false;
+        }
+
+        void enter()
+        {
+            if (m_active && m_depth++ == 0)
+            {
+                m_start = clock_type::now();
+            }
+        }
+
+        void exit()
+        {
+            if (m_active && m_depth > 0 && --m_depth == 0)
+            {
+                m_elapsed += std::chrono::duration<double, std::micro>(clock_type::now() - m_start).count();
+            }
+        }
+
+        double elapsed() const
+        {
+            return m_elapsed;
+        }
+
+    private:
+
+        bool m_active = false;
+        std::size_t m_depth = 0;
+        clock_type::time_point m_start;
+        double m_elapsed = 0.;
+    };
+
+    namespace
+    {
+        class include_callbacks : public clang::PPCallbacks
+        {
+        public:
+
+            include_callbacks(clang::SourceManager& sm, std::shared_ptr<include_recorder> recorder)
+                : m_source_manager(sm), p_recorder(std::move(recorder))
+            {
+            }
+
+            void FileChanged(clang::SourceLocation loc, FileChangeReason reason,
+                             clang::SrcMgr::CharacteristicKind, clang::FileID) override
+            {
+                if (reason == EnterFile)
+                {
+                    clang::FileID id = m_source_manager.getFileID(m_source_manager.getExpansionLoc(loc));
+                    const clang::FileEntry* entry = m_source_manager.getFileEntryForID(id);
+                    p_recorder->enter(entry ? entry->getName().str() : std::string());
+                }
+                else if (reason == ExitFile)
+                {
+                    p_recorder->exit();
+                }
+            }
+
+        private:
+
+            clang::SourceManager& m_source_manager;
+            std::shared_ptr<include_recorder> p_recorder;
+        };
+
+        class execution_callbacks : public cling::InterpreterCallbacks
+        {
+        public:
+
+            execution_callbacks(cling::Interpreter* i, std::shared_ptr<execution_timer> timer)
+                : cling::InterpreterCallbacks(i), p_timer(std::move(timer))
+            {
+            }
+
+            void* LockCompilationDuringUserCodeExecution() override
+            {
+                p_timer->enter();
+                return nullptr;
+            }
+
+            void UnlockCompilationDuringUserCodeExecution(void*) override
+            {
+                p_timer->exit();
+            }
+
+        private:
+
+            std::shared_ptr<execution_timer> p_timer;
+        };
+
+        struct instantiation_stats
+        {
+            std::size_t count = 0;
+            std::size_t statements = 0;
+        };
+
+        std::size_t count_statements(const clang::Stmt* stmt)
+        {
+            if (stmt == nullptr)
+            {
+                return 0;
+            }
+            std::size_t res = 1;
+            for (const clang::Stmt* child : stmt->children())
+            {
+                res += count_statements(child);
+            }
+            return res;
+        }
+
+        // Name of the template a function was instantiated from: the function
+        // template itself, or the class template for the members of a class
+        // template specialization.
+        std::string template_name(const clang::FunctionDecl* fd)
+        {
+            if (const auto* ftd = fd->getPrimaryTemplate())
+            {
+                return ftd->getQualifiedNameAsString();
+            }
+            if (const auto* md = llvm::dyn_cast<clang::CXXMethodDecl>(fd))
+            {
+                if (const auto* ctsd = llvm::dyn_cast<clang::ClassTemplateSpecializationDecl>(md->getParent()))
+                {
+                    return ctsd->getSpecializedTemplate()->getQualifiedNameAsString();
+                }
+            }
+            return fd->getQualifiedNameAsString();
+        }
+
+        void collect_instantiations(const cling::Transaction& t,
+                                    std::map<std::string, instantiation_stats>& stats)
+        {
+            for (auto i = t.decls_begin(), e = t.decls_end(); i != e; ++i)
+            {
+                if (i->m_Call != cling::Transaction::kCCIHandleCXXImplicitFunctionInstantiation)
+                {
+                    continue;
+                }
+                for (const clang::Decl* decl : i->m_DGR)
+                {
+                    if (const auto* fd = llvm::dyn_cast<clang::FunctionDecl>(decl))
+                    {
+                        auto& entry = stats[template_name(fd)];
+                        ++entry.count;
+                        entry.statements += count_statements(fd->getBody());
+                    }
+                }
+            }
+            if (t.hasNestedTransactions())
+            {
+                for (auto n = t.nested_begin(), e = t.nested_end(); n != e; ++n)
+                {
+                    collect_instantiations(**n, stats);
+                }
+            }
+        }
+
+        // Parses the reports of the LLVM pass timers, whose rows end with the
+        // wall time of the pass followed by its name.
+        std::map<std::string, double> parse_pass_timings(const std::string& report)
+        {
+            static const std::regex row(R"(^\s*(?:([0-9.]+) \(\s*[0-9.]+%\)\s+)+(\S.*?)\s*$)");
+            std::map<std::string, double> res;
+            std::istringstream is(report);
+            std::string line;
+            std::smatch match;
+            while (std::getline(is, line))
+            {
+                if (std::regex_match(line, match, row) && match[2] != "Total")
+                {
+                    res[match[2]] += std::stod(match[1]) * 1e6;
+                }
+            }
+            return res;
+        }
+
+        std::string format_ms(double us)
+        {
+            std::ostringstream os;
+            os << std::fixed << std::setprecision(1) << us / 1000.;
+            return os.str();
+        }
+    }
+
+    compiletime::compiletime(cling::Interpreter& i)
+        : m_interpreter(i), p_recorder(std::make_shared<include_recorder>()),
+          p_execution(std::make_shared<execution_timer>())
+    {
+        clang::Preprocessor& pp = m_interpreter.getCI()->getPreprocessor();
+        pp.addPPCallbacks(std::make_unique<include_callbacks>(pp.getSourceManager(), p_recorder));
+        m_interpreter.setCallbacks(std::make_unique<execution_callbacks>(&m_interpreter, p_execution));
+    }
+
+    xoptions compiletime::get_options()
+    {
+        xoptions options{"compiletime", "Profile the compilation of a cell"};
+        options.add_options()
+            ("n,top", "number of rows of each table", cxxopts::value<std::size_t>()->default_value("20"))
+            ("o,output", "write a Chrome trace (chrome://tracing) to this file", cxxopts::value<std::string>());
+        return options;
+    }
+
+    void compiletime::operator()(const std::string& line, const std::string& cell)
+    {
+        auto options = get_options();
+        auto result = options.parse(line);
+        std::size_t top = result["top"].as<std::size_t>();
+
+        // Flush what the pass timers may have accumulated before the cell.
+        std::string discarded;
+        llvm::raw_string_ostream discarded_stream(discarded);
+        llvm::TimerGroup::printAll(discarded_stream);
+
+        const cling::Transaction* previous = m_interpreter.getLastTransaction();
+        bool previous_time_passes = llvm::TimePassesIsEnabled;
+        llvm::TimePassesIsEnabled = true;
+        p_recorder->start();
+        p_execution->start();
+        auto start = clock_type::now();
+
+        process_cell(m_interpreter, cell);
+
+        double total = std::chrono::duration<double, std::micro>(clock_type::now() - start).count();
+        p_execution->stop();
+        p_recorder->stop();
+        double running = p_execution->elapsed();
+        llvm::TimePassesIsEnabled = previous_time_passes;
+
+        std::string pass_report;
+        llvm::raw_string_ostream pass_stream(pass_report);
+        llvm::TimerGroup::printAll(pass_stream);
+        pass_stream.flush();
+        std::map<std::string, double> passes = parse_pass_timings(pass_report);
+
+        std::map<std::string, instantiation_stats> instantiations;
+        const cling::Transaction* t = previous ? previous->getNext() : m_interpreter.getFirstTransaction();
+        for (; t != nullptr; t = t->getNext())
+        {
+            collect_instantiations(*t, instantiations);
+        }
+
+        std::vector<include_timing> includes = p_recorder->timings();
+        std::sort(includes.begin(), includes.end(), [](const include_timing& lhs, const include_timing& rhs)
+        {
+            return lhs.inclusive > rhs.inclusive;
+        });
+        double parsing = 0.;
+        for (const auto& include : includes)
+        {
+            if (include.depth == 0)
+            {
+                parsing += include.inclusive;
+            }
+        }
+
+        std::vector<std::pair<std::string, double>> sorted_passes(passes.begin(), passes.end());
+        std::sort(sorted_passes.begin(), sorted_passes.end(), [](const auto& lhs, const auto& rhs)
+        {
+            return lhs.second > rhs.second;
+        });
+        double backend = 0.;
+        for (const auto& pass : sorted_passes)
+        {
+            backend += pass.second;
+        }
+        // What is neither parsing, code generation nor the execution of the
+        // cell is spent in the rest of the frontend.
+        double frontend = std::max(0., total - running - parsing - backend);
+
+        std::vector<std::pair<std::string, instantiation_stats>> sorted_instantiations(instantiations.begin(), instantiations.end());
+        std::sort(sorted_instantiations.begin(), sorted_instantiations.end(), [](const auto& lhs, const auto& rhs)
+        {
+            return lhs.second.statements > rhs.second.statements;
+        });
+
+        std::ostringstream html;
+        std::ostringstream text;
+        html << "<p><b>Total: " << format_ms(total) << " ms</b></p>";
+        html << html_table({"Phase", "Time (ms)"}, {
+            {"Parsing headers", format_ms(parsing)},
+            {"Semantic analysis, template instantiation and IR generation", format_ms(frontend)},
+            {"LLVM optimization and code generation", format_ms(backend)},
+            {"Running the cell", format_ms(running)}
+        });
+        text << "Total: " << format_ms(total) << " ms\n"
+             << "  Parsing headers: " << format_ms(parsing) << " ms\n"
+             << "  Semantic analysis, template instantiation and IR generation: " << format_ms(frontend) << " ms\n"
+             << "  LLVM optimization and code generation: " << format_ms(backend) << " ms\n"
+             << "  Running the cell: " << format_ms(running) << " ms\n";
+
+        if (!includes.empty())
+        {
+            std::vector<std::vector<std::string>> rows;
+            text << "\nHeaders (inclusive / self ms):\n";
+            for (std::size_t i = 0; i < std::min(top, includes.size()); ++i)
+            {
+                const auto& include = includes[i];
+                rows.push_back({html_escape(include.file), std::to_string(include.depth),
+                                format_ms(include.inclusive), format_ms(include.self)});
+                text << "  " << format_ms(include.inclusive) << " / " << format_ms(include.self)
+                     << "  " << include.file << "\n";
+            }
+            html << "<h4>Headers</h4>" << html_table({"Header", "Depth", "Inclusive (ms)", "Self (ms)"}, rows);
+        }
+
+        if (!sorted_instantiations.empty())
+        {
+            std::vector<std::vector<std::string>> rows;
+            text << "\nTemplate instantiations (functions / statements):\n";
+            for (std::size_t i = 0; i < std::min(top, sorted_instantiations.size()); ++i)
+            {
+                const auto& entry = sorted_instantiations[i];
+                rows.push_back({html_escape(entry.first), std::to_string(entry.second.count),
+                                std::to_string(entry.second.statements)});
+                text << "  " << entry.second.count << " / " << entry.second.statements
+                     << "  " << entry.first << "\n";
+            }
+            html << "<h4>Template instantiations</h4>"
+                 << html_table({"Template", "Instantiated functions", "Instantiated statements"}, rows);
+        }
+
+        if (!sorted_passes.empty())
+        {
+            std::vector<std::vector<std::string>> rows;
+            text << "\nLLVM passes (ms):\n";
+            for (std::size_t i = 0; i < std::min(top, sorted_passes.size()); ++i)
+            {
+                rows.push_back({html_escape(sorted_passes[i].first), format_ms(sorted_passes[i].second)});
+                text << "  " << format_ms(sorted_passes[i].second) << "  " << sorted_passes[i].first << "\n";
+            }
+            html << "<h4>LLVM passes</h4>" << html_table({"Pass", "Time (ms)"}, rows);
+        }
+
+        nl::json pub_data;
+        pub_data["text/plain"] = text.str();
+        pub_data["text/html"] = html.str();
+        xeus::get_interpreter().display_data(std::move(pub_data), nl::json::object(), nl::json::object());
+
+        if (result.count("output"))
+        {
+            nl::json events = nl::json::array();
+            events.push_back({{"name", "Cell"}, {"cat", "cell"}, {"ph", "X"}, {"ts", 0.},
+                              {"dur", total}, {"pid", 1}, {"tid", 1}});
+            for (const auto& include : p_recorder->timings())
+            {
+                events.push_back({{"name", include.file}, {"cat", "header"}, {"ph", "X"},
+                                  {"ts", include.start}, {"dur", include.inclusive}, {"pid", 1}, {"tid", 1}});
+            }
+            // Instantiations and passes are not timestamped: they are laid
+            // out back to back on their own tracks.
+            double ts = 0.;
+            for (const auto& pass : sorted_passes)
+            {
+                events.push_back({{"name", pass.first}, {"cat", "llvm"}, {"ph", "X"},
+                                  {"ts", ts}, {"dur", pass.second}, {"pid", 1}, {"tid", 2}});
+                ts += pass.second;
+            }
+            nl::json templates = nl::json::object();
+            for (const auto& entry : sorted_instantiations)
+            {
+                templates[entry.first] = {{"functions", entry.second.count},
+                                          {"statements", entry.second.statements}};
+            }
+            events.push_back({{"name", "Template instantiations"}, {"cat", "template"}, {"ph", "i"},
+                              {"ts", 0.}, {"s", "p"}, {"pid", 1}, {"tid", 3}, {"args", templates}});
+            nl::json trace = {{"traceEvents", events}, {"displayTimeUnit", "ms"}};
+
+            std::string filename = result["output"].as<std::string>();
+            std::ofstream output(filename);
+            if (!output)
+            {
+                std::cerr << "UsageError: cannot write " << filename << "\n";
+                return;
+            }
+            output << trace.dump();
+            std::cout << "Trace written to " << filename << std::endl;
+        }
+    }
+
+    xoptions prun::get_options()
+    {
+        xoptions options{"prun", "Profile the execution of a cell with a sampling profiler"};
+        options.add_options()
+            ("f,frequency", "sampling frequency in Hz, in CPU time", cxxopts::value<std::size_t>()->default_value("1000"))
+            ("n,top", "number of rows of the table of functions", cxxopts::value<std::size_t>()->default_value("20"));
+        return options;
+    }
+
+#if defined(_WIN32)
+
+    void prun::operator()(const std::string& /*line*/, const std::string& /*cell*/)
+    {
+        std::cerr << "UsageError: %%prun is not available on Windows\n";
+    }
+
+#else
+
+    namespace
+    {
+        // Samples are recorded from the signal handler into preallocated
+        // storage, since it must not allocate nor lock.
+        constexpr std::size_t sample_depth = 48;
+        constexpr std::size_t max_samples = 1 << 15;
+
+        struct sample_buffer
+        {
+            std::vector<void*> frames;
+            std::vector<int> depths;
+            std::atomic<std::size_t> count;
+        };
+
+        // Read by the signal handler, which may interrupt the thread that
+        // sets it at any point.
+        static_assert(ATOMIC_POINTER_LOCK_FREE == 2, "the sample buffer must be published without locks");
+        std::atomic<sample_buffer*> p_samples(nullptr);
+
+        void record_sample(int)
+        {
+            sample_buffer* samples = p_samples.load();
+            if (samples == nullptr)
+            {
+                return;
+            }
+            std::size_t index = samples->count.fetch_add(1);
+            if (index < max_samples)
+            {
+                samples->depths[index] = backtrace(&samples->frames[index * sample_depth],
+                                                   static_cast<int>(sample_depth));
+            }
+        }
+
+        /**
+         * Resolves addresses against the shared libraries with dladdr, and
+         * against the functions the JIT has loaded, whose code lives in
+         * memory it allocated. Addresses outside of any of them are unknown.
+         */
+        class symbolizer
+        {
+        public:
+
+            symbolizer()
+            {
+                for (jit_function& function : jit_functions())
+                {
+                    m_jit_functions[function.address] = std::move(function);
+                }
+            }
+
+            std::string operator()(void* address)
+            {
+                auto it = m_cache.find(address);
+                if (it != m_cache.end())
+                {
+                    return it->second;
+                }
+
+                std::string name;
+                Dl_info info;
+                auto pc = reinterpret_cast<std::uintptr_t>(address);
+                if (dladdr(address, &info) != 0 && info.dli_fname != nullptr)
+                {
+                    if (info.dli_sname != nullptr)
+                    {
+                        name = demangle(info.dli_sname);
+                    }
+                    else
+                    {
+                        std::string library = info.dli_fname;
+                        name = "[" + library.substr(library.find_last_of('/') + 1) + "]";
+                    }
+                }
+                else
+                {
+                    auto jit = m_jit_functions.upper_bound(pc);
+                    if (jit != m_jit_functions.begin() && pc - std::prev(jit)->first < std::prev(jit)->second.size)
+                    {
+                        name = demangle(std::prev(jit)->second.name);
+                    }
+                    else
+                    {
+                        name = "[unknown]";
+                    }
+                }
+                m_cache.emplace(address, name);
+                return name;
+            }
+
+        private:
+
+            std::map<std::uint64_t, jit_function> m_jit_functions;
+            std::map<void*, std::string> m_cache;
+        };
+
+        struct flame_node
+        {
+            std::string name;
+            std::size_t count = 0;
+            std::vector<flame_node> children;
+
+            flame_node& child(const std::string& child_name)
+            {
+                for (auto& c : children)
+                {
+                    if (c.name == child_name)
+                    {
+                        return c;
+                    }
+                }
+                children.push_back(flame_node());
+                children.back().name = child_name;
+                return children.back();
+            }
+        };
+
+        std::size_t flame_height(const flame_node& node)
+        {
+            std::size_t res = 0;
+            for (const auto& c : node.children)
+            {
+                res = std::max(res, flame_height(c));
+            }
+            return res + 1;
+        }
+
+        void render_node(std::ostream& os, const flame_node& node, double x, std::size_t depth,
+                         double scale, std::size_t total, std::size_t height)
+        {
+            constexpr double row = 17.;
+            double width = node.count * scale;
+            if (width < 0.5)
+            {
+                return;
+            }
+            double y = (height - depth - 1) * row;
+            std::size_t hash = std::hash<std::string>()(node.name);
+            int red = 205 + static_cast<int>(hash % 50);
+            int green = static_cast<int>((hash >> 8) % 180);
+            int blue = static_cast<int>((hash >> 16) % 55);
+            std::ostringstream percent;
+            percent << std::fixed << std::setprecision(2) << 100. * node.count / total;
+            std::string label = html_escape(node.name);
+            os << "<g><title>" << label << " (" << node.count << " samples, " << percent.str() << "%)</title>"
+               << "<rect x=\"" << x << "\" y=\"" << y << "\" width=\"" << width << "\" height=\"" << row - 1
+               << "\" fill=\"rgb(" << red << "," << green << "," << blue << ")\" rx=\"2\"/>";
+            std::size_t chars = static_cast<std::size_t>(width / 7.);
+            if (chars > 3)
+            {
+                std::string text = node.name.size() > chars ? node.name.substr(0, chars - 2) + ".." : node.name;
+                os << "<text x=\"" << x + 3 << "\" y=\"" << y + row - 5
+                   << "\" font-size=\"12\" font-family=\"monospace\">" << html_escape(text) << "</text>";
+            }
+            os << "</g>";
+            for (const auto& c : node.children)
+            {
+                render_node(os, c, x, depth + 1, scale, total, height);
+                x += c.count * scale;
+            }
+        }
+
+        std::string flame_graph(const flame_node& root)
+        {
+            constexpr double width = 1200.;
+            std::size_t height = flame_height(root);
+            std::ostringstream os;
+            os << "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"" << width << "\" height=\"" << height * 17
+               << "\" style=\"background: white\">";
+            if (root.count != 0)
+            {
+                render_node(os, root, 0., 0, width / root.count, root.count, height);
+            }
+            os << "</svg>";
+            return os.str();
+        }
+    }
+
+    void prun::operator()(const std::string& line, const std::string& cell)
+    {
+        auto options = get_options();
+        auto result = options.parse(line);
+        std::size_t frequency = std::max<std::size_t>(1, result["frequency"].as<std::size_t>());
+        std::size_t top = result["top"].as<std::size_t>();
+
+        sample_buffer samples;
+        samples.frames.resize(max_samples * sample_depth);
+        samples.depths.resize(max_samples);
+        samples.count = 0;
+
+        // The first call to backtrace may load the unwinder: do it outside
+        // of the signal handler.
+        void* warmup[1];
+        backtrace(warmup, 1);
+
+        struct sigaction action = {};
+        struct sigaction previous_action = {};
+        action.sa_handler = record_sample;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGPROF, &action, &previous_action);
+
+        long period = std::max<long>(1, 1000000L / static_cast<long>(frequency));
+        struct itimerval timer = {};
+        struct itimerval previous_timer = {};
+        timer.it_interval.tv_sec = period / 1000000L;
+        timer.it_interval.tv_usec = period % 1000000L;
+        timer.it_value = timer.it_interval;
+
+        p_samples = &samples;
+        setitimer(ITIMER_PROF, &timer, &previous_timer);
+        auto start = clock_type::now();
+
+        process_cell(m_interpreter, cell);
+
+        double elapsed = std::chrono::duration<double>(clock_type::now() - start).count();
+        setitimer(ITIMER_PROF, &previous_timer, nullptr);
+        sigaction(SIGPROF, &previous_action, nullptr);
+        p_samples = nullptr;
+
+        std::size_t count = std::min(samples.count.load(), max_samples);
+        if (count == 0)
+        {
+            std::cout << "No sample was recorded, the cell ran for " << elapsed << " s" << std::endl;
+            return;
+        }
+
+        // Stacks are recorded innermost first, starting with the signal
+        // handler and the signal trampoline. Frames above the wrapper cling
+        // generates for the cell belong to the kernel and are dropped.
+        symbolizer symbolize;
+        flame_node root;
+        root.name = "all";
+        std::map<std::string, std::size_t> self_counts;
+        std::map<std::string, std::size_t> inclusive_counts;
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            void** frames = &samples.frames[i * sample_depth];
+            int depth = samples.depths[i];
+            std::vector<std::string> stack;
+            bool in_cell = false;
+            for (int f = 2; f < depth; ++f)
+            {
+                std::string name = symbolize(frames[f]);
+                if (name.compare(0, 14, "__cling_Un1Qu3") == 0)
+                {
+                    stack.push_back("<cell>");
+                    in_cell = true;
+                    break;
+                }
+                stack.push_back(name);
+            }
+            if (!in_cell)
+            {
+                stack.assign(1, "[compilation and interpreter]");
+            }
+
+            ++root.count;
+            flame_node* node = &root;
+            for (auto it = stack.rbegin(); it != stack.rend(); ++it)
+            {
+                node = &node->child(*it);
+                ++node->count;
+            }
+            ++self_counts[stack.front()];
+            std::set<std::string> unique(stack.begin(), stack.end());
+            for (const auto& name : unique)
+            {
+                ++inclusive_counts[name];
+            }
+        }
+
+        std::vector<std::pair<std::string, std::size_t>> hottest(self_counts.begin(), self_counts.end());
+        std::sort(hottest.begin(), hottest.end(), [](const auto& lhs, const auto& rhs)
+        {
+            return lhs.second > rhs.second;
+        });
+
+        auto percent = [count](std::size_t n)
+        {
+            std::ostringstream os;
+            os << std::fixed << std::setprecision(1) << 100. * n / count;
+            return os.str();
+        };
+
+        std::ostringstream text;
+        std::vector<std::vector<std::string>> rows;
+        text << count << " samples in " << elapsed << " s";
+        if (samples.count.load() > max_samples)
+        {
+            text << " (" << samples.count.load() - max_samples << " samples dropped)";
+        }
+        text << "\n\n   self%  incl%  function\n";
+        for (std::size_t i = 0; i < std::min(top, hottest.size()); ++i)
+        {
+            const auto& name = hottest[i].first;
+            rows.push_back({html_escape(name), percent(hottest[i].second), percent(inclusive_counts[name])});
+            text << std::setw(8) << percent(hottest[i].second) << std::setw(7) << percent(inclusive_counts[name])
+                 << "  " << name << "\n";
+        }
+
+        std::string svg = flame_graph(root);
+        std::ostringstream html;
+        html << "<p>" << html_escape(text.str().substr(0, text.str().find('\n'))) << "</p>" << svg
+             << html_table({"Function", "Self (%)", "Inclusive (%)"}, rows);
+
+        nl::json pub_data;
+        pub_data["text/plain"] = text.str();
+        pub_data["text/html"] = html.str();
+        pub_data["image/svg+xml"] = svg;
+        xeus::get_interpreter().display_data(std::move(pub_data), nl::json::object(), nl::json::object());
+    }
+
+#endif
+}
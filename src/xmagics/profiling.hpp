@@ -0,0 +1,71 @@
+/***********************************************************************************
+* Copyright (c) 2016, Johan Mabille, Loic Gouarin, Sylvain Corlay, Wolf Vollprecht *
+* Copyright (c) 2016, QuantStack                                                   *
+*                                                                                  *
+* Distributed under the terms of the BSD 3-Clause License.                         *
+*                                                                                  *
+* The full license is in the file LICENSE, distributed with this software.         *
+************************************************************************************/
+
+#ifndef XMAGICS_PROFILING_HPP
+#define XMAGICS_PROFILING_HPP
+
+#include <memory>
+#include <string>
+
+#include "cling/Interpreter/Interpreter.h"
+
+#include "xeus-cling/xmagics.hpp"
+#include "xeus-cling/xoptions.hpp"
+
+namespace xcpp
+{
+    class include_recorder;
+    class execution_timer;
+
+    /**
+     * %%compiletime compiles and runs a cell while recording where the
+     * compilation time goes: the headers that were parsed, the templates
+     * that were instantiated and the LLVM passes that optimized and emitted
+     * the code.
+     */
+    class compiletime : public xmagic_cell
+    {
+    public:
+
+        compiletime(cling::Interpreter& i);
+
+        xoptions get_options();
+        virtual void operator()(const std::string& line, const std::string& cell) override;
+
+    private:
+
+        cling::Interpreter& m_interpreter;
+        // Shared with the preprocessor callbacks, which cannot be removed
+        // once installed and only record while a cell is profiled.
+        std::shared_ptr<include_recorder> p_recorder;
+        // Likewise shared with the interpreter callbacks, to leave the time
+        // spent running the cell out of the compilation.
+        std::shared_ptr<execution_timer> p_execution;
+    };
+
+    /**
+     * %%prun runs a cell under a sampling profiler driven by SIGPROF, and
+     * shows where the time goes as a flame graph and a table of the hottest
+     * functions.
+     */
+    class prun : public xmagic_cell
+    {
+    public:
+
+        prun(cling::Interpreter& i) : m_interpreter(i) {}
+
+        xoptions get_options();
+        virtual void operator()(const std::string& line, const std::string& cell) override;
+
+    private:
+
+        cling::Interpreter& m_interpreter;
+    };
+}
+#endif
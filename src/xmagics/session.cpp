@@ -0,0 +1,251 @@
+/***********************************************************************************
+* Copyright (c) 2016, Johan Mabille, Loic Gouarin, Sylvain Corlay, Wolf Vollprecht *
+* Copyright (c) 2016, QuantStack                                                   *
+*                                                                                  *
+* Distributed under the terms of the BSD 3-Clause License.                         *
+*                                                                                  *
+* The full license is in the file LICENSE, distributed with this software.         *
+************************************************************************************/
+
+#include <cstddef>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "cling/Interpreter/InterpreterCallbacks.h"
+
+#include "xeus-cling/xoptions.hpp"
+
+#include "jobs.hpp"
+#include "session.hpp"
+
+namespace xcpp
+{
+    xoptions autounload::get_options()
+    {
+        xoptions options{"autounload", "Set which runs of a cell unload the previous cell first"};
+        options.add_options()
+            ("m,mode", "edited, identical or off", cxxopts::value<std::string>());
+        options.parse_positional("mode");
+        return options;
+    }
+
+    void autounload::operator()(const std::string& line)
+    {
+        auto options = get_options();
+        auto result = options.parse(line);
+        if (!result.count("mode"))
+        {
+            std::cout << "autounload " << m_mode << std::endl;
+            return;
+        }
+        std::string mode = result["mode"].as<std::string>();
+        if (mode != "edited" && mode != "identical" && mode != "off")
+        {
+            std::cerr << "UsageError: unknown mode " << mode << ", expected edited, identical or off\n";
+            return;
+        }
+        m_mode = mode;
+    }
+
+    xoptions reset::get_options()
+    {
+        xoptions options{"reset", "Rebuild the interpreter without restarting the kernel"};
+        options.add_options()
+            ("c,clear", "forget the saved prelude instead of re-running it");
+        return options;
+    }
+
+    void reset::operator()(const std::string& line)
+    {
+        auto options = get_options();
+        auto result = options.parse(line);
+
+        reset_request request;
+        request.clear_prelude = result.count("clear") != 0;
+        m_callback(request);
+    }
+
+    void reset::operator()(const std::string& line, const std::string& cell)
+    {
+        auto options = get_options();
+        auto result = options.parse(line);
+
+        if (result.count("clear"))
+        {
+            std::cerr << "UsageError: %%reset saves the cell as prelude, it cannot be combined with --clear\n";
+            return;
+        }
+
+        reset_request request;
+        request.set_prelude = true;
+        request.prelude = cell;
+        m_callback(request);
+    }
+
+    xoptions run::get_options()
+    {
+        xoptions options{"run", "Declare the content of a source file, recompiled only when it changed"};
+        options.add_options()
+            ("f,filename", "filename", cxxopts::value<std::string>())
+            ("force", "recompile the file even if it did not change");
+        options.parse_positional("filename");
+        return options;
+    }
+
+    namespace
+    {
+        // Forgets the files whose transaction was unloaded, by the cells run
+        // again or by the magics, since cling recycles transactions.
+        class run_callbacks : public cling::InterpreterCallbacks
+        {
+        public:
+
+            using callback_type = std::function<void(const cling::Transaction&)>;
+
+            run_callbacks(cling::Interpreter* interpreter, callback_type callback)
+                : cling::InterpreterCallbacks(interpreter), m_callback(std::move(callback))
+            {
+            }
+
+            void TransactionUnloaded(const cling::Transaction& t) override
+            {
+                m_callback(t);
+            }
+
+        private:
+
+            callback_type m_callback;
+        };
+    }
+
+    run::run(cling::Interpreter& i, std::shared_ptr<job_registry> jobs)
+        : m_interpreter(i), p_files(std::make_shared<file_map>()), p_jobs(std::move(jobs))
+    {
+        // The callbacks are added to the ones of the interpreter.
+        auto files = p_files;
+        m_interpreter.setCallbacks(std::make_unique<run_callbacks>(&m_interpreter, [files](const cling::Transaction& t)
+        {
+            for (auto it = files->begin(); it != files->end();)
+            {
+                it = it->second.transaction == &t ? files->erase(it) : std::next(it);
+            }
+        }));
+    }
+
+    void run::unload(const cling::Transaction* transaction)
+    {
+        // Only the last transaction can be unloaded: the ones declared after
+        // the file go first, since they may depend on it.
+        std::size_t later = 0;
+        for (const cling::Transaction* t = transaction->getNext(); t != nullptr; t = t->getNext())
+        {
+            ++later;
+        }
+        if (later != 0)
+        {
+            std::cout << "Unloading the " << later << " transactions declared after the file" << std::endl;
+        }
+        while (m_interpreter.getLastTransaction() != transaction)
+        {
+            m_interpreter.unload(*const_cast<cling::Transaction*>(m_interpreter.getLastTransaction()));
+        }
+        m_interpreter.unload(*const_cast<cling::Transaction*>(transaction));
+    }
+
+    void run::operator()(const std::string& line)
+    {
+        auto options = get_options();
+        auto result = options.parse(line);
+        if (!result.count("filename"))
+        {
+            std::cerr << "UsageError: %run requires a file name\n";
+            return;
+        }
+
+        llvm::SmallString<256> path(result["filename"].as<std::string>());
+        llvm::sys::fs::make_absolute(path);
+        llvm::sys::fs::file_status status;
+        if (llvm::sys::fs::status(path, status) || !llvm::sys::fs::is_regular_file(status))
+        {
+            std::cerr << "UsageError: cannot open " << path.str().str() << "\n";
+            return;
+        }
+
+        bool force = result.count("force") != 0;
+        // Files whose transaction was unloaded are no longer in the map.
+        auto it = p_files->find(path.str());
+        bool loaded = it != p_files->end();
+        if (loaded && !force && it->second.modification_time == status.getLastModificationTime())
+        {
+            std::cout << path.str().str() << " is up to date" << std::endl;
+            return;
+        }
+
+        auto buffer = llvm::MemoryBuffer::getFile(path);
+        if (!buffer)
+        {
+            std::cerr << "UsageError: cannot read " << path.str().str() << ": "
+                      << buffer.getError().message() << "\n";
+            return;
+        }
+        llvm::MD5 md5;
+        md5.update(buffer.get()->getBuffer());
+        llvm::MD5::MD5Result digest;
+        md5.final(digest);
+        llvm::SmallString<32> hash;
+        llvm::MD5::stringifyResult(digest, hash);
+
+        // Touching the file without changing it does not recompile it.
+        if (loaded && !force && it->second.hash == hash.str())
+        {
+            it->second.modification_time = status.getLastModificationTime();
+            std::cout << path.str().str() << " is up to date" << std::endl;
+            return;
+        }
+        if (loaded)
+        {
+            std::size_t running = p_jobs->running();
+            if (running != 0)
+            {
+                std::cerr << "UsageError: " << running << " background jobs are running, "
+                          << "%wait for them or %kill them before running " << path.str().str() << " again\n";
+                return;
+            }
+            // Unloading the transaction erases the file from the map.
+            unload(it->second.transaction);
+        }
+
+        // The content is compiled from memory rather than included, so that
+        // a changed file is never read from the caches of the source manager.
+        // The #line directive keeps the diagnostics pointing to the file, and
+        // the headers next to it are found through the include path.
+        std::string directory = llvm::sys::path::parent_path(path).str();
+        if (m_include_paths.insert(directory).second)
+        {
+            m_interpreter.AddIncludePath(directory);
+        }
+        std::string quoted_path;
+        for (char c : path.str())
+        {
+            quoted_path += c == '\\' ? "\\\\" : std::string(1, c);
+        }
+        std::string code = "#line 1 \"" + quoted_path + "\"\n" + buffer.get()->getBuffer().str();
+
+        cling::Transaction* transaction = nullptr;
+        auto compilation_result = m_interpreter.declare(code, &transaction);
+        if (compilation_result != cling::Interpreter::kSuccess || transaction == nullptr)
+        {
+            return;
+        }
+        (*p_files)[path.str()] = {status.getLastModificationTime(), hash.str(), transaction};
+    }
+}
@@ -0,0 +1,116 @@
+/***********************************************************************************
+* Copyright (c) 2016, Johan Mabille, Loic Gouarin, Sylvain Corlay, Wolf Vollprecht *
+* Copyright (c) 2016, QuantStack                                                   *
+*                                                                                  *
+* Distributed under the terms of the BSD 3-Clause License.                         *
+*                                                                                  *
+* The full license is in the file LICENSE, distributed with this software.         *
+************************************************************************************/
+
+#ifndef XMAGICS_SESSION_HPP
+#define XMAGICS_SESSION_HPP
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+
+#include "llvm/Support/Chrono.h"
+#include "cling/Interpreter/Interpreter.h"
+#include "cling/Interpreter/Transaction.h"
+
+#include "xeus-cling/xmagics.hpp"
+#include "xeus-cling/xoptions.hpp"
+
+namespace xcpp
+{
+    class job_registry;
+
+    struct reset_request
+    {
+        // Forget the saved prelude cells instead of re-running them.
+        bool clear_prelude = false;
+        // Replace the saved prelude with the content of the cell.
+        bool set_prelude = false;
+        std::string prelude;
+    };
+
+    /**
+     * %autounload sets which runs of a cell unload the previous cell first:
+     * "edited" also unloads it for an edited cell declaring one of its
+     * names, "identical" only when the same cell is run again, "off" never.
+     */
+    class autounload : public xmagic_line
+    {
+    public:
+
+        autounload(std::string& mode) : m_mode(mode) {}
+
+        xoptions get_options();
+        virtual void operator()(const std::string& line) override;
+
+    private:
+
+        std::string& m_mode;
+    };
+
+    /**
+     * %reset rebuilds the cling interpreter in place. The magic only records
+     * the request: the interpreter performs it once the magic returned, since
+     * the magics themselves are re-registered against the new instance.
+     */
+    class reset : public xmagic_line_cell
+    {
+    public:
+
+        using callback_type = std::function<void(const reset_request&)>;
+
+        reset(callback_type callback) : m_callback(std::move(callback)) {}
+
+        xoptions get_options();
+        virtual void operator()(const std::string& line) override;
+        virtual void operator()(const std::string& line, const std::string& cell) override;
+
+    private:
+
+        callback_type m_callback;
+    };
+
+    /**
+     * %run declares the content of a source file in a transaction of its
+     * own. Running the same file again is a no-op until it changes, then its
+     * previous declarations are unloaded before the new content is compiled.
+     */
+    class run : public xmagic_line
+    {
+    public:
+
+        run(cling::Interpreter& i, std::shared_ptr<job_registry> jobs);
+
+        xoptions get_options();
+        virtual void operator()(const std::string& line) override;
+
+    private:
+
+        struct loaded_file
+        {
+            llvm::sys::TimePoint<> modification_time;
+            std::string hash;
+            const cling::Transaction* transaction;
+        };
+
+        using file_map = std::map<std::string, loaded_file>;
+
+        void unload(const cling::Transaction* transaction);
+
+        cling::Interpreter& m_interpreter;
+        // Shared with the callbacks of the interpreter, which forget the
+        // files whose transaction is unloaded.
+        std::shared_ptr<file_map> p_files;
+        // A changed file is not unloaded while background jobs may run it.
+        std::shared_ptr<job_registry> p_jobs;
+        std::set<std::string> m_include_paths;
+    };
+}
+#endif
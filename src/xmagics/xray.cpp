@@ -0,0 +1,312 @@
+/***********************************************************************************
+* Copyright (c) 2016, Johan Mabille, Loic Gouarin, Sylvain Corlay, Wolf Vollprecht *
+* Copyright (c) 2016, QuantStack                                                   *
+*                                                                                  *
+* Distributed under the terms of the BSD 3-Clause License.                         *
+*                                                                                  *
+* The full license is in the file LICENSE, distributed with this software.         *
+************************************************************************************/
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "llvm/Object/ObjectFile.h"
+#include "llvm/Support/Error.h"
+#include "llvm/XRay/InstrumentationMap.h"
+#include "llvm/XRay/Trace.h"
+#include "llvm/XRay/XRayRecord.h"
+
+#include "nlohmann/json.hpp"
+
+#include "xeus/xinterpreter.hpp"
+
+#include "../xdemangle.hpp"
+#include "../xhtml.hpp"
+#include "xray.hpp"
+
+namespace nl = nlohmann;
+
+namespace xcpp
+{
+    namespace
+    {
+        // Beyond this number of calls, the Chrome trace becomes too large to
+        // be opened.
+        constexpr std::size_t max_trace_events = 1 << 20;
+
+        template <class T>
+        bool check(llvm::Expected<T>& value)
+        {
+            if (value)
+            {
+                return true;
+            }
+            llvm::consumeError(value.takeError());
+            return false;
+        }
+
+        // Names of the functions of an executable, by address.
+        std::map<std::uint64_t, std::string> function_symbols(const std::string& exe_file)
+        {
+            std::map<std::uint64_t, std::string> res;
+            auto binary = llvm::object::ObjectFile::createObjectFile(exe_file);
+            if (!check(binary))
+            {
+                return res;
+            }
+            for (const llvm::object::SymbolRef& symbol : binary->getBinary()->symbols())
+            {
+                auto type = symbol.getType();
+                auto address = symbol.getAddress();
+                auto name = symbol.getName();
+                if (check(type) && check(address) && check(name) &&
+                    *type == llvm::object::SymbolRef::ST_Function)
+                {
+                    res[*address] = demangle(name->str());
+                }
+            }
+            return res;
+        }
+
+        struct function_latency
+        {
+            std::string name;
+            // Durations of the calls in nanoseconds.
+            std::vector<double> durations;
+            double total = 0.;
+        };
+
+        std::string format_duration(double ns)
+        {
+            std::ostringstream os;
+            os << std::fixed;
+            if (ns < 1e3)
+            {
+                os << std::setprecision(0) << ns << " ns";
+            }
+            else if (ns < 1e6)
+            {
+                os << std::setprecision(2) << ns * 1e-3 << " us";
+            }
+            else if (ns < 1e9)
+            {
+                os << std::setprecision(2) << ns * 1e-6 << " ms";
+            }
+            else
+            {
+                os << std::setprecision(2) << ns * 1e-9 << " s";
+            }
+            return os.str();
+        }
+
+        double percentile(const std::vector<double>& sorted, double p)
+        {
+            std::size_t index = static_cast<std::size_t>(p * static_cast<double>(sorted.size() - 1) + 0.5);
+            return sorted[std::min(index, sorted.size() - 1)];
+        }
+
+        // Histogram of the durations in power of two buckets, as an inline
+        // SVG bar chart.
+        std::string histogram_svg(const std::vector<double>& sorted)
+        {
+            auto bucket_of = [](double ns)
+            {
+                return static_cast<int>(std::floor(std::log2(std::max(ns, 1.))));
+            };
+            int first = bucket_of(sorted.front());
+            int last = bucket_of(sorted.back());
+            std::vector<std::size_t> counts(static_cast<std::size_t>(last - first + 1), 0);
+            for (double ns : sorted)
+            {
+                ++counts[static_cast<std::size_t>(bucket_of(ns) - first)];
+            }
+            std::size_t highest = *std::max_element(counts.begin(), counts.end());
+
+            const double bar_width = 8.;
+            const double height = 24.;
+            std::ostringstream os;
+            os << "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"" << bar_width * counts.size()
+               << "\" height=\"" << height << "\">";
+            for (std::size_t i = 0; i < counts.size(); ++i)
+            {
+                double h = counts[i] == 0 ? 0. : std::max(1., height * counts[i] / highest);
+                os << "<rect x=\"" << bar_width * i << "\" y=\"" << height - h << "\" width=\""
+                   << bar_width - 1 << "\" height=\"" << h << "\" fill=\"#4878cf\"><title>"
+                   << format_duration(std::ldexp(1., first + static_cast<int>(i))) << " - "
+                   << format_duration(std::ldexp(1., first + static_cast<int>(i) + 1)) << ": "
+                   << counts[i] << " calls</title></rect>";
+            }
+            os << "</svg>";
+            return os.str();
+        }
+    }
+
+    bool xray_report(const std::string& exe_file,
+                     const std::vector<std::string>& log_files,
+                     std::size_t top,
+                     const std::string& trace_file)
+    {
+        auto map = llvm::xray::loadInstrumentationMap(exe_file);
+        if (!map)
+        {
+            std::cerr << "Could not read the XRay instrumentation map of " << exe_file << ": "
+                      << llvm::toString(map.takeError()) << std::endl;
+            return false;
+        }
+        if (log_files.empty())
+        {
+            std::cerr << "The run did not write any XRay log" << std::endl;
+            return false;
+        }
+
+        auto symbols = function_symbols(exe_file);
+        const auto& addresses = map->getFunctionAddresses();
+        std::map<std::int32_t, function_latency> functions;
+        auto function = [&](std::int32_t id) -> function_latency&
+        {
+            auto it = functions.find(id);
+            if (it != functions.end())
+            {
+                return it->second;
+            }
+            function_latency& res = functions[id];
+            auto address = addresses.find(id);
+            auto symbol = address == addresses.end() ? symbols.end() : symbols.find(address->second);
+            res.name = symbol == symbols.end() ? "function #" + std::to_string(id) : symbol->second;
+            return res;
+        };
+
+        nl::json events = nl::json::array();
+        std::size_t dropped_events = 0;
+        for (std::size_t run = 0; run < log_files.size(); ++run)
+        {
+            auto trace = llvm::xray::loadTraceFile(log_files[run], true);
+            if (!trace)
+            {
+                std::cerr << "Could not read the XRay log " << log_files[run] << ": "
+                          << llvm::toString(trace.takeError()) << std::endl;
+                return false;
+            }
+            double frequency = static_cast<double>(trace->getFileHeader().CycleFrequency);
+            double ns_per_cycle = frequency > 0. ? 1e9 / frequency : 1.;
+
+            // Calls are matched per thread. The exit of a function left by an
+            // exception is not recorded: its entry is dropped when one of its
+            // callers returns.
+            using call = std::pair<std::int32_t, std::uint64_t>;
+            std::map<std::uint32_t, std::vector<call>> stacks;
+            bool first = true;
+            std::uint64_t origin = 0;
+            for (const llvm::xray::XRayRecord& record : *trace)
+            {
+                if (first)
+                {
+                    origin = record.TSC;
+                    first = false;
+                }
+                auto& stack = stacks[record.TId];
+                if (record.Type == llvm::xray::RecordTypes::ENTER)
+                {
+                    stack.emplace_back(record.FuncId, record.TSC);
+                    continue;
+                }
+                auto entry = std::find_if(stack.rbegin(), stack.rend(),
+                                          [&record](const call& c) { return c.first == record.FuncId; });
+                if (entry == stack.rend())
+                {
+                    continue;
+                }
+                std::uint64_t start = entry->second;
+                stack.erase(std::next(entry).base(), stack.end());
+
+                double duration = static_cast<double>(record.TSC - start) * ns_per_cycle;
+                function_latency& f = function(record.FuncId);
+                f.durations.push_back(duration);
+                f.total += duration;
+
+                if (!trace_file.empty())
+                {
+                    if (events.size() < max_trace_events)
+                    {
+                        events.push_back({{"name", f.name}, {"cat", "xray"}, {"ph", "X"},
+                                          {"ts", static_cast<double>(start - origin) * ns_per_cycle * 1e-3},
+                                          {"dur", duration * 1e-3}, {"pid", run + 1}, {"tid", record.TId}});
+                    }
+                    else
+                    {
+                        ++dropped_events;
+                    }
+                }
+            }
+        }
+
+        std::vector<function_latency*> sorted;
+        for (auto& entry : functions)
+        {
+            std::sort(entry.second.durations.begin(), entry.second.durations.end());
+            sorted.push_back(&entry.second);
+        }
+        std::sort(sorted.begin(), sorted.end(), [](const function_latency* lhs, const function_latency* rhs)
+        {
+            return lhs->total > rhs->total;
+        });
+
+        std::ostringstream text;
+        std::vector<std::vector<std::string>> rows;
+        text << "Latency of the " << std::min(top, sorted.size()) << " functions with the highest total time:\n";
+        for (std::size_t i = 0; i < std::min(top, sorted.size()); ++i)
+        {
+            const auto& d = sorted[i]->durations;
+            std::vector<std::string> row = {
+                html_escape(sorted[i]->name), std::to_string(d.size()), format_duration(sorted[i]->total),
+                format_duration(sorted[i]->total / static_cast<double>(d.size())), format_duration(d.front()),
+                format_duration(percentile(d, 0.5)), format_duration(percentile(d, 0.9)),
+                format_duration(percentile(d, 0.99)), format_duration(d.back()), histogram_svg(d)
+            };
+            text << "  " << sorted[i]->name << ": " << row[1] << " calls, total " << row[2] << ", median "
+                 << row[5] << ", p99 " << row[7] << ", max " << row[8] << "\n";
+            rows.push_back(std::move(row));
+        }
+
+        std::ostringstream html;
+        html << "<p>Latency of the " << std::min(top, sorted.size())
+             << " functions with the highest total time, over " << log_files.size() << " runs</p>"
+             << html_table({"Function", "Calls", "Total", "Mean", "Min", "Median", "p90", "p99", "Max",
+                            "Histogram"}, rows);
+
+        nl::json pub_data;
+        pub_data["text/plain"] = text.str();
+        pub_data["text/html"] = html.str();
+        xeus::get_interpreter().display_data(std::move(pub_data), nl::json::object(), nl::json::object());
+
+        if (!trace_file.empty())
+        {
+            std::ofstream output(trace_file);
+            if (!output)
+            {
+                std::cerr << "Could not write " << trace_file << std::endl;
+                return false;
+            }
+            nl::json trace = {{"traceEvents", events}, {"displayTimeUnit", "ns"}};
+            output << trace.dump();
+            std::cout << "Trace written to " << trace_file;
+            if (dropped_events != 0)
+            {
+                std::cout << ", without the last " << dropped_events << " calls";
+            }
+            std::cout << std::endl;
+        }
+        return true;
+    }
+}
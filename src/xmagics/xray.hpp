@@ -0,0 +1,31 @@
+/***********************************************************************************
+* Copyright (c) 2016, Johan Mabille, Loic Gouarin, Sylvain Corlay, Wolf Vollprecht *
+* Copyright (c) 2016, QuantStack                                                   *
+*                                                                                  *
+* Distributed under the terms of the BSD 3-Clause License.                         *
+*                                                                                  *
+* The full license is in the file LICENSE, distributed with this software.         *
+************************************************************************************/
+
+#ifndef XMAGICS_XRAY_HPP
+#define XMAGICS_XRAY_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace xcpp
+{
+    /**
+     * Reads the logs written by the XRay runtime during the runs of an
+     * executable built with -fxray-instrument, and displays the distribution
+     * of the latency of the calls of its functions. The calls are also
+     * written as a Chrome trace to trace_file, unless it is empty.
+     */
+    bool xray_report(const std::string& exe_file,
+                     const std::vector<std::string>& log_files,
+                     std::size_t top,
+                     const std::string& trace_file);
+}
+
+#endif
@@ -0,0 +1,142 @@
+/***********************************************************************************
+* Copyright (c) 2016, Johan Mabille, Loic Gouarin, Sylvain Corlay, Wolf Vollprecht *
+* Copyright (c) 2016, QuantStack                                                   *
+*                                                                                  *
+* Distributed under the terms of the BSD 3-Clause License.                         *
+*                                                                                  *
+* The full license is in the file LICENSE, distributed with this software.         *
+************************************************************************************/
+
+#ifndef XCPP_MEMORY_HPP
+#define XCPP_MEMORY_HPP
+
+#include <cstddef>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#if defined(__APPLE__)
+#include <mach/mach.h>
+#endif
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+#if !defined(_WIN32)
+#include <unistd.h>
+#endif
+
+namespace xcpp
+{
+    /**
+     * Returns the resident set size of the kernel process in bytes, or 0 if
+     * it cannot be determined on this platform.
+     */
+    inline std::size_t resident_memory()
+    {
+#if defined(__APPLE__)
+        mach_task_basic_info info;
+        mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+        if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO,
+                      reinterpret_cast<task_info_t>(&info), &count) == KERN_SUCCESS)
+        {
+            return static_cast<std::size_t>(info.resident_size);
+        }
+        return 0;
+#elif defined(__linux__)
+        std::ifstream statm("/proc/self/statm");
+        std::size_t pages = 0;
+        std::size_t resident = 0;
+        if (statm >> pages >> resident)
+        {
+            return resident * static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+        }
+        return 0;
+#else
+        return 0;
+#endif
+    }
+
+    /**
+     * Returns the size in bytes of the anonymous executable mappings of the
+     * kernel process, which hold the code compiled by the JIT, or 0 if it
+     * cannot be determined on this platform.
+     */
+    inline std::size_t jit_code_memory()
+    {
+#if defined(__linux__)
+        std::ifstream maps("/proc/self/maps");
+        std::size_t res = 0;
+        std::string line;
+        while (std::getline(maps, line))
+        {
+            // start-end perms offset device inode [path]
+            std::istringstream fields(line);
+            std::string range, perms, offset, device, inode, path;
+            fields >> range >> perms >> offset >> device >> inode >> path;
+            auto dash = range.find('-');
+            if (perms.size() < 3 || perms[2] != 'x' || !path.empty() || dash == std::string::npos)
+            {
+                continue;
+            }
+            res += static_cast<std::size_t>(std::stoull(range.substr(dash + 1), nullptr, 16) -
+                                            std::stoull(range.substr(0, dash), nullptr, 16));
+        }
+        return res;
+#else
+        return 0;
+#endif
+    }
+
+    /**
+     * Returns the number of threads of the kernel process, or 0 if it cannot
+     * be determined on this platform.
+     */
+    inline std::size_t thread_count()
+    {
+#if defined(__linux__)
+        std::ifstream status("/proc/self/status");
+        std::string line;
+        while (std::getline(status, line))
+        {
+            if (line.compare(0, 8, "Threads:") == 0)
+            {
+                return static_cast<std::size_t>(std::stoull(line.substr(8)));
+            }
+        }
+        return 0;
+#else
+        return 0;
+#endif
+    }
+
+    /**
+     * Hands free heap pages back to the operating system where the allocator
+     * supports it, so that resident_memory reflects what was released.
+     */
+    inline void release_free_memory()
+    {
+#if defined(__GLIBC__)
+        malloc_trim(0);
+#endif
+    }
+
+    inline std::string format_memory(double bytes)
+    {
+        const char* units[] = {"B", "kB", "MB", "GB", "TB"};
+        std::size_t unit = 0;
+        double value = bytes < 0 ? -bytes : bytes;
+        while (value >= 1024. && unit < 4)
+        {
+            value /= 1024.;
+            ++unit;
+        }
+        std::ostringstream output;
+        output.precision(value < 10. ? 2 : 1);
+        output << std::fixed << (bytes < 0 ? -value : value) << " " << units[unit];
+        return output.str();
+    }
+}
+
+#endif
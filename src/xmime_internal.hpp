@@ -170,6 +170,17 @@ namespace xcpp
         }
     }
 
+    namespace cling_detail
+    {
+        // Whether "xcpp/xmime.hpp" was declared in the current interpreter.
+        // Cleared when the interpreter is rebuilt by %reset.
+        inline bool& xmime_included()
+        {
+            static bool included = false;
+            return included;
+        }
+    }
+
     inline nl::json mime_repr(const cling::Value& V)
     {
         // Return a JSON mime bundle representing the specified value.
@@ -178,38 +189,45 @@ namespace xcpp
         const void* value = V.getPtr();
 
         // Include "xmime.hpp" only on the first time a variable is displayed.
-        static bool xmime_included = false;
-
-        if (!xmime_included)
+        if (!cling_detail::xmime_included())
         {
             cling_detail::LockCompilationDuringUserCodeExecutionRAII LCDUCER(*interpreter);
             interpreter->declare("#include \"xcpp/xmime.hpp\"");
-            xmime_included = true;
+            cling_detail::xmime_included() = true;
         }
 
-        cling::Value mimeReprV;
+        nl::json res = nl::json::object();
+        cling::Transaction* transaction = nullptr;
         {
-            // Use an llvm::raw_ostream to prepend '0x' in front of the pointer value.
-            cling::ostrstream code;
-            code << "using xcpp::mime_bundle_repr;";
-            code << "mime_bundle_repr(";
-            code << "*(" << xcpp::cling_detail::getTypeString(V);
-            code << &value;
-            code << "));";
-
-            cling_detail::AccessCtrlRAII_t AccessCtrlRAII(*interpreter);
-            cling_detail::LockCompilationDuringUserCodeExecutionRAII LCDUCER(*interpreter);
-            interpreter->process(code.str(), &mimeReprV);
-        }
+            cling::Value mimeReprV;
+            {
+                // Use an llvm::raw_ostream to prepend '0x' in front of the pointer value.
+                cling::ostrstream code;
+                code << "using xcpp::mime_bundle_repr;";
+                code << "mime_bundle_repr(";
+                code << "*(" << xcpp::cling_detail::getTypeString(V);
+                code << &value;
+                code << "));";
+
+                cling_detail::AccessCtrlRAII_t AccessCtrlRAII(*interpreter);
+                cling_detail::LockCompilationDuringUserCodeExecutionRAII LCDUCER(*interpreter);
+                interpreter->process(code.str(), &mimeReprV, &transaction);
+            }
 
-        if (mimeReprV.isValid() && mimeReprV.getPtr())
-        {
-            return *(nl::json*)mimeReprV.getPtr();
+            if (mimeReprV.isValid() && mimeReprV.getPtr())
+            {
+                res = *(nl::json*)mimeReprV.getPtr();
+            }
         }
-        else
+
+        // The call is only compiled for this display. Once the returned bundle
+        // is destroyed, it is unloaded so that displays do not pile up in the
+        // JIT, unless something was compiled after it in the meantime.
+        if (transaction != nullptr && interpreter->getLastTransaction() == transaction)
         {
-            return nl::json::object();
+            interpreter->unload(*transaction);
         }
+        return res;
     }
 }
 
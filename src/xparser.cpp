@@ -8,8 +8,10 @@
 ************************************************************************************/
 
 #include <algorithm>
+#include <cctype>
 #include <iostream>
 #include <regex>
+#include <set>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -40,6 +42,19 @@ namespace xcpp
         return result;
     }
 
+    std::string clean_completion(const std::string& completion)
+    {
+        // remove the definition at the beginning (for example [#int#])
+        std::string res = std::regex_replace(completion, std::regex("\\[\\#.*\\#\\]"), "");
+        // remove the variable name in <#type name#>
+        res = std::regex_replace(res, std::regex("(\\ |\\*)+(\\w+)(\\#\\>)"), "$1$3");
+        // remove unnecessary space at the end of <#type   #>
+        res = std::regex_replace(res, std::regex("\\ *(\\#\\>)"), "$1");
+        // remove <# #> to keep only the type
+        res = std::regex_replace(res, std::regex("\\<\\#([^#>]*)\\#\\>"), "$1");
+        return res;
+    }
+
     std::vector<std::string> get_lines(const std::string& input)
     {
         std::vector<std::string> lines;
@@ -183,4 +198,195 @@ namespace xcpp
         }
         return map_opts;
     }
+
+    namespace
+    {
+        bool is_identifier_start(char c)
+        {
+            return std::isalpha(static_cast<unsigned char>(c)) || c == '_';
+        }
+
+        bool is_identifier_char(char c)
+        {
+            return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+        }
+
+        std::size_t skip_literal(const std::string& code, std::size_t i)
+        {
+            char quote = code[i++];
+            while (i < code.size() && code[i] != quote && code[i] != '\n')
+            {
+                i += code[i] == '\\' ? 2 : 1;
+            }
+            return i + 1;
+        }
+
+        std::size_t skip_raw_literal(const std::string& code, std::size_t i)
+        {
+            // R"delimiter( ... )delimiter"
+            std::size_t open = code.find('(', i);
+            if (open == std::string::npos)
+            {
+                return code.size();
+            }
+            std::string end = ")" + code.substr(i + 1, open - i - 1) + "\"";
+            std::size_t close = code.find(end, open);
+            return close == std::string::npos ? code.size() : close + end.size();
+        }
+
+        // Tokens of the code with their nesting depth in braces and
+        // parentheses. Comments, literals and preprocessor directives are
+        // skipped.
+        struct token
+        {
+            std::string text;
+            int depth;
+        };
+
+        std::vector<token> tokenize(const std::string& code)
+        {
+            std::vector<token> res;
+            int depth = 0;
+            bool line_start = true;
+            std::size_t i = 0;
+            while (i < code.size())
+            {
+                char c = code[i];
+                if (c == '\n')
+                {
+                    line_start = true;
+                    ++i;
+                }
+                else if (std::isspace(static_cast<unsigned char>(c)))
+                {
+                    ++i;
+                }
+                else if (line_start && c == '#')
+                {
+                    // Up to the end of the line, continuations included.
+                    while (i < code.size() && (code[i] != '\n' || code[i - 1] == '\\'))
+                    {
+                        ++i;
+                    }
+                }
+                else if (code.compare(i, 2, "//") == 0)
+                {
+                    i = code.find('\n', i);
+                    i = i == std::string::npos ? code.size() : i;
+                }
+                else if (code.compare(i, 2, "/*") == 0)
+                {
+                    i = code.find("*/", i + 2);
+                    i = i == std::string::npos ? code.size() : i + 2;
+                }
+                else if (c == '"' || c == '\'')
+                {
+                    line_start = false;
+                    i = skip_literal(code, i);
+                    res.push_back({"\"", depth});
+                }
+                else if (is_identifier_start(c))
+                {
+                    line_start = false;
+                    std::size_t begin = i;
+                    while (i < code.size() && is_identifier_char(code[i]))
+                    {
+                        ++i;
+                    }
+                    std::string word = code.substr(begin, i - begin);
+                    if (i < code.size() && code[i] == '"' && !word.empty() && word.back() == 'R')
+                    {
+                        i = skip_raw_literal(code, i);
+                        res.push_back({"\"", depth});
+                    }
+                    else if (i < code.size() && (code[i] == '"' || code[i] == '\'') &&
+                             (word == "u8" || word == "u" || word == "U" || word == "L"))
+                    {
+                        i = skip_literal(code, i);
+                        res.push_back({"\"", depth});
+                    }
+                    else
+                    {
+                        res.push_back({std::move(word), depth});
+                    }
+                }
+                else if (std::isdigit(static_cast<unsigned char>(c)))
+                {
+                    line_start = false;
+                    while (i < code.size() && (is_identifier_char(code[i]) || code[i] == '.' || code[i] == '\''))
+                    {
+                        ++i;
+                    }
+                    res.push_back({"0", depth});
+                }
+                else
+                {
+                    line_start = false;
+                    std::size_t size = code.compare(i, 2, "::") == 0 || code.compare(i, 2, "&&") == 0 ? 2 : 1;
+                    if (c == '}' || c == ')')
+                    {
+                        --depth;
+                    }
+                    res.push_back({code.substr(i, size), depth});
+                    if (c == '{' || c == '(')
+                    {
+                        ++depth;
+                    }
+                    i += size;
+                }
+            }
+            return res;
+        }
+    }
+
+    std::set<std::string> declared_names(const std::string& code)
+    {
+        // Keywords that may precede a declared name.
+        static const std::set<std::string> type_keywords = {
+            "auto", "bool", "char", "char16_t", "char32_t", "class", "const", "double", "enum", "float",
+            "int", "long", "namespace", "short", "signed", "struct", "union", "unsigned", "using",
+            "void", "volatile", "wchar_t"
+        };
+        // Keywords that never do, nor are declared.
+        static const std::set<std::string> keywords = {
+            "alignas", "alignof", "and", "asm", "break", "case", "catch", "const_cast", "constexpr",
+            "continue", "decltype", "default", "delete", "do", "dynamic_cast", "else", "explicit",
+            "export", "extern", "false", "for", "friend", "goto", "if", "inline", "mutable", "new",
+            "noexcept", "not", "nullptr", "operator", "or", "private", "protected", "public",
+            "register", "reinterpret_cast", "return", "sizeof", "static", "static_assert",
+            "static_cast", "switch", "template", "this", "thread_local", "throw", "true", "try",
+            "typedef", "typeid", "typename", "virtual", "while"
+        };
+        static const std::set<std::string> followers = {"=", ";", "(", "{", "[", ","};
+
+        auto is_name = [](const token& t)
+        {
+            return is_identifier_start(t.text[0]) && !keywords.count(t.text) && !type_keywords.count(t.text);
+        };
+        auto is_type_end = [&is_name](const token& t)
+        {
+            return is_name(t) || type_keywords.count(t.text) || t.text == ">";
+        };
+
+        std::vector<token> tokens = tokenize(code);
+        std::set<std::string> res;
+        for (std::size_t i = 1; i + 1 < tokens.size(); ++i)
+        {
+            if (tokens[i].depth != 0 || !is_name(tokens[i]) || !followers.count(tokens[i + 1].text))
+            {
+                continue;
+            }
+            // Pointers and references: the type is before the declarators.
+            std::size_t type = i - 1;
+            while (type > 0 && (tokens[type].text == "*" || tokens[type].text == "&" || tokens[type].text == "&&"))
+            {
+                --type;
+            }
+            if (is_type_end(tokens[type]) && (type == 0 || tokens[type - 1].text != "."))
+            {
+                res.insert(tokens[i].text);
+            }
+        }
+        return res;
+    }
 }
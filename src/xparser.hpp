@@ -11,6 +11,7 @@
 #define XCPP_PARSER_HPP
 
 #include <map>
+#include <set>
 #include <string>
 #include <vector>
 
@@ -18,6 +19,10 @@ namespace xcpp
 {
     std::vector<std::string> split_line(const std::string& input, const std::string& delims, std::size_t cursor_pos);
 
+    // Turns a completion result of cling, such as "[#int#]size()" or
+    // "push_back(<#const int &value#>)", into the text shown in the notebook.
+    std::string clean_completion(const std::string& completion);
+
     std::vector<std::string> get_lines(const std::string& input);
 
     std::vector<std::string> split_from_includes(const std::string& input);
@@ -28,6 +33,11 @@ namespace xcpp
 
     std::string trim(std::string const& str);
 
+    // Names that the code declares at the top level, found from the tokens
+    // rather than compiled: a name followed by an initializer, a parameter
+    // list, a body or a semicolon, and preceded by a type.
+    std::set<std::string> declared_names(const std::string& code);
+
     std::map<std::string, std::string> parse_opts(std::string& line, const std::string& opts);
 }
 #endif
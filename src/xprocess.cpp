@@ -0,0 +1,245 @@
+/***********************************************************************************
+* Copyright (c) 2016, Johan Mabille, Loic Gouarin, Sylvain Corlay, Wolf Vollprecht *
+* Copyright (c) 2016, QuantStack                                                   *
+*                                                                                  *
+* Distributed under the terms of the BSD 3-Clause License.                         *
+*                                                                                  *
+* The full license is in the file LICENSE, distributed with this software.         *
+************************************************************************************/
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+#endif
+
+#include "xprocess.hpp"
+
+namespace xcpp
+{
+#if defined(_WIN32)
+
+    int run_process(const std::vector<std::string>& /*args*/,
+                    const output_callback& /*on_stdout*/,
+                    const output_callback& /*on_stderr*/,
+                    process_usage* /*usage*/,
+                    const std::vector<std::string>& /*env*/,
+                    bool /*interruptible*/)
+    {
+        std::cerr << "Running processes is not supported on Windows" << std::endl;
+        return -1;
+    }
+
+#else
+
+    namespace
+    {
+        double to_seconds(const timeval& tv)
+        {
+            return static_cast<double>(tv.tv_sec) + 1e-6 * static_cast<double>(tv.tv_usec);
+        }
+
+        // Process group of the program the interrupts of the kernel are
+        // forwarded to, 0 when none is running.
+        volatile std::sig_atomic_t interrupted_group = 0;
+
+        void forward_interrupt(int sig)
+        {
+            if (interrupted_group != 0)
+            {
+                kill(-static_cast<pid_t>(interrupted_group), sig);
+            }
+        }
+
+        bool make_pipe(int fds[2])
+        {
+            if (pipe(fds) != 0)
+            {
+                return false;
+            }
+            fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+            fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+            return true;
+        }
+    }
+
+    int run_process(const std::vector<std::string>& args,
+                    const output_callback& on_stdout,
+                    const output_callback& on_stderr,
+                    process_usage* usage,
+                    const std::vector<std::string>& env,
+                    bool interruptible)
+    {
+        if (args.empty())
+        {
+            return -1;
+        }
+
+        std::vector<char*> argv;
+        for (const auto& arg : args)
+        {
+            argv.push_back(const_cast<char*>(arg.c_str()));
+        }
+        argv.push_back(nullptr);
+
+        // The requested entries replace the variables of the same name that
+        // the kernel inherited.
+        std::vector<char*> envp;
+        for (char** e = environ; *e != nullptr; ++e)
+        {
+            std::size_t length = std::strcspn(*e, "=");
+            bool replaced = std::any_of(env.begin(), env.end(), [&](const std::string& entry)
+            {
+                return entry.compare(0, length, *e, length) == 0 && entry.size() > length && entry[length] == '=';
+            });
+            if (!replaced)
+            {
+                envp.push_back(*e);
+            }
+        }
+        for (const auto& entry : env)
+        {
+            envp.push_back(const_cast<char*>(entry.c_str()));
+        }
+        envp.push_back(nullptr);
+
+        int out[2], err[2];
+        if (!make_pipe(out))
+        {
+            return -1;
+        }
+        if (!make_pipe(err))
+        {
+            close(out[0]);
+            close(out[1]);
+            return -1;
+        }
+
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+        posix_spawn_file_actions_adddup2(&actions, out[1], STDOUT_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, err[1], STDERR_FILENO);
+
+        posix_spawnattr_t attributes;
+        posix_spawnattr_init(&attributes);
+        if (interruptible)
+        {
+            posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETPGROUP);
+            posix_spawnattr_setpgroup(&attributes, 0);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        pid_t pid;
+        int spawned = posix_spawnp(&pid, argv[0], &actions, &attributes, argv.data(), envp.data());
+        posix_spawn_file_actions_destroy(&actions);
+        posix_spawnattr_destroy(&attributes);
+        close(out[1]);
+        close(err[1]);
+        if (spawned != 0)
+        {
+            close(out[0]);
+            close(err[0]);
+            std::cerr << "Could not run " << args[0] << ": " << std::strerror(spawned) << std::endl;
+            return -1;
+        }
+
+        struct sigaction previous_action;
+        if (interruptible)
+        {
+            interrupted_group = pid;
+            struct sigaction action;
+            action.sa_handler = forward_interrupt;
+            action.sa_flags = 0;
+            sigemptyset(&action.sa_mask);
+            sigaction(SIGINT, &action, &previous_action);
+        }
+
+        // Forward the output as it comes, in large chunks.
+        std::vector<char> buffer(1 << 16);
+        pollfd fds[2] = {{out[0], POLLIN, 0}, {err[0], POLLIN, 0}};
+        int open_fds = 2;
+        while (open_fds > 0)
+        {
+            if (poll(fds, 2, -1) < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                break;
+            }
+            for (int i = 0; i < 2; ++i)
+            {
+                if (fds[i].fd < 0 || fds[i].revents == 0)
+                {
+                    continue;
+                }
+                ssize_t size = read(fds[i].fd, buffer.data(), buffer.size());
+                if (size > 0)
+                {
+                    (i == 0 ? on_stdout : on_stderr)(buffer.data(), static_cast<std::size_t>(size));
+                }
+                else if (size == 0 || errno != EINTR)
+                {
+                    close(fds[i].fd);
+                    fds[i].fd = -1;
+                    --open_fds;
+                }
+            }
+        }
+        for (const auto& fd : fds)
+        {
+            if (fd.fd >= 0)
+            {
+                close(fd.fd);
+            }
+        }
+
+        int status = 0;
+        rusage resources = {};
+        while (wait4(pid, &status, 0, &resources) < 0 && errno == EINTR)
+        {
+        }
+        if (interruptible)
+        {
+            sigaction(SIGINT, &previous_action, nullptr);
+            interrupted_group = 0;
+        }
+        if (usage != nullptr)
+        {
+            usage->wall_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            usage->user_time = to_seconds(resources.ru_utime);
+            usage->system_time = to_seconds(resources.ru_stime);
+#if defined(__APPLE__)
+            usage->max_rss = static_cast<std::size_t>(resources.ru_maxrss);
+#else
+            usage->max_rss = static_cast<std::size_t>(resources.ru_maxrss) * 1024;
+#endif
+        }
+
+        if (WIFSIGNALED(status))
+        {
+            return 128 + WTERMSIG(status);
+        }
+        return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    }
+
+#endif
+}
@@ -0,0 +1,50 @@
+/***********************************************************************************
+* Copyright (c) 2016, Johan Mabille, Loic Gouarin, Sylvain Corlay, Wolf Vollprecht *
+* Copyright (c) 2016, QuantStack                                                   *
+*                                                                                  *
+* Distributed under the terms of the BSD 3-Clause License.                         *
+*                                                                                  *
+* The full license is in the file LICENSE, distributed with this software.         *
+************************************************************************************/
+
+#ifndef XCPP_PROCESS_HPP
+#define XCPP_PROCESS_HPP
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace xcpp
+{
+    struct process_usage
+    {
+        double wall_time = 0.;
+        double user_time = 0.;
+        double system_time = 0.;
+        // Peak resident set size in bytes.
+        std::size_t max_rss = 0;
+    };
+
+    using output_callback = std::function<void(const char* data, std::size_t size)>;
+
+    /**
+     * Runs a program, looked up in the PATH if it has no slash, and forwards
+     * its standard output and error to the callbacks as they are produced.
+     * env holds NAME=value entries added to the environment of the kernel,
+     * replacing the variables of the same name.
+     * If interruptible is true, the program runs in its own process group,
+     * which the interrupts received by the kernel are forwarded to until the
+     * program exits.
+     * Returns the exit status of the program, 128 + the signal number if it
+     * was killed, or -1 if it could not be started.
+     */
+    int run_process(const std::vector<std::string>& args,
+                    const output_callback& on_stdout,
+                    const output_callback& on_stderr,
+                    process_usage* usage = nullptr,
+                    const std::vector<std::string>& env = {},
+                    bool interruptible = false);
+}
+
+#endif
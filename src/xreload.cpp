@@ -0,0 +1,308 @@
+/***********************************************************************************
+* Copyright (c) 2016, Johan Mabille, Loic Gouarin, Sylvain Corlay, Wolf Vollprecht *
+* Copyright (c) 2016, QuantStack                                                   *
+*                                                                                  *
+* Distributed under the terms of the BSD 3-Clause License.                         *
+*                                                                                  *
+* The full license is in the file LICENSE, distributed with this software.         *
+************************************************************************************/
+
+#include <algorithm>
+#include <cstddef>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/Chrono.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "clang/Basic/SourceManager.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Lex/PPCallbacks.h"
+#include "clang/Lex/Preprocessor.h"
+#include "cling/Interpreter/Exception.h"
+#include "cling/Interpreter/InterpreterCallbacks.h"
+
+#include "xparser.hpp"
+#include "xreload.hpp"
+
+namespace xcpp
+{
+    bool is_include_block(const std::string& block)
+    {
+        return trim(block).compare(0, 8, "#include") == 0;
+    }
+
+    namespace
+    {
+        struct header
+        {
+            std::string path;
+            llvm::sys::TimePoint<> modification_time;
+            std::string hash;
+        };
+
+        bool file_hash(const std::string& path, std::string& hash)
+        {
+            auto buffer = llvm::MemoryBuffer::getFile(path);
+            if (!buffer)
+            {
+                return false;
+            }
+            llvm::MD5 md5;
+            md5.update(buffer.get()->getBuffer());
+            llvm::MD5::MD5Result digest;
+            md5.final(digest);
+            llvm::SmallString<32> res;
+            llvm::MD5::stringifyResult(digest, res);
+            hash = res.str().str();
+            return true;
+        }
+    }
+
+    class reload_state
+    {
+    public:
+
+        struct include_block
+        {
+            std::string code;
+            // Null if the block failed to compile: it is processed again
+            // once its headers change.
+            const cling::Transaction* transaction;
+            std::vector<header> headers;
+        };
+
+        bool recording = false;
+        std::set<std::string> entered;
+        std::vector<include_block> blocks;
+
+        // Set by header_reloader::modified.
+        std::size_t first_modified = 0;
+        std::vector<std::string> modified_headers;
+    };
+
+    namespace
+    {
+        class header_callbacks : public clang::PPCallbacks
+        {
+        public:
+
+            header_callbacks(clang::SourceManager& sm, std::shared_ptr<reload_state> state)
+                : m_source_manager(sm), p_state(std::move(state))
+            {
+            }
+
+            void FileChanged(clang::SourceLocation loc, FileChangeReason reason,
+                             clang::SrcMgr::CharacteristicKind kind, clang::FileID) override
+            {
+                // Headers found in the system include directories do not
+                // change while a notebook is developed.
+                if (!p_state->recording || reason != EnterFile || kind != clang::SrcMgr::C_User)
+                {
+                    return;
+                }
+                clang::FileID id = m_source_manager.getFileID(m_source_manager.getExpansionLoc(loc));
+                const clang::FileEntry* entry = m_source_manager.getFileEntryForID(id);
+                if (entry != nullptr)
+                {
+                    llvm::SmallString<256> path(entry->getName());
+                    llvm::sys::fs::make_absolute(path);
+                    p_state->entered.insert(path.str().str());
+                }
+            }
+
+        private:
+
+            clang::SourceManager& m_source_manager;
+            std::shared_ptr<reload_state> p_state;
+        };
+
+        // Forgets the blocks whose transaction was unloaded, by the cells
+        // run again or by the magics, since cling recycles transactions.
+        class unload_callbacks : public cling::InterpreterCallbacks
+        {
+        public:
+
+            unload_callbacks(cling::Interpreter* interpreter, std::shared_ptr<reload_state> state)
+                : cling::InterpreterCallbacks(interpreter), p_state(std::move(state))
+            {
+            }
+
+            void TransactionUnloaded(const cling::Transaction& t) override
+            {
+                auto& blocks = p_state->blocks;
+                blocks.erase(std::remove_if(blocks.begin(), blocks.end(),
+                                            [&t](const reload_state::include_block& b)
+                                            {
+                                                return b.transaction == &t;
+                                            }),
+                             blocks.end());
+            }
+
+        private:
+
+            std::shared_ptr<reload_state> p_state;
+        };
+    }
+
+    header_reloader::header_reloader(cling::Interpreter& interpreter)
+        : m_interpreter(interpreter), p_state(std::make_shared<reload_state>())
+    {
+        clang::Preprocessor& pp = m_interpreter.getCI()->getPreprocessor();
+        pp.addPPCallbacks(std::make_unique<header_callbacks>(pp.getSourceManager(), p_state));
+        m_interpreter.setCallbacks(std::make_unique<unload_callbacks>(&m_interpreter, p_state));
+    }
+
+    void header_reloader::begin_include()
+    {
+        p_state->entered.clear();
+        p_state->recording = true;
+    }
+
+    void header_reloader::end_include(const std::string& block, const cling::Transaction* transaction)
+    {
+        p_state->recording = false;
+        std::set<std::string> entered;
+        entered.swap(p_state->entered);
+
+        std::vector<header> headers;
+        for (const auto& path : entered)
+        {
+            llvm::sys::fs::file_status status;
+            header h;
+            h.path = path;
+            // Skips the buffers that are not files, such as the input lines.
+            if (llvm::sys::fs::status(path, status) || !llvm::sys::fs::is_regular_file(status) ||
+                !file_hash(path, h.hash))
+            {
+                continue;
+            }
+            h.modification_time = status.getLastModificationTime();
+            headers.push_back(std::move(h));
+        }
+        if (!headers.empty())
+        {
+            p_state->blocks.push_back({block, transaction, std::move(headers)});
+        }
+    }
+
+    bool header_reloader::modified()
+    {
+        auto& blocks = p_state->blocks;
+        p_state->modified_headers.clear();
+        p_state->first_modified = blocks.size();
+        for (std::size_t i = 0; i < blocks.size(); ++i)
+        {
+            for (auto& h : blocks[i].headers)
+            {
+                llvm::sys::fs::file_status status;
+                if (llvm::sys::fs::status(h.path, status) ||
+                    status.getLastModificationTime() == h.modification_time)
+                {
+                    continue;
+                }
+                // Touching a header without changing it does not reload it.
+                std::string hash;
+                if (file_hash(h.path, hash) && hash == h.hash)
+                {
+                    h.modification_time = status.getLastModificationTime();
+                    continue;
+                }
+                p_state->first_modified = std::min(p_state->first_modified, i);
+                if (std::find(p_state->modified_headers.begin(), p_state->modified_headers.end(), h.path) ==
+                    p_state->modified_headers.end())
+                {
+                    p_state->modified_headers.push_back(h.path);
+                }
+            }
+        }
+        return p_state->first_modified != blocks.size();
+    }
+
+    void header_reloader::reload()
+    {
+        auto& blocks = p_state->blocks;
+        if (p_state->first_modified >= blocks.size())
+        {
+            return;
+        }
+        std::vector<reload_state::include_block> reloaded(blocks.begin() + static_cast<std::ptrdiff_t>(p_state->first_modified),
+                                                          blocks.end());
+        blocks.erase(blocks.begin() + static_cast<std::ptrdiff_t>(p_state->first_modified), blocks.end());
+
+        // Only the last transaction can be unloaded: the ones declared after
+        // the first block go first, since they may depend on the headers.
+        auto loaded = std::find_if(reloaded.begin(), reloaded.end(),
+                                   [](const reload_state::include_block& b) { return b.transaction != nullptr; });
+        std::size_t later = 0;
+        if (loaded != reloaded.end())
+        {
+            const cling::Transaction* first = loaded->transaction;
+            while (m_interpreter.getLastTransaction() != first)
+            {
+                m_interpreter.unload(*const_cast<cling::Transaction*>(m_interpreter.getLastTransaction()));
+                ++later;
+            }
+            m_interpreter.unload(*const_cast<cling::Transaction*>(first));
+            later -= static_cast<std::size_t>(std::count_if(loaded + 1, reloaded.end(),
+                                                            [](const reload_state::include_block& b)
+                                                            {
+                                                                return b.transaction != nullptr;
+                                                            }));
+        }
+
+        std::size_t failures = 0;
+        for (const auto& b : reloaded)
+        {
+            begin_include();
+            cling::Transaction* transaction = nullptr;
+            auto compilation_result = cling::Interpreter::kFailure;
+            try
+            {
+                compilation_result = m_interpreter.process(b.code, nullptr, &transaction, true);
+            }
+            catch (cling::InterpreterException& e)
+            {
+                if (!e.diagnose())
+                {
+                    std::cerr << "Interpreter Exception: " << e.what() << std::endl;
+                }
+            }
+            catch (std::exception& e)
+            {
+                std::cerr << "Standard Exception: " << e.what() << std::endl;
+            }
+            bool success = compilation_result == cling::Interpreter::kSuccess;
+            end_include(b.code, success ? transaction : nullptr);
+            if (!success)
+            {
+                ++failures;
+            }
+        }
+
+        std::cout << "Reloaded";
+        for (const auto& path : p_state->modified_headers)
+        {
+            std::cout << " " << path;
+        }
+        std::cout << ": " << reloaded.size() << " include blocks processed again";
+        if (later != 0)
+        {
+            std::cout << ", " << later << " transactions declared after them were unloaded, "
+                      << "run the cells using the headers again";
+        }
+        std::cout << std::endl;
+        if (failures != 0)
+        {
+            std::cerr << failures << " include blocks failed to compile, "
+                      << "they are processed again when the headers change" << std::endl;
+        }
+    }
+}
@@ -0,0 +1,61 @@
+/***********************************************************************************
+* Copyright (c) 2016, Johan Mabille, Loic Gouarin, Sylvain Corlay, Wolf Vollprecht *
+* Copyright (c) 2016, QuantStack                                                   *
+*                                                                                  *
+* Distributed under the terms of the BSD 3-Clause License.                         *
+*                                                                                  *
+* The full license is in the file LICENSE, distributed with this software.         *
+************************************************************************************/
+
+#ifndef XCPP_RELOAD_HPP
+#define XCPP_RELOAD_HPP
+
+#include <memory>
+#include <string>
+
+#include "cling/Interpreter/Interpreter.h"
+#include "cling/Interpreter/Transaction.h"
+
+namespace xcpp
+{
+    // Whether a block of a cell only holds #include directives.
+    bool is_include_block(const std::string& block);
+
+    class reload_state;
+
+    /**
+     * Records the local headers, as opposed to the system ones, pulled in by
+     * the include blocks of the cells, with their modification times. When
+     * one of them changes, the include block that first pulled it in is
+     * unloaded along with all the transactions after it, since they may
+     * depend on it, and the include blocks are processed again.
+     */
+    class header_reloader
+    {
+    public:
+
+        header_reloader(cling::Interpreter& interpreter);
+
+        // Records the headers entered by the preprocessor until end_include,
+        // which is passed the include block and its transaction, null if it
+        // failed to compile.
+        void begin_include();
+        void end_include(const std::string& block, const cling::Transaction* transaction);
+
+        // Whether a recorded header changed since it was included.
+        bool modified();
+
+        // Unloads and includes again the blocks depending on the modified
+        // headers, and reports what was reloaded on std::cout.
+        void reload();
+
+    private:
+
+        cling::Interpreter& m_interpreter;
+        // Shared with the callbacks of the interpreter, which outlive the
+        // reloader if the interpreter is kept.
+        std::shared_ptr<reload_state> p_state;
+    };
+}
+
+#endif
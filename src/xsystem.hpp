@@ -10,12 +10,127 @@
 #ifndef XCPP_SYSTEM_HPP
 #define XCPP_SYSTEM_HPP
 
+#include <cstddef>
 #include <cstdio>
+#include <iostream>
+#include <regex>
+#include <string>
 
 #include "xeus-cling/xpreamble.hpp"
 
+#include "xprocess.hpp"
+
 namespace xcpp
 {
+    /**
+     * Splits the output of a command into valid UTF-8 text, which is all the
+     * messages can carry: a character cut at the end of a chunk is completed
+     * with the next one, and invalid bytes are replaced with U+FFFD.
+     */
+    class xutf8_stream
+    {
+    public:
+
+        xutf8_stream(std::ostream& os)
+            : m_os(os)
+        {
+        }
+
+        void write(const char* data, std::size_t size)
+        {
+            m_pending.append(data, size);
+            std::size_t i = 0;
+            std::string text;
+            text.reserve(m_pending.size());
+            while (i < m_pending.size())
+            {
+                std::size_t length = sequence_length(i);
+                if (length == 0)
+                {
+                    break;
+                }
+                if (length == invalid)
+                {
+                    text += replacement;
+                    ++i;
+                }
+                else
+                {
+                    text.append(m_pending, i, length);
+                    i += length;
+                }
+            }
+            m_pending.erase(0, i);
+            // Flushing publishes the chunk as a single stream message.
+            m_os << text << std::flush;
+        }
+
+        void close()
+        {
+            if (!m_pending.empty())
+            {
+                m_pending.clear();
+                m_os << replacement << std::flush;
+            }
+        }
+
+    private:
+
+        static constexpr std::size_t invalid = static_cast<std::size_t>(-1);
+        static constexpr const char* replacement = "\xEF\xBF\xBD";
+
+        // Length of the sequence starting at i, 0 if it is incomplete, or
+        // invalid.
+        std::size_t sequence_length(std::size_t i) const
+        {
+            auto byte = [this](std::size_t j) { return static_cast<unsigned char>(m_pending[j]); };
+            unsigned char c = byte(i);
+            std::size_t length;
+            unsigned char low = 0x80, high = 0xBF;
+            if (c < 0x80)
+            {
+                return 1;
+            }
+            else if (c >= 0xC2 && c <= 0xDF)
+            {
+                length = 2;
+            }
+            else if (c >= 0xE0 && c <= 0xEF)
+            {
+                length = 3;
+                // No overlong encodings nor surrogates.
+                low = c == 0xE0 ? 0xA0 : 0x80;
+                high = c == 0xED ? 0x9F : 0xBF;
+            }
+            else if (c >= 0xF0 && c <= 0xF4)
+            {
+                length = 4;
+                low = c == 0xF0 ? 0x90 : 0x80;
+                high = c == 0xF4 ? 0x8F : 0xBF;
+            }
+            else
+            {
+                return invalid;
+            }
+            for (std::size_t j = 1; j < length; ++j)
+            {
+                if (i + j == m_pending.size())
+                {
+                    return 0;
+                }
+                unsigned char b = byte(i + j);
+                if (j == 1 ? (b < low || b > high) : (b < 0x80 || b > 0xBF))
+                {
+                    return invalid;
+                }
+            }
+            return length;
+        }
+
+        std::ostream& m_os;
+        std::string m_pending;
+    };
+
     struct xsystem : xpreamble
     {
         const std::string spattern = R"(^\!)";
@@ -32,37 +147,44 @@ namespace xcpp
             std::smatch to_execute;
             std::regex_search(code, to_execute, re);
 
-            int ret = 1;
-
+#if defined(WIN32)
             // Redirection of stderr to stdout
             std::string command = to_execute.str(1) + " 2>&1";
-
-#if defined(WIN32)
+            int ret = -1;
             FILE* shell_result = _popen(command.c_str(), "r");
-#else
-            FILE* shell_result = popen(command.c_str(), "r");
-#endif
             if (shell_result)
             {
                 char buff[512];
-                ret = 0;
                 while (fgets(buff, sizeof(buff), shell_result))
                 {
                     std::cout << buff;
                 }
-#if defined(WIN32)
-                _pclose(shell_result);
+                ret = _pclose(shell_result);
+                std::cout << std::flush;
+            }
 #else
-                pclose(shell_result);
+            // The command runs in its own process group, so that interrupting
+            // the kernel stops it with all its children.
+            xutf8_stream out(std::cout), err(std::cerr);
+            int ret = run_process({"/bin/sh", "-c", to_execute.str(1)},
+                                  [&out](const char* data, std::size_t size) { out.write(data, size); },
+                                  [&err](const char* data, std::size_t size) { err.write(data, size); },
+                                  nullptr, {}, true);
+            out.close();
+            err.close();
 #endif
 
-                std::cout << std::flush;
+            if (ret >= 0)
+            {
                 kernel_res["status"] = "ok";
+                kernel_res["payload"] = nl::json::array();
+                kernel_res["user_expressions"] = nl::json::object();
+                kernel_res["metadata"]["exit_status"] = ret;
             }
             else
             {
                 std::cerr << "Unable to execute the shell command\n";
-                std::cout << std::flush;
+                std::cerr << std::flush;
                 kernel_res["status"] = "error";
                 kernel_res["ename"] = "ename";
                 kernel_res["evalue"] = "evalue";
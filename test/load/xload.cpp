@@ -0,0 +1,823 @@
+/***********************************************************************************
+* Copyright (c) 2016, Johan Mabille, Loic Gouarin, Sylvain Corlay, Wolf Vollprecht *
+* Copyright (c) 2016, QuantStack                                                   *
+*                                                                                  *
+* Distributed under the terms of the BSD 3-Clause License.                         *
+*                                                                                  *
+* The full license is in the file LICENSE, distributed with this software.         *
+************************************************************************************/
+
+// Load and latency harness: replays a recorded session against a running
+// kernel through the Jupyter protocol, and reports the latency of the
+// requests, the throughput of IOPub and the memory growth of the kernel.
+// See docs/source/performance.rst.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+
+#include "nlohmann/json.hpp"
+#include "zmq.hpp"
+#include "zmq_addon.hpp"
+
+namespace nl = nlohmann;
+
+extern char** environ;
+
+namespace
+{
+    using clock_type = std::chrono::steady_clock;
+
+    const char* usage =
+        "Usage: test_xeus_cling_load --session FILE [options]\n"
+        "\n"
+        "  --session FILE         recorded session, one request per line\n"
+        "  --connection-file FILE connect to a running kernel\n"
+        "  --pid PID              process of the running kernel, for the memory growth\n"
+        "  --kernel CMD           start the kernel with CMD, '{connection_file}' being\n"
+        "                         replaced (default: 'xcpp -f {connection_file}')\n"
+        "  --concurrency N        number of clients replaying the session (default: 1)\n"
+        "  --repeat N             number of replays by each client (default: 1)\n"
+        "  --rate R               requests per second of each client, 0 for no pause\n"
+        "                         between requests (default: 0)\n"
+        "  --timeout S            time to wait for a reply in seconds (default: 60)\n"
+        "  --output FILE          write the results as JSON\n"
+        "  --baseline FILE        fail if the results regress against a baseline\n"
+        "  --tolerance T          relative regression tolerated (default: 0.2)\n";
+
+    struct options
+    {
+        std::string session;
+        std::string connection_file;
+        int pid = 0;
+        std::string kernel = "xcpp -f {connection_file}";
+        std::size_t concurrency = 1;
+        std::size_t repeat = 1;
+        double rate = 0.;
+        double timeout = 60.;
+        std::string output;
+        std::string baseline;
+        double tolerance = 0.2;
+    };
+
+    bool parse_options(int argc, char* argv[], options& res)
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string arg = argv[i];
+            if (arg == "--help" || arg == "-h" || i + 1 == argc)
+            {
+                return false;
+            }
+            std::string value = argv[++i];
+            if (arg == "--session")
+            {
+                res.session = value;
+            }
+            else if (arg == "--connection-file")
+            {
+                res.connection_file = value;
+            }
+            else if (arg == "--pid")
+            {
+                res.pid = std::atoi(value.c_str());
+            }
+            else if (arg == "--kernel")
+            {
+                res.kernel = value;
+            }
+            else if (arg == "--concurrency")
+            {
+                res.concurrency = static_cast<std::size_t>(std::max(1l, std::strtol(value.c_str(), nullptr, 10)));
+            }
+            else if (arg == "--repeat")
+            {
+                res.repeat = static_cast<std::size_t>(std::max(1l, std::strtol(value.c_str(), nullptr, 10)));
+            }
+            else if (arg == "--rate")
+            {
+                res.rate = std::max(0., std::atof(value.c_str()));
+            }
+            else if (arg == "--timeout")
+            {
+                res.timeout = std::max(0., std::atof(value.c_str()));
+            }
+            else if (arg == "--output")
+            {
+                res.output = value;
+            }
+            else if (arg == "--baseline")
+            {
+                res.baseline = value;
+            }
+            else if (arg == "--tolerance")
+            {
+                res.tolerance = std::max(0., std::atof(value.c_str()));
+            }
+            else
+            {
+                return false;
+            }
+        }
+        return !res.session.empty();
+    }
+
+    /**************
+     * Connection *
+     **************/
+
+    struct connection
+    {
+        std::string transport;
+        std::string ip;
+        int shell_port = 0;
+        int iopub_port = 0;
+        int control_port = 0;
+        std::string key;
+        std::string signature_scheme;
+
+        std::string endpoint(int port) const
+        {
+            return transport + "://" + ip + ":" + std::to_string(port);
+        }
+    };
+
+    connection read_connection_file(const std::string& path)
+    {
+        nl::json config;
+        std::ifstream(path) >> config;
+        connection res;
+        res.transport = config.value("transport", "tcp");
+        res.ip = config.value("ip", "127.0.0.1");
+        res.shell_port = config["shell_port"];
+        res.iopub_port = config["iopub_port"];
+        res.control_port = config["control_port"];
+        res.key = config.value("key", "");
+        res.signature_scheme = config.value("signature_scheme", "hmac-sha256");
+        return res;
+    }
+
+    int free_port()
+    {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = 0;
+        socklen_t length = sizeof(address);
+        int port = 0;
+        if (bind(fd, reinterpret_cast<sockaddr*>(&address), length) == 0 &&
+            getsockname(fd, reinterpret_cast<sockaddr*>(&address), &length) == 0)
+        {
+            port = ntohs(address.sin_port);
+        }
+        close(fd);
+        return port;
+    }
+
+    std::string random_hex(std::size_t size)
+    {
+        static std::mutex mutex;
+        static std::mt19937_64 generator(std::random_device{}());
+        std::lock_guard<std::mutex> lock(mutex);
+        std::ostringstream os;
+        os << std::hex;
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            os << (generator() & 0xf);
+        }
+        return os.str();
+    }
+
+    // Writes a connection file with free ports of the loopback interface.
+    connection write_connection_file(const std::string& path)
+    {
+        connection res;
+        res.transport = "tcp";
+        res.ip = "127.0.0.1";
+        res.shell_port = free_port();
+        res.iopub_port = free_port();
+        res.control_port = free_port();
+        res.key = random_hex(32);
+        res.signature_scheme = "hmac-sha256";
+        nl::json config = {{"transport", res.transport}, {"ip", res.ip},
+                           {"shell_port", res.shell_port}, {"iopub_port", res.iopub_port},
+                           {"control_port", res.control_port}, {"stdin_port", free_port()},
+                           {"hb_port", free_port()}, {"key", res.key},
+                           {"signature_scheme", res.signature_scheme}};
+        std::ofstream(path) << config.dump(4);
+        return res;
+    }
+
+    pid_t start_kernel(std::string command, const std::string& connection_file)
+    {
+        const std::string placeholder = "{connection_file}";
+        auto pos = command.find(placeholder);
+        if (pos != std::string::npos)
+        {
+            command.replace(pos, placeholder.size(), connection_file);
+        }
+        // Through a shell, so that the command can be found in the PATH and
+        // given with arguments; exec keeps the pid of the kernel.
+        command = "exec " + command;
+        const char* argv[] = {"/bin/sh", "-c", command.c_str(), nullptr};
+        pid_t pid = 0;
+        if (posix_spawn(&pid, "/bin/sh", nullptr, nullptr, const_cast<char**>(argv), environ) != 0)
+        {
+            return 0;
+        }
+        return pid;
+    }
+
+    // Resident set size of a process in bytes, 0 when it cannot be read.
+    double resident_memory(int pid)
+    {
+        if (pid <= 0)
+        {
+            return 0.;
+        }
+        std::ifstream statm("/proc/" + std::to_string(pid) + "/statm");
+        long size = 0;
+        long resident = 0;
+        if (!(statm >> size >> resident))
+        {
+            return 0.;
+        }
+        return static_cast<double>(resident) * static_cast<double>(sysconf(_SC_PAGESIZE));
+    }
+
+    /************
+     * Messages *
+     ************/
+
+    const std::string delimiter = "<IDS|MSG>";
+
+    class channel
+    {
+    public:
+
+        channel(zmq::context_t& context, int type, const connection& config, int port)
+            : m_socket(context, type), m_config(config), m_session(random_hex(32))
+        {
+            m_socket.setsockopt(ZMQ_LINGER, 0);
+            if (type == ZMQ_SUB)
+            {
+                m_socket.setsockopt(ZMQ_SUBSCRIBE, "", 0);
+            }
+            m_socket.connect(config.endpoint(port));
+        }
+
+        // Sends a request and returns its msg_id.
+        std::string send(const std::string& msg_type, const nl::json& content)
+        {
+            std::string msg_id = random_hex(32);
+            nl::json header = {{"msg_id", msg_id}, {"username", "xload"}, {"session", m_session},
+                               {"date", now()}, {"msg_type", msg_type}, {"version", "5.3"}};
+            std::vector<std::string> frames = {header.dump(), "{}", "{}", content.dump()};
+
+            zmq::multipart_t message;
+            message.addstr(delimiter);
+            message.addstr(sign(frames));
+            for (const auto& frame : frames)
+            {
+                message.addstr(frame);
+            }
+            message.send(m_socket);
+            return msg_id;
+        }
+
+        // Waits up to timeout seconds for a message. On success, fills the
+        // header, parent header and content, and the size of the message.
+        bool receive(double timeout, nl::json& header, nl::json& parent_header, nl::json& content,
+                     std::size_t& size)
+        {
+            zmq::pollitem_t items[] = {{static_cast<void*>(m_socket), 0, ZMQ_POLLIN, 0}};
+            zmq::poll(items, 1, static_cast<long>(timeout * 1000));
+            if (!(items[0].revents & ZMQ_POLLIN))
+            {
+                return false;
+            }
+            zmq::multipart_t message(m_socket);
+            size = 0;
+            std::vector<std::string> frames;
+            bool delimited = false;
+            while (!message.empty())
+            {
+                std::string frame = message.popstr();
+                size += frame.size();
+                if (delimited)
+                {
+                    frames.push_back(std::move(frame));
+                }
+                delimited = delimited || frame == delimiter;
+            }
+            if (frames.size() < 5)
+            {
+                return false;
+            }
+            header = nl::json::parse(frames[1]);
+            parent_header = nl::json::parse(frames[2]);
+            content = nl::json::parse(frames[4]);
+            return true;
+        }
+
+    private:
+
+        static std::string now()
+        {
+            std::time_t t = std::time(nullptr);
+            char buffer[32];
+            std::strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&t));
+            return buffer;
+        }
+
+        std::string sign(const std::vector<std::string>& frames) const
+        {
+            if (m_config.key.empty())
+            {
+                return "";
+            }
+            // The signature of the concatenation of the frames is the one of
+            // the frames fed one after the other.
+            std::string data;
+            for (const auto& frame : frames)
+            {
+                data += frame;
+            }
+            unsigned char digest[EVP_MAX_MD_SIZE];
+            unsigned int length = 0;
+            HMAC(EVP_sha256(), m_config.key.data(), static_cast<int>(m_config.key.size()),
+                 reinterpret_cast<const unsigned char*>(data.data()), data.size(), digest, &length);
+            std::ostringstream os;
+            os << std::hex << std::setfill('0');
+            for (unsigned int i = 0; i < length; ++i)
+            {
+                os << std::setw(2) << static_cast<int>(digest[i]);
+            }
+            return os.str();
+        }
+
+        zmq::socket_t m_socket;
+        const connection& m_config;
+        std::string m_session;
+    };
+
+    /***********
+     * Session *
+     ***********/
+
+    struct request
+    {
+        std::string msg_type;
+        nl::json content;
+    };
+
+    // A session is a JSON lines file of the requests sent on the shell
+    // channel: {"msg_type": "execute_request", "content": {"code": "..."}}.
+    // The fields of the content that are not given take the values sent by
+    // the notebook.
+    bool read_session(const std::string& path, std::vector<request>& res)
+    {
+        std::ifstream in(path);
+        if (!in)
+        {
+            std::cerr << path << ": cannot open the session" << std::endl;
+            return false;
+        }
+        const std::map<std::string, nl::json> defaults = {
+            {"execute_request", {{"code", ""}, {"silent", false}, {"store_history", true},
+                                 {"user_expressions", nl::json::object()}, {"allow_stdin", false},
+                                 {"stop_on_error", false}}},
+            {"complete_request", {{"code", ""}}},
+            {"inspect_request", {{"code", ""}, {"detail_level", 0}}},
+            {"is_complete_request", {{"code", ""}}},
+            {"kernel_info_request", nl::json::object()}
+        };
+
+        std::string line;
+        std::size_t number = 0;
+        while (std::getline(in, line))
+        {
+            ++number;
+            if (line.find_first_not_of(" \t\r") == std::string::npos)
+            {
+                continue;
+            }
+            nl::json entry;
+            try
+            {
+                entry = nl::json::parse(line);
+            }
+            catch (const std::exception& e)
+            {
+                std::cerr << path << ":" << number << ": " << e.what() << std::endl;
+                return false;
+            }
+            request r;
+            r.msg_type = entry.value("msg_type", "");
+            auto it = defaults.find(r.msg_type);
+            if (it == defaults.end())
+            {
+                std::cerr << path << ":" << number << ": unsupported message type '" << r.msg_type << "'"
+                          << std::endl;
+                return false;
+            }
+            r.content = it->second;
+            r.content.update(entry.value("content", nl::json::object()));
+            if (r.content.count("code") && !r.content.count("cursor_pos") && r.msg_type != "execute_request" &&
+                r.msg_type != "is_complete_request")
+            {
+                r.content["cursor_pos"] = r.content["code"].get<std::string>().size();
+            }
+            res.push_back(std::move(r));
+        }
+        if (res.empty())
+        {
+            std::cerr << path << ": empty session" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    /***********
+     * Results *
+     ***********/
+
+    struct latencies
+    {
+        std::vector<double> values;
+        std::size_t errors = 0;
+        std::size_t timeouts = 0;
+    };
+
+    double percentile(const std::vector<double>& sorted, double p)
+    {
+        if (sorted.empty())
+        {
+            return 0.;
+        }
+        std::size_t index = static_cast<std::size_t>(p * static_cast<double>(sorted.size() - 1) + 0.5);
+        return sorted[std::min(index, sorted.size() - 1)];
+    }
+
+    class recorder
+    {
+    public:
+
+        void record(const std::string& msg_type, double ms, bool error)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            latencies& l = m_latencies[msg_type];
+            l.values.push_back(ms);
+            l.errors += error ? 1 : 0;
+        }
+
+        void timeout(const std::string& msg_type)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            ++m_latencies[msg_type].timeouts;
+        }
+
+        nl::json summary()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            nl::json res = nl::json::object();
+            for (auto& entry : m_latencies)
+            {
+                auto& values = entry.second.values;
+                std::sort(values.begin(), values.end());
+                res[entry.first] = {{"count", values.size()}, {"errors", entry.second.errors},
+                                    {"timeouts", entry.second.timeouts}, {"p50", percentile(values, 0.5)},
+                                    {"p95", percentile(values, 0.95)}, {"p99", percentile(values, 0.99)},
+                                    {"max", values.empty() ? 0. : values.back()}};
+            }
+            return res;
+        }
+
+    private:
+
+        std::mutex m_mutex;
+        std::map<std::string, latencies> m_latencies;
+    };
+
+    // Replays the session on its own shell socket, with one request in
+    // flight at a time.
+    void replay(zmq::context_t& context, const connection& config, const options& opts,
+                const std::vector<request>& session, recorder& results, std::atomic<bool>& failed)
+    {
+        channel shell(context, ZMQ_DEALER, config, config.shell_port);
+        auto period = std::chrono::duration_cast<clock_type::duration>(
+            std::chrono::duration<double>(opts.rate > 0. ? 1. / opts.rate : 0.));
+        auto next = clock_type::now();
+        for (std::size_t i = 0; i < opts.repeat && !failed; ++i)
+        {
+            for (const auto& r : session)
+            {
+                std::this_thread::sleep_until(next);
+                auto start = clock_type::now();
+                next = start + period;
+                std::string msg_id = shell.send(r.msg_type, r.content);
+
+                nl::json header, parent_header, content;
+                std::size_t size = 0;
+                bool replied = false;
+                while (!replied)
+                {
+                    double left = opts.timeout - std::chrono::duration<double>(clock_type::now() - start).count();
+                    if (left <= 0. || !shell.receive(left, header, parent_header, content, size))
+                    {
+                        break;
+                    }
+                    replied = parent_header.value("msg_id", "") == msg_id;
+                }
+                if (!replied)
+                {
+                    // The kernel is stuck or gone: the next replies could not
+                    // be matched with their requests.
+                    results.timeout(r.msg_type);
+                    failed = true;
+                    return;
+                }
+                double ms = std::chrono::duration<double, std::milli>(clock_type::now() - start).count();
+                results.record(r.msg_type, ms, content.value("status", "") != "ok");
+            }
+        }
+    }
+
+    struct iopub_stats
+    {
+        std::size_t messages = 0;
+        std::size_t bytes = 0;
+    };
+
+    void count_iopub(zmq::context_t& context, const connection& config, std::atomic<bool>& stop, iopub_stats& stats)
+    {
+        channel iopub(context, ZMQ_SUB, config, config.iopub_port);
+        while (!stop)
+        {
+            nl::json header, parent_header, content;
+            std::size_t size = 0;
+            if (iopub.receive(0.1, header, parent_header, content, size))
+            {
+                ++stats.messages;
+                stats.bytes += size;
+            }
+        }
+    }
+
+    bool wait_for_kernel(zmq::context_t& context, const connection& config, double timeout)
+    {
+        channel shell(context, ZMQ_DEALER, config, config.shell_port);
+        std::string msg_id = shell.send("kernel_info_request", nl::json::object());
+        auto start = clock_type::now();
+        nl::json header, parent_header, content;
+        std::size_t size = 0;
+        while (true)
+        {
+            double left = timeout - std::chrono::duration<double>(clock_type::now() - start).count();
+            if (left <= 0. || !shell.receive(left, header, parent_header, content, size))
+            {
+                return false;
+            }
+            if (parent_header.value("msg_id", "") == msg_id)
+            {
+                return true;
+            }
+        }
+    }
+
+    // Compares the results with a baseline, and prints the regressions. The
+    // latencies are allowed an absolute slack of 1 ms and the memory growth
+    // of 16 MB, below which the measures are noise.
+    bool check_baseline(const nl::json& results, const nl::json& baseline, double tolerance)
+    {
+        bool success = true;
+        auto fail = [&success](const std::string& what, double value, double reference)
+        {
+            std::cerr << "Regression: " << what << " is " << value << " (baseline " << reference << ")"
+                      << std::endl;
+            success = false;
+        };
+
+        const nl::json& latency = results["latency"];
+        nl::json reference_latency = baseline.value("latency", nl::json::object());
+        for (auto it = reference_latency.begin(); it != reference_latency.end(); ++it)
+        {
+            if (!latency.count(it.key()))
+            {
+                continue;
+            }
+            for (const char* p : {"p50", "p95", "p99"})
+            {
+                double value = latency[it.key()][p];
+                double reference = it->value(p, value);
+                if (value > reference * (1. + tolerance) + 1.)
+                {
+                    fail(it.key() + " " + p + " latency (ms)", value, reference);
+                }
+            }
+        }
+
+        double throughput = results["iopub"]["messages_per_second"];
+        double reference_throughput = baseline.value("iopub", nl::json::object()).value("messages_per_second", 0.);
+        if (throughput < reference_throughput * (1. - tolerance))
+        {
+            fail("IOPub throughput (messages/s)", throughput, reference_throughput);
+        }
+
+        const nl::json& growth = results["memory"]["growth"];
+        nl::json reference_growth = baseline.value("memory", nl::json::object()).value("growth", nl::json());
+        if (growth.is_number() && reference_growth.is_number())
+        {
+            double value = growth;
+            double reference = reference_growth;
+            if (value > std::max(reference, 0.) * (1. + tolerance) + 16e6)
+            {
+                fail("memory growth (bytes)", value, reference);
+            }
+        }
+        return success;
+    }
+
+    void print_results(const nl::json& results)
+    {
+        std::cout << std::left << std::setw(24) << "Message type" << std::right << std::setw(8) << "Count"
+                  << std::setw(8) << "Errors" << std::setw(12) << "p50 (ms)" << std::setw(12) << "p95 (ms)"
+                  << std::setw(12) << "p99 (ms)" << std::setw(12) << "max (ms)" << "\n";
+        std::cout << std::fixed << std::setprecision(2);
+        for (auto it = results["latency"].begin(); it != results["latency"].end(); ++it)
+        {
+            const nl::json& l = *it;
+            std::cout << std::left << std::setw(24) << it.key() << std::right << std::setw(8)
+                      << l["count"].get<std::size_t>() << std::setw(8) << l["errors"].get<std::size_t>()
+                      << std::setw(12) << l["p50"].get<double>() << std::setw(12) << l["p95"].get<double>()
+                      << std::setw(12) << l["p99"].get<double>() << std::setw(12) << l["max"].get<double>()
+                      << "\n";
+        }
+        const nl::json& iopub = results["iopub"];
+        std::cout << "\nIOPub: " << iopub["messages"].get<std::size_t>() << " messages, "
+                  << iopub["messages_per_second"].get<double>() << " messages/s, "
+                  << iopub["bytes_per_second"].get<double>() / 1e6 << " MB/s\n";
+        const nl::json& memory = results["memory"];
+        if (memory["growth"].is_null())
+        {
+            std::cout << "Memory: not available\n";
+        }
+        else
+        {
+            std::cout << "Memory: " << memory["start"].get<double>() / 1e6 << " MB -> "
+                      << memory["end"].get<double>() / 1e6 << " MB ("
+                      << memory["growth"].get<double>() / 1e6 << " MB)\n";
+        }
+        std::cout << std::flush;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    options opts;
+    if (!parse_options(argc, argv, opts))
+    {
+        std::cerr << usage;
+        return 2;
+    }
+
+    std::vector<request> session;
+    if (!read_session(opts.session, session))
+    {
+        return 2;
+    }
+
+    connection config;
+    pid_t kernel = 0;
+    std::string connection_file = opts.connection_file;
+    if (connection_file.empty())
+    {
+        connection_file = "/tmp/xload-" + random_hex(8) + ".json";
+        config = write_connection_file(connection_file);
+        kernel = start_kernel(opts.kernel, connection_file);
+        if (kernel == 0)
+        {
+            std::cerr << "Could not start the kernel: " << opts.kernel << std::endl;
+            return 2;
+        }
+        opts.pid = kernel;
+    }
+    else
+    {
+        config = read_connection_file(connection_file);
+    }
+
+    int status = 0;
+    {
+        zmq::context_t context;
+        if (!wait_for_kernel(context, config, 60.))
+        {
+            std::cerr << "The kernel did not reply to kernel_info_request" << std::endl;
+            status = 2;
+        }
+        else
+        {
+            std::atomic<bool> stop(false);
+            iopub_stats stats;
+            std::thread listener(count_iopub, std::ref(context), std::cref(config), std::ref(stop), std::ref(stats));
+            // Let the subscription reach the kernel before the first request.
+            std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+            double memory_start = resident_memory(opts.pid);
+            auto start = clock_type::now();
+            recorder results;
+            std::atomic<bool> failed(false);
+            std::vector<std::thread> clients;
+            for (std::size_t i = 0; i < opts.concurrency; ++i)
+            {
+                clients.emplace_back(replay, std::ref(context), std::cref(config), std::cref(opts),
+                                     std::cref(session), std::ref(results), std::ref(failed));
+            }
+            for (auto& client : clients)
+            {
+                client.join();
+            }
+            // The last messages on IOPub may come after the last reply.
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            double elapsed = std::chrono::duration<double>(clock_type::now() - start).count();
+            stop = true;
+            listener.join();
+            double memory_end = resident_memory(opts.pid);
+
+            nl::json summary;
+            summary["latency"] = results.summary();
+            summary["iopub"] = {{"messages", stats.messages}, {"bytes", stats.bytes},
+                                {"messages_per_second", stats.messages / elapsed},
+                                {"bytes_per_second", stats.bytes / elapsed}};
+            summary["memory"] = {{"start", memory_start}, {"end", memory_end},
+                                 {"growth", memory_start > 0. && memory_end > 0. ? nl::json(memory_end - memory_start)
+                                                                                 : nl::json()}};
+            summary["config"] = {{"session", opts.session}, {"concurrency", opts.concurrency},
+                                 {"repeat", opts.repeat}, {"rate", opts.rate}, {"duration", elapsed}};
+            print_results(summary);
+
+            if (!opts.output.empty())
+            {
+                std::ofstream(opts.output) << summary.dump(4) << std::endl;
+            }
+            if (failed)
+            {
+                std::cerr << "A request timed out after " << opts.timeout << " s" << std::endl;
+                status = 1;
+            }
+            if (!opts.baseline.empty())
+            {
+                nl::json baseline;
+                std::ifstream in(opts.baseline);
+                if (!in)
+                {
+                    std::cerr << opts.baseline << ": cannot open the baseline" << std::endl;
+                    status = 2;
+                }
+                else
+                {
+                    in >> baseline;
+                    if (!check_baseline(summary, baseline, opts.tolerance))
+                    {
+                        status = 1;
+                    }
+                }
+            }
+        }
+    }
+
+    if (kernel != 0)
+    {
+        kill(kernel, SIGTERM);
+        waitpid(kernel, nullptr, 0);
+        std::remove(connection_file.c_str());
+    }
+    return status;
+}
@@ -9,10 +9,18 @@
 
 #include "gtest/gtest.h"
 
+#include <atomic>
 #include <functional>
+#include <future>
 #include <iostream>
 #include <list>
+#include <mutex>
+#include <ostream>
+#include <sstream>
 #include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
 #include "xeus-cling/xbuffer.hpp"
 
@@ -33,3 +41,140 @@ TEST(stream, output)
     EXPECT_EQ(outputs.front(), "Some output\n");
     std::cout.rdbuf(cout_strbuf);
 }
+
+struct recorded_outputs
+{
+    std::mutex mutex;
+    std::vector<std::pair<std::string, xcpp::xoutput_origin>> outputs;
+
+    void operator()(const std::string& text, const xcpp::xoutput_origin& origin)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        outputs.emplace_back(text, origin);
+    }
+};
+
+TEST(stream, threads)
+{
+    recorded_outputs recorded;
+    xcpp::xoutput_buffer buffer(std::ref(recorded));
+    std::ostream os(&buffer);
+    auto write = [&os](const std::string& name)
+    {
+        for (int i = 0; i < 1000; ++i)
+        {
+            os << name << " " << i << "\n" << std::flush;
+        }
+    };
+    std::thread first(write, "first");
+    std::thread second(write, "second");
+    first.join();
+    second.join();
+    buffer.flush_all();
+
+    // Each flush publishes whole lines of a single thread.
+    std::size_t lines = 0;
+    for (const auto& output : recorded.outputs)
+    {
+        std::istringstream is(output.first);
+        std::string name;
+        int i = 0;
+        while (is >> name >> i)
+        {
+            EXPECT_TRUE(name == "first" || name == "second");
+            ++lines;
+        }
+    }
+    EXPECT_EQ(lines, 2000u);
+}
+
+TEST(stream, late_output)
+{
+    recorded_outputs recorded;
+    xcpp::xoutput_buffer buffer(std::ref(recorded));
+    std::ostream os(&buffer);
+    std::promise<void> cell_ended;
+    std::promise<void> first_written;
+
+    buffer.begin_cell(1);
+    std::thread worker([&]()
+    {
+        os << "during" << std::flush;
+        first_written.set_value();
+        cell_ended.get_future().wait();
+        os << "after" << std::flush;
+    });
+    first_written.get_future().wait();
+    os << "main" << std::flush;
+    std::vector<std::size_t> running = buffer.end_cell();
+    EXPECT_TRUE(buffer.running(running));
+
+    buffer.begin_cell(2);
+    cell_ended.set_value();
+    worker.join();
+    os << "next" << std::flush;
+    buffer.end_cell();
+    EXPECT_FALSE(buffer.running(running));
+
+    ASSERT_EQ(running.size(), 1u);
+    std::size_t worker_id = running.front();
+    bool after = false;
+    bool finished = false;
+    for (const auto& output : recorded.outputs)
+    {
+        const xcpp::xoutput_origin& origin = output.second;
+        if (output.first == "during" || output.first == "main")
+        {
+            EXPECT_EQ(origin.cell, 1u);
+            EXPECT_TRUE(origin.current);
+        }
+        else if (output.first == "after")
+        {
+            after = true;
+            EXPECT_EQ(origin.thread, worker_id);
+            EXPECT_EQ(origin.cell, 1u);
+            EXPECT_FALSE(origin.current);
+        }
+        else if (output.first == "next")
+        {
+            EXPECT_EQ(origin.cell, 2u);
+            EXPECT_TRUE(origin.current);
+        }
+        finished = finished || (origin.thread == worker_id && origin.finished);
+    }
+    EXPECT_TRUE(after);
+    EXPECT_TRUE(finished);
+}
+
+TEST(stream, flusher)
+{
+    // The threads other than the kernel thread only append and notify, the
+    // callback is called by the thread draining their output.
+    std::vector<std::thread::id> callers;
+    std::atomic<int> notifications(0);
+    xcpp::xoutput_buffer buffer([&callers](const std::string&, const xcpp::xoutput_origin&)
+                                {
+                                    callers.push_back(std::this_thread::get_id());
+                                },
+                                [&notifications]() { ++notifications; });
+    std::ostream os(&buffer);
+    std::thread worker([&os]()
+    {
+        os << "worker" << std::flush;
+    });
+    worker.join();
+    EXPECT_TRUE(callers.empty());
+    EXPECT_EQ(notifications.load(), 1);
+
+    os << "kernel" << std::flush;
+    ASSERT_EQ(callers.size(), 1u);
+    std::thread flusher([&buffer]()
+    {
+        buffer.flush_threads();
+    });
+    std::thread::id flusher_id = flusher.get_id();
+    flusher.join();
+    ASSERT_EQ(callers.size(), 2u);
+    EXPECT_EQ(callers.front(), std::this_thread::get_id());
+    EXPECT_EQ(callers.back(), flusher_id);
+}
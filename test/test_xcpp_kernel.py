@@ -7,6 +7,12 @@
 # The full license is in the file LICENSE, distributed with this software.  #
 #############################################################################
 
+import json
+import os
+import re
+import shutil
+import subprocess
+import tempfile
 import unittest
 import jupyter_kernel_test
 
@@ -51,5 +57,281 @@ class XCppTests(jupyter_kernel_test.KernelTests):
         self.assertEqual(output_msgs[0]['content']['name'], 'stderr')
         self.assertEqual(output_msgs[0]['content']['text'], 'oops')
 
+    def test_xcpp_rerun_cell(self):
+        code = 'int rerun_value = 42;'
+        reply, output_msgs = self.execute_helper(code=code)
+        self.assertEqual(reply['content']['status'], 'ok')
+        reply, output_msgs = self.execute_helper(code=code)
+        self.assertEqual(reply['content']['status'], 'ok')
+
+    def test_xcpp_rerun_edited_cell(self):
+        reply, output_msgs = self.execute_helper(code='int edited_value = 1;')
+        self.assertEqual(reply['content']['status'], 'ok')
+        reply, output_msgs = self.execute_helper(code='int edited_value = 2;')
+        self.assertEqual(reply['content']['status'], 'ok')
+        reply, output_msgs = self.execute_helper(code='edited_value')
+        self.assertEqual(output_msgs[0]['content']['data']['text/plain'], '2')
+        # A cell using the names of the last cell does not unload it.
+        reply, output_msgs = self.execute_helper(code='int edited_twice = edited_value * 2;')
+        self.assertEqual(reply['content']['status'], 'ok')
+        reply, output_msgs = self.execute_helper(code='edited_value + edited_twice')
+        self.assertEqual(output_msgs[0]['content']['data']['text/plain'], '6')
+
+    def test_xcpp_autounload(self):
+        self.execute_helper(code='%autounload identical')
+        reply, output_msgs = self.execute_helper(code='int autounload_value = 1;')
+        self.assertEqual(reply['content']['status'], 'ok')
+        reply, output_msgs = self.execute_helper(code='int autounload_value = 2;')
+        self.assertEqual(reply['content']['status'], 'error')
+        self.execute_helper(code='%autounload edited')
+
+    def test_xcpp_optlevel(self):
+        reply, output_msgs = self.execute_helper(code='%optlevel 2')
+        self.assertEqual(reply['content']['status'], 'ok')
+        reply, output_msgs = self.execute_helper(code='6 * 7')
+        self.assertEqual(reply['content']['metadata']['optlevel'], 2)
+        self.execute_helper(code='%optlevel 0')
+
+    def test_xcpp_background(self):
+        self.execute_helper(code='#include <atomic>\nstd::atomic<int> background_value(0);')
+        reply, output_msgs = self.execute_helper(code='%%background -n answer\nbackground_value = 42;')
+        self.assertEqual(reply['content']['status'], 'ok')
+        self.assertIn('Job', output_msgs[0]['content']['data']['text/plain'])
+        reply, output_msgs = self.execute_helper(code='%wait')
+        self.assertEqual(reply['content']['status'], 'ok')
+        # The kernel updates the display of the job once it completed.
+        updates = [msg for msg in output_msgs if msg['msg_type'] == 'update_display_data']
+        self.assertIn('done', updates[-1]['content']['data']['text/plain'])
+        reply, output_msgs = self.execute_helper(code='background_value.load()')
+        self.assertEqual(output_msgs[0]['content']['data']['text/plain'], '42')
+        reply, output_msgs = self.execute_helper(code='%jobs')
+        self.assertIn('done', output_msgs[0]['content']['data']['text/plain'])
+
+    def test_xcpp_compiletime(self):
+        reply, output_msgs = self.execute_helper(code='%%compiletime\n#include <vector>\nstd::vector<int> compiletime_v(3);')
+        self.assertEqual(reply['content']['status'], 'ok')
+        self.assertEqual(output_msgs[0]['msg_type'], 'display_data')
+        self.assertIn('Parsing headers', output_msgs[0]['content']['data']['text/plain'])
+
+    def test_xcpp_compiletime_excludes_running(self):
+        # The cell sleeps for half a second, which is reported as running
+        # time and not as compilation time.
+        self.execute_helper(code='#include <chrono>\n#include <thread>')
+        reply, output_msgs = self.execute_helper(code='%%compiletime\nstd::this_thread::sleep_for(std::chrono::milliseconds(500));')
+        self.assertEqual(reply['content']['status'], 'ok')
+        text = output_msgs[0]['content']['data']['text/plain']
+        running = float(re.search(r'Running the cell: ([0-9.]+) ms', text).group(1))
+        frontend = float(re.search(r'template instantiation and IR generation: ([0-9.]+) ms', text).group(1))
+        self.assertGreaterEqual(running, 500)
+        self.assertLess(frontend, 500)
+
+    def test_xcpp_cpuinfo(self):
+        reply, output_msgs = self.execute_helper(code='%cpuinfo')
+        self.assertEqual(reply['content']['status'], 'ok')
+        self.assertIn('Host CPU', output_msgs[0]['content']['text'])
+
+    def test_xcpp_disassemble(self):
+        self.execute_helper(code='int disassemble_square(int x) { return x * x; }')
+        reply, output_msgs = self.execute_helper(code='%disassemble disassemble_square')
+        self.assertEqual(reply['content']['status'], 'ok')
+        self.assertIn('ret', output_msgs[0]['content']['data']['text/plain'])
+
+    def test_xcpp_executable(self):
+        # The inline and static functions and the static variables of a
+        # previous cell are used by main.
+        code = ('#include <cstdio>\n'
+                'static int executable_calls = 0;\n'
+                'static const int executable_base = 20;\n'
+                'static int executable_offset(int x) { ++executable_calls; return x + 1; }\n'
+                'inline int executable_twice(int x) { return 2 * x; }')
+        reply, output_msgs = self.execute_helper(code=code)
+        self.assertEqual(reply['content']['status'], 'ok')
+        with tempfile.TemporaryDirectory() as directory:
+            code = ('%%executable ' + os.path.join(directory, 'exe') + ' --run\n'
+                    'int value = executable_twice(executable_base) + executable_offset(1);\n'
+                    'std::printf("%d %d\\n", value, executable_calls);')
+            for run in range(2):
+                reply, output_msgs = self.execute_helper(code=code)
+                self.assertEqual(reply['content']['status'], 'ok')
+                stdout = ''.join(msg['content']['text'] for msg in output_msgs
+                                 if msg['msg_type'] == 'stream' and msg['content']['name'] == 'stdout')
+                self.assertIn('42 1\n', stdout)
+            # The second build of the unchanged session reuses the object.
+            self.assertIn('Reusing the cached object file', stdout)
+
+    def test_xcpp_executable_pgo_exported_profile_file(self):
+        # The profile of the training run is written where the magic asks,
+        # even when the kernel exports LLVM_PROFILE_FILE.
+        code = ('#include <cstdlib>\n'
+                'setenv("LLVM_PROFILE_FILE", "/nonexistent/inherited.profraw", 1);')
+        reply, output_msgs = self.execute_helper(code=code)
+        self.assertEqual(reply['content']['status'], 'ok')
+        with tempfile.TemporaryDirectory() as directory:
+            code = ('%%executable ' + os.path.join(directory, 'pgo') + ' --pgo --repeat 1\n'
+                    'volatile int pgo_sum = 0;\n'
+                    'for (int i = 0; i < 1000; ++i) pgo_sum += i;')
+            reply, output_msgs = self.execute_helper(code=code)
+            self.assertEqual(reply['content']['status'], 'ok')
+            stdout = ''.join(msg['content']['text'] for msg in output_msgs
+                             if msg['msg_type'] == 'stream' and msg['content']['name'] == 'stdout')
+            self.assertIn('Speedup of the profile-guided build', stdout)
+        self.execute_helper(code='unsetenv("LLVM_PROFILE_FILE");')
+
+    def test_xcpp_forkmap(self):
+        reply, output_msgs = self.execute_helper(code='%%forkmap n in {1, 2, 3} -j 2\nint forkmap_square = n * n;\nforkmap_square')
+        self.assertEqual(reply['content']['status'], 'ok')
+        updates = [msg for msg in output_msgs if msg['msg_type'] == 'update_display_data']
+        text = updates[-1]['content']['data']['text/plain']
+        self.assertIn('n = 3: ok', text)
+        self.assertIn(', 9', text)
+
+    def test_xcpp_llvm_ir(self):
+        self.execute_helper(code='int llvm_ir_square(int x) { return x * x; }')
+        reply, output_msgs = self.execute_helper(code='%llvm_ir llvm_ir_square')
+        self.assertEqual(reply['content']['status'], 'ok')
+        self.assertIn('define', output_msgs[0]['content']['data']['text/plain'])
+
+    def test_xcpp_march_reset(self):
+        reply, output_msgs = self.execute_helper(code='%march')
+        default_cpu = output_msgs[0]['content']['text'].split(': ')[1].strip()
+        reply, output_msgs = self.execute_helper(code='%march native')
+        self.assertEqual(reply['content']['status'], 'ok')
+        native_cpu = output_msgs[0]['content']['text'].split(' ')[3]
+        self.execute_helper(code='%reset')
+        reply, output_msgs = self.execute_helper(code='%march')
+        self.assertEqual(output_msgs[0]['content']['text'], 'JIT CPU: ' + native_cpu + '\n')
+        self.execute_helper(code='%march ' + default_cpu)
+
+    def test_xcpp_native(self):
+        self.execute_helper(code='inline int native_factor() { return 3; }')
+        code = '%%native -- -O2\nint native_triple(int x) { return native_factor() * x; }'
+        reply, output_msgs = self.execute_helper(code=code)
+        self.assertEqual(reply['content']['status'], 'ok')
+        self.assertIn('Compiled 1 functions', output_msgs[0]['content']['text'])
+        reply, output_msgs = self.execute_helper(code='native_triple(14)')
+        self.assertEqual(output_msgs[0]['content']['data']['text/plain'], '42')
+        # Running the cell again binds the new definition.
+        code = '%%native -- -O2\nint native_triple(int x) { return native_factor() * x + 1; }'
+        reply, output_msgs = self.execute_helper(code=code)
+        self.assertEqual(reply['content']['status'], 'ok')
+        reply, output_msgs = self.execute_helper(code='native_triple(14)')
+        self.assertEqual(output_msgs[0]['content']['data']['text/plain'], '43')
+
+    def test_xcpp_optreport(self):
+        code = '%%optreport\nint optreport_sum = 0;\nfor (int i = 0; i < 100; ++i) optreport_sum += i;'
+        reply, output_msgs = self.execute_helper(code=code)
+        self.assertEqual(reply['content']['status'], 'ok')
+        self.assertEqual(output_msgs[-1]['msg_type'], 'display_data')
+
+    def test_xcpp_optlevel_reset(self):
+        self.execute_helper(code='%optlevel 2')
+        reply, output_msgs = self.execute_helper(code='%reset')
+        self.assertEqual(reply['content']['status'], 'ok')
+        reply, output_msgs = self.execute_helper(code='%optlevel')
+        self.assertIn('Optimization level: 2', output_msgs[0]['content']['text'])
+        self.execute_helper(code='%optlevel 0')
+
+    def test_xcpp_prun(self):
+        code = '%%prun\nvolatile double prun_x = 0;\nfor (int i = 0; i < 100000000; ++i) prun_x = prun_x + 1;'
+        reply, output_msgs = self.execute_helper(code=code)
+        self.assertEqual(reply['content']['status'], 'ok')
+        self.assertIn('samples', output_msgs[-1]['content']['data']['text/plain'])
+
+    def test_xcpp_run(self):
+        with tempfile.TemporaryDirectory() as directory:
+            filename = os.path.join(directory, 'run_helpers.cpp')
+            with open(filename, 'w') as f:
+                f.write('int run_helper() { return 1; }\n')
+            reply, output_msgs = self.execute_helper(code='%run ' + filename)
+            self.assertEqual(reply['content']['status'], 'ok')
+            reply, output_msgs = self.execute_helper(code='%run ' + filename)
+            self.assertIn('up to date', output_msgs[0]['content']['text'])
+            with open(filename, 'w') as f:
+                f.write('int run_helper() { return 2; }\n')
+            os.utime(filename, (0, 0))
+            reply, output_msgs = self.execute_helper(code='%run ' + filename)
+            self.assertEqual(reply['content']['status'], 'ok')
+            reply, output_msgs = self.execute_helper(code='run_helper()')
+            self.assertEqual(output_msgs[0]['content']['data']['text/plain'], '2')
+
+    def test_xcpp_reload_header(self):
+        with tempfile.TemporaryDirectory() as directory:
+            filename = os.path.join(directory, 'reload_helpers.hpp')
+            with open(filename, 'w') as f:
+                f.write('inline int reload_helper() { return 1; }\n')
+            reply, output_msgs = self.execute_helper(code='#include "' + filename + '"')
+            self.assertEqual(reply['content']['status'], 'ok')
+            with open(filename, 'w') as f:
+                f.write('inline int reload_helper() { return 2; }\n')
+            os.utime(filename, (0, 0))
+            reply, output_msgs = self.execute_helper(code='reload_helper()')
+            self.assertIn('Reloaded', output_msgs[0]['content']['text'])
+            self.assertEqual(output_msgs[-1]['content']['data']['text/plain'], '2')
+
+    def test_xcpp_shell(self):
+        reply, output_msgs = self.execute_helper(code='!echo out; echo err 1>&2; exit 3')
+        self.assertEqual(reply['content']['status'], 'ok')
+        self.assertEqual(reply['content']['metadata']['exit_status'], 3)
+        streams = {msg['content']['name']: msg['content']['text'] for msg in output_msgs if msg['msg_type'] == 'stream'}
+        self.assertEqual(streams['stdout'], 'out\n')
+        self.assertEqual(streams['stderr'], 'err\n')
+
+    def test_xcpp_reset(self):
+        self.execute_helper(code='int reset_value = 42;')
+        reply, output_msgs = self.execute_helper(code='%reset')
+        self.assertEqual(reply['content']['status'], 'ok')
+        self.assertIn('Interpreter reset', output_msgs[0]['content']['text'])
+        reply, output_msgs = self.execute_helper(code='reset_value')
+        self.assertEqual(reply['content']['status'], 'error')
+
+
+class XCppBatchTests(unittest.TestCase):
+
+    @staticmethod
+    def code_cell(source, tags=None):
+        return {'cell_type': 'code', 'execution_count': None, 'metadata': {'tags': tags or []},
+                'outputs': [], 'source': source}
+
+    def execute_notebook(self, cells, *args):
+        # Runs xcpp --execute on a notebook made of cells, returns the exit
+        # status and the written notebook.
+        with tempfile.TemporaryDirectory() as directory:
+            input_path = os.path.join(directory, 'batch.ipynb')
+            output_path = os.path.join(directory, 'batch.out.ipynb')
+            with open(input_path, 'w') as f:
+                json.dump({'cells': cells, 'metadata': {}, 'nbformat': 4, 'nbformat_minor': 4}, f)
+            command = [shutil.which('xcpp'), '--execute', input_path, '--output', output_path, '-std=c++14']
+            process = subprocess.run(command + list(args), stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+            with open(output_path) as f:
+                return process.returncode, json.load(f)['cells']
+
+    def test_xcpp_batch_raises_exception(self):
+        cells = [self.code_cell('int batch_value = 42;'),
+                 self.code_cell('batch_undeclared_name', ['raises-exception']),
+                 self.code_cell('batch_value')]
+        status, cells = self.execute_notebook(cells)
+        self.assertEqual(status, 0)
+        self.assertEqual(cells[1]['outputs'][-1]['output_type'], 'error')
+        self.assertEqual(cells[2]['outputs'][0]['output_type'], 'execute_result')
+        self.assertEqual(cells[2]['outputs'][0]['data']['text/plain'], '42')
+
+    def test_xcpp_batch_error(self):
+        cells = [self.code_cell('batch_undeclared_name'),
+                 self.code_cell('6 * 7')]
+        status, executed = self.execute_notebook(cells)
+        self.assertNotEqual(status, 0)
+        self.assertEqual(executed[0]['outputs'][-1]['output_type'], 'error')
+        self.assertIsNone(executed[1]['execution_count'])
+        self.assertEqual(executed[1]['outputs'], [])
+
+    def test_xcpp_batch_allow_errors(self):
+        cells = [self.code_cell('batch_undeclared_name'),
+                 self.code_cell('6 * 7')]
+        status, executed = self.execute_notebook(cells, '--allow-errors')
+        self.assertNotEqual(status, 0)
+        self.assertEqual(executed[0]['outputs'][-1]['output_type'], 'error')
+        self.assertIsNotNone(executed[1]['execution_count'])
+        self.assertEqual(executed[1]['outputs'][0]['data']['text/plain'], '42')
+
 if __name__ == '__main__':
     unittest.main()